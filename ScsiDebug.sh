@@ -0,0 +1,62 @@
+#!/bin/sh
+
+# exercise the SCSI power path against a scsi_debug disk, so it can be
+# checked without a SAS shelf: loads the module if it isn't already,
+# runs the power options on its disk and reports each one, e.g.
+# sh ScsiDebug.sh, as root.   Any extra arguments go to modprobe.
+
+LOADED=0
+if [ ! -d /sys/bus/pseudo/drivers/scsi_debug ]; then
+	modprobe scsi_debug ptype=0 "$@" || exit 1
+	LOADED=1
+	udevadm settle 2>/dev/null || sleep 2
+fi
+
+DEV=
+for b in /sys/bus/pseudo/drivers/scsi_debug/adapter*/host*/target*/*:*/block/*; do
+	if [ -d "$b" ]; then
+		DEV=/dev/`basename $b`
+		break
+	fi
+done
+if [ -z "$DEV" ]; then
+	echo "no scsi_debug disk found"
+	exit 1
+fi
+
+FAILED=0
+
+# run ataidle with the given arguments and report whether it worked
+check() {
+	desc=$1
+	shift
+	if ./ataidle "$@" $DEV > /dev/null 2>&1; then
+		echo "ok	$desc"
+	else
+		echo "FAIL	$desc: ataidle $* $DEV"
+		FAILED=`expr $FAILED + 1`
+	fi
+}
+
+echo "testing $DEV"
+
+# the made-up IDENTIFY names the drive by its INQUIRY vendor and product
+if ./ataidle $DEV 2>/dev/null | grep -q "^Model:.*scsi_debug"; then
+	echo "ok	IDENTIFY from INQUIRY"
+else
+	echo "FAIL	IDENTIFY from INQUIRY"
+	FAILED=`expr $FAILED + 1`
+fi
+
+check "standby_z timer by MODE SELECT" -S 10m
+check "idle with FORCE_IDLE_0" -i
+check "standby with FORCE_STANDBY_0" -s
+check "spin-up with START STOP UNIT" -u
+check "timer off" -S 0
+
+if [ $LOADED -eq 1 ]; then
+	modprobe -r scsi_debug
+fi
+
+echo "$FAILED failed"
+[ $FAILED -eq 0 ]
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# time a single-drive set or query end to end: run ataidle with the
+# given arguments over and over and report the CPU time each run took,
+# e.g. sh Startup.sh 1000 -W 1 /dev/sda
+
+if [ $# -lt 2 ]; then
+	echo "usage: sh Startup.sh runs ataidle-arguments"
+	exit 1
+fi
+
+RUNS=$1
+shift
+
+i=0
+while [ $i -lt $RUNS ]; do
+	./ataidle "$@" > /dev/null 2>&1
+	i=`expr $i + 1`
+done
+
+# the second line of times is the children's user and system time.
+# times has to run in this shell, not a pipeline's, to see them.
+TIMES=`mktemp`
+times > $TIMES
+sed -n 2p $TIMES | awk -v runs=$RUNS '
+function secs(t) {
+	split(t, p, "m")
+	sub("s", "", p[2])
+	return p[1] * 60 + p[2]
+}
+{
+	user = secs($1)
+	sys = secs($2)
+	printf("%d runs: %.3f ms user, %.3f ms system, %.3f ms CPU per run\n",
+		runs, user * 1000 / runs, sys * 1000 / runs,
+		(user + sys) * 1000 / runs)
+}'
+rm -f $TIMES
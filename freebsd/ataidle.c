@@ -53,17 +53,25 @@
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <ctype.h>
 
 // sys includes
 #include <sys/types.h>
 #include <sys/ata.h>
 #include <sys/ioctl.h>
+#include <sys/disk.h>
+#include <sys/param.h>
+#include <sys/ucred.h>
+#include <sys/mount.h>
 
 // application-specific includes
 #include "ataidle.h"
 #include "../mi/atagen.h"
 #include "../mi/atadefs.h"
 #include "../mi/util.h"
+#include "../mi/devtable.h"
+#include "../mi/gplog.h"
+#include "../mi/scsi.h"
 		
 // open the ata control device, /dev/ata rw
 int ata_open(struct ATA *ata) {
@@ -100,6 +108,12 @@ ata_cmd(struct ATA *ata, int chan, int dev, int atacmd, int drivercmd)
 			ata->atacmd.cmd = ATAREQUEST;
 		}
 		
+		// the SMART commands need the signature in the LBA
+		// registers, which the Linux kernel fills in by itself
+		if(atacmd == ATA__SMART)
+			ata->atacmd.u.request.u.ata.lba =
+				(ata->atacmd.u.request.u.ata.lba & 0xFF) | ATA_SMART_LBA;
+
 		ata->atacmd.u.request.u.ata.command = atacmd;
 		rc = ioctl( ata->fd, IOCATA, &(ata->atacmd) );
 	}
@@ -107,6 +121,49 @@ ata_cmd(struct ATA *ata, int chan, int dev, int atacmd, int drivercmd)
 	return rc;
 }
 
+// return the name of the disk device node for a channel and device:
+// ATAng numbers disks ad0, ad1, ... as two devices per channel,
+// unless a device node has been given explicitly.
+void
+ata_getdevname(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *name, size_t len)
+{
+	if(ata->devpath[0])
+		snprintf(name, len, "%s", ata->devpath);
+	else
+		snprintf(name, len, "/dev/ad%u", (ata_chan * 2) + ata_dev);
+}
+
+// return the size in bytes of an open disk device
+int32_t
+ata_getdevsize(int fd, uint64_t *size)
+{
+	off_t mediasize = 0;
+	int32_t rc = ioctl(fd, DIOCGMEDIASIZE, &mediasize);
+
+	if(rc)
+		perror("error getting device size");
+	else
+		*size = mediasize;
+	return rc;
+}
+
+// return the number of reads and writes completed on the device.
+// Not yet implemented, since it needs devstat(3).
+int32_t
+ata_getiocount(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint64_t *ios)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int32_t
+ata_getiocounts(const char * const *names, size_t n, uint64_t *ios)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
 // initialize the ata_cmd structure with supplied values
 int32_t
 ata_setataparams(struct ATA *ata, int seccount, int count)
@@ -127,10 +184,26 @@ void ata_setfeature_param(struct ATA *ata, int feature_val)
 	ata->atacmd.u.request.u.ata.feature = feature_val;
 }
 
+// return the sector count register following a command
+int
+ata_getresult(struct ATA *ata)
+{
+	return ata->atacmd.u.request.u.ata.count;
+}
+
+// set the LBA registers, for commands such as the EPC SET FEATURES
+// subcommands which pass parameters in them
+void ata_setlba(struct ATA *ata, uint32_t lba)
+{
+	ata->atacmd.u.request.u.ata.lba = lba;
+}
+
+// the data comes back in the log buffer, which stays valid until the
+// next command, as it does on Linux
 void ata_setdataout_params(struct ATA *ata, char ** databuf, int nbytes)
 {
-	*databuf = (char*) malloc(nbytes);
-	if(databuf == 0) { /* malloc failed, there's no way to recover here */
+	*databuf = (char*) ata_logbuf(ata, nbytes);
+	if(*databuf == NULL) { /* malloc failed, there's no way to recover here */
 		fprintf(stderr, "malloc failed. aborting\n");
 		exit(EXIT_FAILURE);
 	}
@@ -186,5 +259,206 @@ void ata_close(struct ATA *ata)
 {
 	if(ata->fd > 0)
 		close(ata->fd);
+	ata_logfree(ata);
+	ata_scsifree(ata);
+}
+
+// SCSI drives are attached through CAM rather than ATAng, so there is
+// nothing to send SCSI commands to here
+int32_t
+ata_scsicmd(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const uint8_t *cdb, size_t cdblen, uint8_t *buf, uint32_t len,
+				enum ata_scsidir dir)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+// set the transfer mode, as SET FEATURES 0x03 encodes it.   ATASMODE
+// has the driver send the command and set up the controller to match,
+// and leaves the other device on the channel as it is.
+int32_t
+ata_setmode(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint8_t mode)
+{
+	if(!ata_devpresent(ata, ata_chan, ata_dev)) {
+		errno = ENXIO;
+		return -1;
+	}
+
+	ata->atacmd.channel = ata_chan;
+	ata->atacmd.device = -1;
+	ata->atacmd.cmd = ATASMODE;
+	ata->atacmd.u.mode.mode[ata_dev] = mode;
+	ata->atacmd.u.mode.mode[!ata_dev] = -1;
+	return ioctl( ata->fd, IOCATA, &(ata->atacmd) );
+}
+
+// ATAng doesn't queue commands, so there is no depth to get or set
+int32_t
+ata_getqueuedepth(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t *depth)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int32_t
+ata_setqueuedepth(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t depth)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+// ATAng leaves the link power management of the host alone
+int32_t
+ata_getlinkpm(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *policy, size_t len)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int32_t
+ata_setlinkpm(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const char *policy)
+{
+	errno = EOPNOTSUPP;
+	return -1;
 }
 
+// read npages pages of a log from page into buf, with READ LOG EXT or,
+// if smart is set, SMART READ LOG, which always starts at the first
+// page but works on drives without General Purpose Logging
+int32_t
+ata_readlogpages(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, uint16_t npages, bool smart,
+				uint8_t *buf)
+{
+	ata_setataparams(ata, npages, 0);
+	ata->atacmd.u.request.data = (caddr_t) buf;
+	ata->atacmd.u.request.count = (uint32_t) npages * 512;
+	ata->atacmd.u.request.flags = ATA_CMD_READ;
+
+	if(smart) {
+		ata_setfeature_param(ata, ATA_SMART_READ_LOG);
+		ata_setlba(ata, log);
+		return ata_cmd(ata, ata_chan, ata_dev, ATA__SMART, 0);
+	}
+
+	// the page number's high byte goes in LBA 39:32, past what
+	// ata_setlba() takes
+	ata->atacmd.u.request.u.ata.lba = log | ((uint64_t) (page & 0xFF) << 8) |
+			((uint64_t) (page >> 8) << 32);
+	return ata_cmd(ata, ata_chan, ata_dev, ATA__READ_LOG_EXT, 0);
+}
+
+// write out the dirty pages for the drive.   There's no syncfs(2),
+// so every filesystem is synced, and the drive's own are counted.
+int32_t
+ata_syncdev(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint32_t *nsynced)
+{
+	struct statfs *mounts;
+	char device[64];
+	int n, i;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	sync();
+
+	*nsynced = 0;
+	n = getmntinfo(&mounts, MNT_NOWAIT);
+	// ad0s1a is on ad0, but ad01 would be a different drive
+	for(i = 0; i < n; i++)
+		if( (strncmp(mounts[i].f_mntfromname, device, strlen(device)) == 0) &&
+				!isdigit((unsigned char) mounts[i].f_mntfromname[strlen(device)]) )
+			(*nsynced)++;
+
+	return 0;
+}
+
+// the per-process I/O accounting the wake monitor uses would come from
+// kvm(3) and libprocstat(3), which aren't supported yet
+int32_t
+ata_getprocio(struct ata_procio **procs, size_t *nprocs)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int32_t
+ata_getprocfiles(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				int32_t pid, uint32_t *nfiles)
+{
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+// hot-plug events would come from devd(8), which isn't supported yet
+int
+ata_hotplugopen(void)
+{
+	return -1;
+}
+
+enum ata_hotplugevent
+ata_hotplugread(int fd, char *devnode, size_t len)
+{
+	return HOTPLUG_NONE;
+}
+
+// fill in the device table by identifying the drive on every channel
+int32_t
+ata_devscan(struct ATA *ata, struct ata_devtable *table)
+{
+	int32_t rc = 0;
+	uint32_t maxchan = 0, i;
+
+	if( ata_getmaxchan(ata, &maxchan) )
+		return -1;
+
+	for(i = 0; !rc && (i < maxchan * 2); i++) {
+		struct ata_ident ident;
+		struct ata_devent *ent;
+		char devpath[64];
+
+		if( !ata_devpresent(ata, i/2, i%2) || ata_ident(ata, i/2, i%2, &ident) )
+			continue;
+
+		ata_getdevname(ata, i/2, i%2, devpath, sizeof(devpath));
+		ent = ata_devtableadd(table, devpath);
+		if(ent == NULL) {
+			rc = -1;
+			break;
+		}
+
+		// both devices on a channel share it, so the
+		// channel is what the scheduler has to limit
+		snprintf(ent->controller, sizeof(ent->controller), "ata%u", i/2);
+		ent->chan = i/2;
+		ent->dev = i%2;
+		ata_identstrings(&ident, ent->model, ent->serial);
+		ata_identwwn(&ident, ent->wwn);
+		rc = ata_devtablekey(table, ent, "serial", ent->serial);
+		if(!rc)
+			rc = ata_devtablekey(table, ent, "wwn", ent->wwn);
+	}
+
+	return rc;
+}
+
+// an adN node gives the channel and device straight away, as
+// ata_getdevname() numbers them
+bool
+ata_devnode(struct ATA *ata, const char *spec, uint32_t *chan, uint32_t *dev)
+{
+	unsigned int n;
+	char c;
+
+	if( sscanf(spec, "/dev/ad%u%c", &n, &c) != 1 )
+		return false;
+
+	snprintf(ata->devpath, sizeof(ata->devpath), "/dev/ad%u", n);
+	*chan = n / 2;
+	*dev = n % 2;
+	return true;
+}
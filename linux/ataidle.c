@@ -44,17 +44,27 @@
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
-#include <math.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mount.h>
 #include <linux/hdreg.h>
+#include <scsi/sg.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <dirent.h>
+#include <sys/sysmacros.h>
 
 // application-specific includes
 #include "ataidle.h"
 #include "../mi/atagen.h"
 #include "../mi/atadefs.h"
 #include "../mi/util.h"
+#include "../mi/devtable.h"
+#include "../mi/gplog.h"
+#include "../mi/scsi.h"
+
+static const char * const ATA_BYID_DIR = "/dev/disk/by-id";
 		
 // open the ata control device, /dev/ata rw
 int ata_open(struct ATA *ata) {
@@ -71,17 +81,31 @@ ata_cmd(struct ATA *ata, int ata_chan, int ata_dev, int cmd, int drivercmd)
 {
 	int32_t rc = 0;
 	int fd = 0;
-	
-	int chan = ata_chan * 2;
-	int devnum = chan + ata_dev;
-	char devchar = 'a' + devnum;
-	char device[20];
-	sprintf(device, "/dev/hd%c", devchar);
+	char device[64];
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
 	fd = open(device, O_RDONLY);
 	if( fd < 0 )
 		rc = -1;
 	
-	if(!rc) {
+	// commands which need the LBA registers have to go through
+	// HDIO_DRIVE_TASK, which takes the full set of registers but
+	// can't transfer data.   The sector count comes back in the
+	// same place as it does for HDIO_DRIVE_CMD.
+	if(!rc && ata->atacmd.lba_valid) {
+		unsigned char task[7];
+
+		task[0] = cmd;
+		task[1] = ata->atacmd.feature;
+		task[2] = ata->atacmd.sector_number;
+		task[3] = ata->atacmd.lba & 0xFF;
+		task[4] = (ata->atacmd.lba >> 8) & 0xFF;
+		task[5] = (ata->atacmd.lba >> 16) & 0xFF;
+		task[6] = 0x40;
+		rc = ioctl( fd, HDIO_DRIVE_TASK, task );
+		ata->atacmd.feature = task[2];
+		close(fd);
+	} else if(!rc) {
 		ata->atacmd.cmd = cmd;
 		rc = ioctl( fd, HDIO_DRIVE_CMD, &ata->atacmd );
 		close(fd);
@@ -90,6 +114,533 @@ ata_cmd(struct ATA *ata, int ata_chan, int ata_dev, int cmd, int drivercmd)
 	return rc;
 }
 
+// libata refuses SET FEATURES 0x03 from user space, since the host
+// controller's timings have to be changed along with the drive's, so
+// the transfer mode can only be limited at boot with libata.force
+int32_t
+ata_setmode(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint8_t mode)
+{
+	printf("the kernel sets the transfer mode: limit it with "
+			"libata.force=<port>:<mode> on the kernel command line\n");
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+// send a SCSI command through SG_IO: an ATA PASS-THROUGH (16) for ATA
+// commands such as READ LOG EXT, which need both the 48-bit registers
+// and a data transfer that the HDIO ioctls can't do, or a native
+// command to a SCSI drive.
+int32_t
+ata_scsicmd(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const uint8_t *cdb, size_t cdblen, uint8_t *buf, uint32_t len,
+				enum ata_scsidir dir)
+{
+	int32_t rc = 0;
+	int fd;
+	char device[64];
+	unsigned char sense[32];
+	sg_io_hdr_t io;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	fd = open(device, O_RDONLY);
+	if( fd < 0 )
+		return -1;
+
+	memset(&io, 0, sizeof(io));
+	memset(sense, 0, sizeof(sense));
+	io.interface_id = 'S';
+	io.cmdp = (unsigned char*) cdb;
+	io.cmd_len = cdblen;
+	io.dxferp = buf;
+	io.dxfer_len = len;
+	io.dxfer_direction = (dir == SCSI_DIR_IN)? SG_DXFER_FROM_DEV :
+			(dir == SCSI_DIR_OUT)? SG_DXFER_TO_DEV : SG_DXFER_NONE;
+	io.sbp = sense;
+	io.mx_sb_len = sizeof(sense);
+	io.timeout = ATA_CMD_TIMEOUT * 1000;
+
+	rc = ioctl( fd, SG_IO, &io );
+	if( !rc && (io.status || io.host_status || (io.driver_status & ~0x08)) ) {
+		errno = EIO;
+		rc = -1;
+	}
+
+	close(fd);
+	return rc;
+}
+
+// read npages pages of a log from page into buf, with READ LOG EXT or,
+// if smart is set, SMART READ LOG, which always starts at the first
+// page but works on drives without General Purpose Logging
+int32_t
+ata_readlogpages(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, uint16_t npages, bool smart,
+				uint8_t *buf)
+{
+	unsigned char cdb[16];
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = 0x85;						// ATA PASS-THROUGH (16)
+	cdb[2] = 0x0E;						// from device, count in sectors
+	cdb[6] = npages & 0xFF;
+	cdb[8] = log;
+	cdb[13] = 0x40;
+	if(smart) {
+		cdb[1] = (4 << 1);				// PIO data-in, 28-bit
+		cdb[4] = ATA_SMART_READ_LOG;
+		cdb[10] = (ATA_SMART_LBA >> 8) & 0xFF;
+		cdb[12] = (ATA_SMART_LBA >> 16) & 0xFF;
+		cdb[14] = ATA__SMART;
+	} else {
+		cdb[1] = (4 << 1) | 1;			// PIO data-in, 48-bit
+		cdb[5] = (npages >> 8) & 0xFF;
+		cdb[10] = page & 0xFF;
+		cdb[9] = (page >> 8) & 0xFF;		// LBA 39:32
+		cdb[14] = ATA__READ_LOG_EXT;
+	}
+
+	return ata_scsicmd(ata, ata_chan, ata_dev, cdb, sizeof(cdb), buf,
+			(uint32_t) npages * 512, SCSI_DIR_IN);
+}
+
+// return the name of the block device node for a channel and device:
+// the master on the first channel is hda, the slave hdb and so on,
+// unless a device node has been given explicitly.
+void
+ata_getdevname(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *name, size_t len)
+{
+	if(ata->devpath[0])
+		snprintf(name, len, "%s", ata->devpath);
+	else
+		snprintf(name, len, "/dev/hd%c", (char) ('a' + (ata_chan * 2) + ata_dev));
+}
+
+// return the size in bytes of an open block device
+int32_t
+ata_getdevsize(int fd, uint64_t *size)
+{
+	int32_t rc = ioctl(fd, BLKGETSIZE64, size);
+
+	if(rc)
+		perror("error getting device size");
+	return rc;
+}
+
+// the path of the queue_depth attribute of the drive's SCSI device,
+// through which libata drives' NCQ depth is set
+static void
+ata_queuedepthpath(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *path, size_t len)
+{
+	char device[64];
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	snprintf(path, len, "/sys/block/%s/device/queue_depth",
+			strrchr(device, '/') + 1);
+}
+
+// return the queue depth the kernel is using with the drive
+int32_t
+ata_getqueuedepth(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t *depth)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int32_t rc;
+
+	ata_queuedepthpath(ata, ata_chan, ata_dev, path, sizeof(path));
+	fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+	rc = (fscanf(fp, "%u", depth) == 1)? 0 : -1;
+	fclose(fp);
+	return rc;
+}
+
+// set the queue depth, which libata caps at what the drive supports;
+// a depth of 1 turns NCQ off
+int32_t
+ata_setqueuedepth(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t depth)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int32_t rc;
+
+	ata_queuedepthpath(ata, ata_chan, ata_dev, path, sizeof(path));
+	fp = fopen(path, "w");
+	if(fp == NULL)
+		return -1;
+	rc = (fprintf(fp, "%u\n", depth) > 0)? 0 : -1;
+	if( fclose(fp) != 0 )
+		rc = -1;
+	return rc;
+}
+
+// the path of the link_power_management_policy attribute of the SCSI
+// host the drive hangs off.   AHCI makes each port a host of its own,
+// so the policy is the drive's, unless it's behind a port multiplier.
+static int32_t
+ata_linkpmpath(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *path, size_t len)
+{
+	char device[64], syspath[PATH_MAX], devpath[PATH_MAX];
+	unsigned int host;
+	int32_t rc = -1;
+	char *p, *save, c;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	snprintf(syspath, sizeof(syspath), "/sys/block/%s/device",
+			strrchr(device, '/') + 1);
+	if(realpath(syspath, devpath) == NULL)
+		return -1;
+
+	for(p = strtok_r(devpath, "/", &save); p != NULL; p = strtok_r(NULL, "/", &save))
+		if( sscanf(p, "host%u%c", &host, &c) == 1 ) {
+			snprintf(path, len,
+					"/sys/class/scsi_host/host%u/link_power_management_policy", host);
+			rc = 0;
+		}
+
+	if(rc)
+		errno = ENOENT;
+	return rc;
+}
+
+// return the host's SATA link power management policy, such as
+// max_performance or min_power
+int32_t
+ata_getlinkpm(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *policy, size_t len)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int32_t rc;
+
+	if( ata_linkpmpath(ata, ata_chan, ata_dev, path, sizeof(path)) )
+		return -1;
+	fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+	rc = (fgets(policy, len, fp) != NULL)? 0 : -1;
+	if(!rc)
+		policy[strcspn(policy, "\n")] = 0;
+	fclose(fp);
+	return rc;
+}
+
+// set it, which libata carries out on the host and the drive, DIPM
+// included, for every policy the kernel knows
+int32_t
+ata_setlinkpm(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const char *policy)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int32_t rc;
+
+	if( ata_linkpmpath(ata, ata_chan, ata_dev, path, sizeof(path)) )
+		return -1;
+	fp = fopen(path, "w");
+	if(fp == NULL)
+		return -1;
+	rc = (fprintf(fp, "%s\n", policy) > 0)? 0 : -1;
+	if( fclose(fp) != 0 )
+		rc = -1;
+	return rc;
+}
+
+// return the number of reads and writes the kernel has completed
+// on the device, from /proc/diskstats
+int32_t
+ata_getiocount(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint64_t *ios)
+{
+	int32_t rc = -1;
+	FILE *fp;
+	char device[64], line[256], name[32];
+	const char *base;
+	unsigned long long reads, writes;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	base = strrchr(device, '/') + 1;
+
+	fp = fopen("/proc/diskstats", "r");
+	if(fp == NULL)
+		return -1;
+
+	while( rc && fgets(line, sizeof(line), fp) ) {
+		if( (sscanf(line, "%*u %*u %31s %llu %*u %*u %*u %llu",
+				name, &reads, &writes) == 3) && (strcmp(name, base) == 0) ) {
+			*ios = reads + writes;
+			rc = 0;
+		}
+	}
+
+	fclose(fp);
+	return rc;
+}
+
+static int
+ata_iocount_cmp(const void *key, const void *name)
+{
+	return strcmp((const char*) key, *(const char * const *) name);
+}
+
+// the same for n devices at once, from a single pass over /proc/diskstats.
+// names are the devices' base names, such as "sda", in strcmp() order,
+// and the count of any not found is left as it is.
+int32_t
+ata_getiocounts(const char * const *names, size_t n, uint64_t *ios)
+{
+	FILE *fp;
+	char line[256], name[32];
+	const char * const *found;
+	unsigned long long reads, writes;
+
+	fp = fopen("/proc/diskstats", "r");
+	if(fp == NULL)
+		return -1;
+
+	while( fgets(line, sizeof(line), fp) ) {
+		if( (sscanf(line, "%*u %*u %31s %llu %*u %*u %*u %llu",
+				name, &reads, &writes) == 3) &&
+				((found = bsearch(name, names, n, sizeof(char*),
+				ata_iocount_cmp)) != NULL) )
+			ios[found - names] = reads + writes;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+static int
+ata_procio_cmp(const void *a, const void *b)
+{
+	return ((const struct ata_procio*) a)->pid - ((const struct ata_procio*) b)->pid;
+}
+
+// sample the storage I/O of every process, from the read_bytes and
+// write_bytes in /proc/<pid>/io, sorted by pid.   Processes which
+// can't be read, such as those which have just exited, are left out.
+int32_t
+ata_getprocio(struct ata_procio **procs, size_t *nprocs)
+{
+	DIR *dir = opendir("/proc");
+	struct dirent *de;
+	struct ata_procio *list = NULL;
+	size_t n = 0, max = 0;
+
+	if(dir == NULL) {
+		perror("error opening /proc");
+		return -1;
+	}
+
+	while( (de = readdir(dir)) != NULL ) {
+		char path[64], line[128];
+		unsigned long long rbytes = 0, wbytes = 0, val;
+		FILE *fp;
+		char *p;
+
+		if( (de->d_name[0] < '1') || (de->d_name[0] > '9') )
+			continue;
+
+		if(n == max) {
+			size_t newmax = (max)? max * 2 : 256;
+			struct ata_procio *newlist = (struct ata_procio*)
+					realloc(list, newmax * sizeof(struct ata_procio));
+			if(newlist == 0) {
+				fprintf(stderr, "malloc failed\n");
+				free(list);
+				closedir(dir);
+				return -1;
+			}
+			list = newlist;
+			max = newmax;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%.16s/io", de->d_name);
+		if( (fp = fopen(path, "r")) == NULL )
+			continue;
+		while( fgets(line, sizeof(line), fp) ) {
+			if( sscanf(line, "read_bytes: %llu", &val) == 1 )
+				rbytes = val;
+			else if( sscanf(line, "write_bytes: %llu", &val) == 1 )
+				wbytes = val;
+		}
+		fclose(fp);
+
+		memset(&list[n], 0, sizeof(struct ata_procio));
+		list[n].pid = atoi(de->d_name);
+		list[n].iobytes = rbytes + wbytes;
+
+		snprintf(path, sizeof(path), "/proc/%.16s/comm", de->d_name);
+		if( (fp = fopen(path, "r")) != NULL ) {
+			if( fgets(list[n].comm, sizeof(list[n].comm), fp) &&
+					((p = strchr(list[n].comm, '\n')) != NULL) )
+				*p = 0;
+			fclose(fp);
+		}
+		n++;
+	}
+
+	closedir(dir);
+	qsort(list, n, sizeof(struct ata_procio), ata_procio_cmp);
+	*procs = list;
+	*nprocs = n;
+
+	return 0;
+}
+
+// collect the device numbers of a disk and its partitions from sysfs
+static size_t
+ata_getdevnums(const char *device, dev_t *nums, size_t max)
+{
+	const char *base = strrchr(device, '/') + 1;
+	char path[PATH_MAX];
+	struct dirent *de;
+	unsigned int major, minor;
+	size_t n = 0;
+	DIR *dir;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/sys/class/block/%s", base);
+	if( (dir = opendir(path)) == NULL )
+		return 0;
+
+	// the disk's own dev file, then one in each partition's directory
+	while( (n < max) && ((de = readdir(dir)) != NULL) ) {
+		if( strcmp(de->d_name, "dev") == 0 )
+			snprintf(path, sizeof(path), "/sys/class/block/%s/dev", base);
+		else if( strncmp(de->d_name, base, strlen(base)) == 0 )
+			snprintf(path, sizeof(path), "/sys/class/block/%s/%s/dev",
+					base, de->d_name);
+		else
+			continue;
+
+		if( (fp = fopen(path, "r")) == NULL )
+			continue;
+		if( fscanf(fp, "%u:%u", &major, &minor) == 2 )
+			nums[n++] = makedev(major, minor);
+		fclose(fp);
+	}
+
+	closedir(dir);
+	return n;
+}
+
+// count the files process pid has open on the drive, either the device
+// itself or one of its partitions, or on a filesystem mounted from one
+int32_t
+ata_getprocfiles(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				int32_t pid, uint32_t *nfiles)
+{
+	char device[64], path[64];
+	dev_t nums[64];
+	size_t nnums, i;
+	struct dirent *de;
+	DIR *dir;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	nnums = ata_getdevnums(device, nums, sizeof(nums)/sizeof(nums[0]));
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+	if( (dir = opendir(path)) == NULL )
+		return -1;
+
+	*nfiles = 0;
+	while( (de = readdir(dir)) != NULL ) {
+		char fdpath[PATH_MAX];
+		struct stat st;
+
+		if(de->d_name[0] == '.')
+			continue;
+		snprintf(fdpath, sizeof(fdpath), "%s/%s", path, de->d_name);
+		if( stat(fdpath, &st) )
+			continue;
+
+		for(i = 0; i < nnums; i++)
+			if( (S_ISBLK(st.st_mode) && (st.st_rdev == nums[i])) ||
+					(st.st_dev == nums[i]) ) {
+				(*nfiles)++;
+				break;
+			}
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+// undo the octal escapes, such as \040 for a space, in a mountinfo field
+static void
+ata_unescape(char *s)
+{
+	char *d = s;
+
+	while(*s) {
+		if( (s[0] == '\\') && (s[1] >= '0') && (s[1] <= '3') &&
+				(s[2] >= '0') && (s[2] <= '7') && (s[3] >= '0') && (s[3] <= '7') ) {
+			*d++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+			s += 4;
+		} else
+			*d++ = *s++;
+	}
+	*d = 0;
+}
+
+// write out the dirty pages for the drive: syncfs() every filesystem
+// mounted from it or one of its partitions, then fsync() the device
+// itself for anything written to it directly.
+int32_t
+ata_syncdev(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, uint32_t *nsynced)
+{
+	char device[64], line[1024];
+	dev_t nums[64];
+	size_t nnums, i;
+	int32_t rc = 0;
+	FILE *fp;
+	int fd;
+
+	ata_getdevname(ata, ata_chan, ata_dev, device, sizeof(device));
+	nnums = ata_getdevnums(device, nums, sizeof(nums)/sizeof(nums[0]));
+	*nsynced = 0;
+
+	fp = fopen("/proc/self/mountinfo", "r");
+	while( (fp != NULL) && fgets(line, sizeof(line), fp) ) {
+		unsigned int major, minor;
+		char mountpoint[PATH_MAX];
+
+		if( sscanf(line, "%*d %*d %u:%u %*s %4095s", &major, &minor, mountpoint) != 3 )
+			continue;
+
+		for(i = 0; i < nnums; i++)
+			if( nums[i] == makedev(major, minor) )
+				break;
+		if(i == nnums)
+			continue;
+
+		ata_unescape(mountpoint);
+		fd = open(mountpoint, O_RDONLY | O_DIRECTORY);
+		if(fd < 0)
+			continue;
+		if( syncfs(fd) )
+			rc = -1;
+		else
+			(*nsynced)++;
+		close(fd);
+	}
+	if(fp != NULL)
+		fclose(fp);
+
+	fd = open(device, O_RDONLY);
+	if( (fd < 0) || fsync(fd) )
+		rc = -1;
+	if(fd >= 0)
+		close(fd);
+
+	return rc;
+}
+
 // initialize the ata_cmd structure with supplied values
 int32_t
 ata_setataparams(struct ATA *ata, int seccount, int count)
@@ -97,17 +648,26 @@ ata_setataparams(struct ATA *ata, int seccount, int count)
 	// clear the structure to remove any random values
 	memset(&ata->atacmd, 0, sizeof(struct ata_cmd));
 	
-	if(seccount != 0)
-		ata->atacmd.sector_number = seccount;
-	else
-		ata->atacmd.sector_count = 1;
+	// the sector count is only set for commands which transfer
+	// data, see ata_setdataout_params(), so that non-data commands
+	// such as SET FEATURES aren't sent as PIO data-in.
+	ata->atacmd.sector_number = seccount;
 	
 	return 0;
 }
 
+// return the sector count register following a non-data command,
+// which HDIO_DRIVE_CMD hands back in the third byte
+int
+ata_getresult(struct ATA *ata)
+{
+	return ata->atacmd.feature;
+}
+
 void ata_setdataout_params(struct ATA *ata, char ** databuf, int nbytes)
 {
 	*databuf = (char*) ata->atacmd.buf;
+	ata->atacmd.sector_count = nbytes / 512;
 }
 
 
@@ -121,36 +681,23 @@ ata_devpresent(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev)
 	return 0;
 }
 
-// return the maximum valid channel id
+// return the maximum valid channel id.   Channels only number the
+// /dev/hdX nodes, of which the first 8 can be addressed, and the
+// result of probing every node for them was never used, so there's
+// no need to open any of them.
 int32_t 
 ata_getmaxchan(struct ATA *ata, uint32_t *maxchan)
 {
-	int rc = 0, fd = 0, ndevs = 0;
-	char devname[15];
-	bool done = false;
-
-	// keep trying to open hdX (a-z), stop when an open fails.
-	while(!done && (ndevs < 26)) {
-		memset(devname, 0, 15);
-		snprintf(devname, 15, "/dev/hd%c", 'a'+ndevs);
-		fd = open(devname, O_RDONLY);
-		if(fd < 0) {
-			done = true;
-		} else {
-			close(fd);
-			ndevs++;
-		}
-	}
-
-	double devs = (double) ndevs;
-	*maxchan = ceil(devs/2);
 	*maxchan = 8;
-	return rc;
+	return 0;
 }
 
 void ata_close(struct ATA *ata)
 {
-	// don't do anything - device is already closed
+	// the device is already closed, there's only the log buffer and
+	// the transports to free
+	ata_logfree(ata);
+	ata_scsifree(ata);
 }
 
 void ata_setfeature_param(struct ATA *ata, int feature)
@@ -158,3 +705,223 @@ void ata_setfeature_param(struct ATA *ata, int feature)
 	ata->atacmd.feature = feature;
 }
 
+// set the LBA registers, for commands such as the EPC SET FEATURES
+// subcommands which pass parameters in them
+void ata_setlba(struct ATA *ata, uint32_t lba)
+{
+	ata->atacmd.lba = lba;
+	ata->atacmd.lba_valid = true;
+}
+
+// open a socket on which the kernel sends a uevent whenever
+// a device is added, changed or removed
+int
+ata_hotplugopen(void)
+{
+	struct sockaddr_nl addr;
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+	if(fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;		// kernel events, rather than udev's
+
+	if( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// read one uevent.   Only events for whole disks are of interest: for
+// those the action is returned and devnode set to the device node,
+// which devtmpfs has already created.
+enum ata_hotplugevent
+ata_hotplugread(int fd, char *devnode, size_t len)
+{
+	char buf[4096];
+	char *p;
+	const char *action = NULL, *subsystem = NULL, *devtype = NULL, *devname = NULL;
+	ssize_t n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+
+	if(n <= 0)
+		return HOTPLUG_NONE;
+	buf[n] = 0;
+
+	// the message is a header followed by NUL separated KEY=value pairs
+	for(p = buf; p < buf + n; p += strlen(p) + 1) {
+		if( strncmp(p, "ACTION=", 7) == 0 )
+			action = p + 7;
+		else if( strncmp(p, "SUBSYSTEM=", 10) == 0 )
+			subsystem = p + 10;
+		else if( strncmp(p, "DEVTYPE=", 8) == 0 )
+			devtype = p + 8;
+		else if( strncmp(p, "DEVNAME=", 8) == 0 )
+			devname = p + 8;
+	}
+
+	if( !action || !subsystem || !devtype || !devname ||
+		strcmp(subsystem, "block") || strcmp(devtype, "disk") )
+		return HOTPLUG_NONE;
+
+	snprintf(devnode, len, "/dev/%s", devname);
+
+	if( strcmp(action, "add") == 0 )
+		return HOTPLUG_ADD;
+	else if( strcmp(action, "change") == 0 )
+		return HOTPLUG_CHANGE;
+	else if( strcmp(action, "remove") == 0 )
+		return HOTPLUG_REMOVE;
+
+	return HOTPLUG_NONE;
+}
+
+// find the controller a disk hangs off from where it sits in the sysfs
+// device tree: the last PCI function in the path, such as 0000:00:1f.2,
+// or failing that the SCSI host.   Drives behind the same HBA or port
+// multiplier then share a controller.
+static void
+ata_getcontroller(const char *devpath, char *ctrl, size_t len)
+{
+	char path[PATH_MAX], syspath[PATH_MAX];
+	const char *devname = strrchr(devpath, '/');
+	char *p, *save;
+
+	// failing anything better the drive is its own controller, under
+	// its device node, cut short if it doesn't fit
+	if( (snprintf(ctrl, len, "%s", devpath) >= (int) len) ||
+			(snprintf(path, sizeof(path), "/sys/class/block/%s",
+			(devname)? devname + 1 : devpath) >= (int) sizeof(path)) ||
+			(realpath(path, syspath) == NULL) )
+		return;
+
+	for(p = strtok_r(syspath, "/", &save); p != NULL; p = strtok_r(NULL, "/", &save)) {
+		unsigned int domain, bus, slot, func;
+		char c;
+
+		if( sscanf(p, "%x:%x:%x.%x%c", &domain, &bus, &slot, &func, &c) == 4 )
+			snprintf(ctrl, len, "%s", p);
+		else if( (strncmp(p, "host", 4) == 0) && (strncmp(ctrl, "/dev/", 5) == 0) )
+			snprintf(ctrl, len, "%s", p);
+	}
+}
+
+// whether a by-id link leads to a drive the commands can be sent to:
+// an ata-, scsi- or wwn- link to a whole sd disk whose SCSI peripheral
+// type is 0, a direct access block device.   The rest lead to device
+// mapper, md, NVMe and optical nodes, or to partitions.
+static bool
+ata_isdisklink(const char *name, const char *devpath)
+{
+	char path[PATH_MAX];
+	const char *p;
+	FILE *fp;
+	int type = -1;
+
+	if( (strncmp(name, "ata-", 4) != 0) && (strncmp(name, "scsi-", 5) != 0) &&
+			(strncmp(name, "wwn-", 4) != 0) )
+		return false;
+
+	if(strncmp(devpath, "/dev/sd", 7) != 0)
+		return false;
+	for(p = devpath + 7; *p; p++)
+		if( (*p < 'a') || (*p > 'z') )
+			return false;
+
+	if( (snprintf(path, sizeof(path), "/sys/class/block/%s/device/type",
+			devpath + 5) >= (int) sizeof(path)) ||
+			((fp = fopen(path, "r")) == NULL) )
+		return false;
+	if(fscanf(fp, "%d", &type) != 1)
+		type = -1;
+	fclose(fp);
+
+	return type == 0;
+}
+
+// fill in the device table from the /dev/disk/by-id links udev creates
+// for SATA and SCSI disks.   The ata- links are named after the drive's model and serial number,
+// with spaces replaced by underscores, and the wwn- links after its WWN,
+// so the drives don't have to be identified to build the table.
+int32_t
+ata_devscan(struct ATA *ata, struct ata_devtable *table)
+{
+	struct dirent **names;
+	int32_t rc = 0;
+	int n, i;
+
+	n = scandir(ATA_BYID_DIR, &names, NULL, alphasort);
+	if(n < 0)
+		return 0;	// no udev, so no drives to address by name
+
+	for(i = 0; i < n; i++) {
+		const char *name = names[i]->d_name;
+		char path[PATH_MAX], devpath[PATH_MAX];
+		struct ata_devent *ent;
+		char *p;
+
+		if( rc || (name[0] == '.') || strstr(name, "-part") )
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", ATA_BYID_DIR, name);
+		if( (realpath(path, devpath) == NULL) || !ata_isdisklink(name, devpath) )
+			continue;
+
+		ent = ata_devtableadd(table, devpath);
+		if(ent == NULL) {
+			rc = -1;
+			continue;
+		}
+
+		if(ent->controller[0] == 0)
+			ata_getcontroller(devpath, ent->controller, sizeof(ent->controller));
+
+		rc = ata_devtablekey(table, ent, "id", name);
+
+		if( strncmp(name, "wwn-", 4) == 0 ) {
+			snprintf(ent->wwn, sizeof(ent->wwn), "%s", name + 4);
+			if(!rc)
+				rc = ata_devtablekey(table, ent, "wwn", ent->wwn);
+		} else if( (strncmp(name, "ata-", 4) == 0) &&
+				((p = strrchr(name, '_')) != NULL) ) {
+			snprintf(ent->byid, sizeof(ent->byid), "%.127s", name);
+			snprintf(ent->serial, sizeof(ent->serial), "%s", p + 1);
+			snprintf(ent->model, sizeof(ent->model), "%.*s",
+					(int) (p - name - 4), name + 4);
+			for(p = ent->model; *p; p++)
+				if(*p == '_')
+					*p = ' ';
+			if(!rc)
+				rc = ata_devtablekey(table, ent, "serial", ent->serial);
+		} else if(ent->byid[0] == 0)
+			snprintf(ent->byid, sizeof(ent->byid), "%.127s", name);
+	}
+
+	for(i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+
+	return rc;
+}
+
+// a block device node, or a link to one such as a /dev/disk/by-id name,
+// is all the commands need to reach the drive
+bool
+ata_devnode(struct ATA *ata, const char *spec, uint32_t *chan, uint32_t *dev)
+{
+	char devpath[PATH_MAX];
+	struct stat st;
+
+	if( (strncmp(spec, "/dev/", 5) != 0) || (realpath(spec, devpath) == NULL) ||
+			(strlen(devpath) >= sizeof(ata->devpath)) ||
+			stat(devpath, &st) || !S_ISBLK(st.st_mode) )
+		return false;
+
+	strcpy(ata->devpath, devpath);
+	*chan = 0;
+	*dev = 0;
+	return true;
+}
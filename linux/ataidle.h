@@ -33,12 +33,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// the first part of this structure is laid out as HDIO_DRIVE_CMD
+// expects it, followed by the data returned by the command.
 struct ata_cmd {
 	unsigned char cmd;
 	unsigned char sector_number;
 	unsigned char feature;
 	unsigned char sector_count;
 	unsigned char buf[512];
+	uint32_t lba;			// LBA registers, sent with HDIO_DRIVE_TASK
+	bool lba_valid;			// if set by ata_setlba()
 };
 
 #endif /* _ATAIDLE_H_ */
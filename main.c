@@ -50,6 +50,21 @@
 #include "mi/atadefs.h"
 #include "mi/util.h"
 #include "mi/atagen.h"		
+#include "mi/bench.h"
+#include "mi/policy.h"
+#include "mi/tune.h"
+#include "mi/epc.h"
+#include "mi/daemon.h"
+#include "mi/devtable.h"
+#include "mi/sched.h"
+#include "mi/wake.h"
+#include "mi/identify.h"
+#include "mi/snapshot.h"
+#include "mi/latency.h"
+#include "mi/spinup.h"
+#include "mi/gplog.h"
+#include "mi/top.h"
+#include "mi/linkpm.h"
 
 #ifdef __FreeBSD__
 	#include <osreldate.h>
@@ -59,34 +74,122 @@
 	#endif
 #endif
 
-extern char * optarg;
-extern int optind, optopt, opterr, optreset;
+extern int optind;
+
+// long names for the options which have them
+static const struct option longopts[] = {
+	{ "epc",	required_argument,	NULL,	'E' },
+	{ "bench",	required_argument,	NULL,	'b' },
+	{ "sweep",	required_argument,	NULL,	'B' },
+	{ "tune",	required_argument,	NULL,	'T' },
+	{ "apply",	no_argument,		NULL,	'a' },
+	{ "policy",	required_argument,	NULL,	'f' },
+	{ "daemon",	no_argument,		NULL,	'D' },
+	{ "who-woke",	no_argument,	NULL,	'w' },
+	{ "flush",	no_argument,		NULL,	'F' },
+	{ "metrics",	required_argument,	NULL,	'M' },
+	{ "jobs",	required_argument,	NULL,	'j' },
+	{ "controller-jobs",	required_argument,	NULL,	'J' },
+	{ "inventory",	required_argument,	NULL,	'n' },
+	{ "snapshot",	required_argument,	NULL,	'k' },
+	{ "restore",	required_argument,	NULL,	'K' },
+	{ "latency",	required_argument,	NULL,	'L' },
+	{ "puis",		required_argument,	NULL,	'U' },
+	{ "spinup",		no_argument,		NULL,	'u' },
+	{ "xfer",		required_argument,	NULL,	'X' },
+	{ "queue-depth",	required_argument,	NULL,	'Q' },
+	{ "tune-depth",	required_argument,	NULL,	'q' },
+	{ "devstats",	no_argument,		NULL,	'G' },
+	{ "top",		required_argument,	NULL,	't' },
+	{ "link-pm",	required_argument,	NULL,	'Z' },
+	{ "link-probe",	required_argument,	NULL,	'z' },
+	{ NULL,		0,					NULL,	0 }
+};
 
 // the main function
 int main( int argc, char ** argv )
 {
 	int rc = 0;
-	int ch, chan, dev = -1;
-	struct ATA *ata = (struct ATA*) malloc(sizeof(struct ATA));
+	int ch, chan = -1, dev = -1;
+	struct ATA atabuf, *ata = &atabuf;
+	struct ata_option opts[argc];
+	int nopts = 0, i;
+	char *arg;
 	long opt_val;
+	uint8_t timer_val;
 	uint32_t maxchan = 0;
 	bool needchandev;
-	char * optstr = "hlA:S:sI:iP:";
+	int nposargs = 0;
+	struct ata_devtable devtable;
+	bool havedevtable = false;
+	long bench_secs = 0;
+	char * sweep = NULL;
+	char * slospec = NULL;
+	char * depthspec = NULL;
+	bool apply = false;
+	bool daemon = false;
+	bool whowoke = false;
+	bool spinup = false;
+	bool devstats = false;
+	long topinterval = 0;
+	const char * metrics = NULL;
+	const char * snapshot = NULL;
+	const char * restore = NULL;
+	long probes = 0;
+	const char * policyfile = ATA_POLICY_FILE;
+	struct ata_policystore policy;
+	long jobs = ATA_SCHED_JOBS;
+	long ctrljobs = ATA_SCHED_CTRLJOBS;
+	char * optstr = "hlA:S:sI:iP:E:W:R:b:B:T:af:DwFM:j:J:n:k:K:L:U:uX:Q:q:Gt:Z:z:";
 
-	if (ata == 0) { /* malloc failed, abort */
-		fprintf(stderr, "malloc failed, aborting.\n");
-		exit(EXIT_FAILURE);
-	}
+	memset(ata, 0, sizeof(struct ATA));
 
-	if( (argc == 1) || (!checkargs(argc, argv, optstr, &needchandev)) )
+	if( (argc == 1) || (!checkargs(argc, argv, optstr, longopts, &needchandev,
+			opts, &nopts)) )
 		usage();
+	nposargs = argc - optind;
 	
 	rc = ata_open(ata);
+
+	// a device node reaches the drive directly, which is what udev
+	// rules and cron jobs use, so they don't pay for finding every drive
+	if(!rc && needchandev && (nposargs == 1)) {
+		uint32_t nodechan, nodedev;
+
+		if( ata_devnode(ata, argv[argc-1], &nodechan, &nodedev) ) {
+			chan = nodechan;
+			dev = nodedev;
+			needchandev = false;
+		}
+	}
+
+	// otherwise a single argument names the drive, by WWN, serial number
+	// or by-id name, so look it up in the device table
+	if(!rc && needchandev && (nposargs == 1)) {
+		struct ata_devent *ent;
+
+		rc = ata_devtablebuild(ata, &devtable);
+		havedevtable = true;
+		ent = (rc)? NULL : ata_devtablefind(&devtable, argv[argc-1]);
+		if(ent == NULL) {
+			printf("no such drive: %s\n", argv[argc-1]);
+			rc = -1;
+		} else {
+			strcpy(ata->devpath, ent->devpath);
+			chan = ent->chan;
+			dev = ent->dev;
+		}
+		needchandev = false;
+	}
 	
-	if(!rc && needchandev)
-		rc = ata_strtolong(argv[argc-2], (long*) &chan);
+	if(!rc && needchandev) {
+		long tmp_lchan;
+		rc = ata_strtolong(argv[argc-2], &tmp_lchan);
+		chan = (int) tmp_lchan;
+	}
 	
-	if(!rc)
+	// only a channel given by number has to be checked
+	if(!rc && needchandev)
 		rc = ata_getmaxchan(ata, &maxchan);
 
 	if( (!rc) && needchandev && ((chan < 0) || (chan > maxchan)) ) {
@@ -107,43 +210,46 @@ int main( int argc, char ** argv )
 	// now we've done all the checking of parameters and everything,
 	// let's see what the user wants us to do.
 	if(!rc) {
-		//optreset = 1;
-		optind = 1;
-		opterr = 1;
+		// -F changes what -s, -S and the daemon do,
+		// so it has to be seen before any of them
+		for(i = 0; i < nopts; i++)
+			if(opts[i].ch == 'F')
+				ata->flush = true;
 		
-		while ((ch = getopt(argc, argv, optstr)) != -1) {
+		for(i = 0; i < nopts; i++) {
+			ch = opts[i].ch;
+			arg = opts[i].arg;
 			switch(ch) {	
 				
 				// S for Standby
 				case 'S':
-					rc = ata_strtolong(optarg, &opt_val);	
+					rc = ata_parsetimer(arg, &timer_val);
 					if(rc)
 						printf("invalid standby value\n");
 					else
-						rc = ata_setstandby( ata, chan, dev, opt_val );
+						rc = ata_setstandby( ata, chan, dev, timer_val );
 					break;
 
 				case 's':
-					rc = ata_setstandby( ata, chan, dev, ATA_IDLEVAL_IMMEDIATE );
+					rc = ata_standbyimmediate( ata, chan, dev );
 					break;
 
 				// I for Idle
 				case 'I':
-					rc = ata_strtolong(optarg, &opt_val);	
-					
+					rc = ata_parsetimer(arg, &timer_val);
 					if(rc)
 						printf("invalid idle value\n");
 					else
-						rc = ata_setidle( ata, chan, dev, opt_val );
+						rc = ata_setidle( ata, chan, dev, timer_val );
 					break;
 
 				case 'i':
-					rc = ata_setidle(ata, chan, dev, ATA_IDLEVAL_IMMEDIATE);
+					rc = ata_idleimmediate( ata, chan, dev );
 					break;
 
 				// A for AutoAcoustic
 				case 'A':
-					rc = ata_strtolong(optarg, &opt_val);
+					rc = ata_strtolong(arg, &opt_val);
 					if(rc)
 							printf("invalid acoustic value\n");
 					else 
@@ -152,16 +258,212 @@ int main( int argc, char ** argv )
 		
 				// P for APM
 				case 'P':
-					rc = ata_strtolong(optarg, &opt_val);
+					rc = ata_strtolong(arg, &opt_val);
 					if(rc)
 							printf("invalid apm value\n");
 					else
 							rc = ata_setapm( ata, chan, dev, opt_val );
 					break;
 				
+				// E for Extended Power Conditions timers
+				case 'E':
+					rc = ata_setepc( ata, chan, dev, arg );
+					break;
+
+				// W for Write cache
+				case 'W':
+					rc = ata_strtolong(arg, &opt_val);
+					if(rc)
+							printf("invalid write cache value\n");
+					else
+							rc = ata_setwritecache( ata, chan, dev, opt_val );
+					break;
+
+				// R for Read look-ahead
+				case 'R':
+					rc = ata_strtolong(arg, &opt_val);
+					if(rc)
+							printf("invalid look-ahead value\n");
+					else
+							rc = ata_setlookahead( ata, chan, dev, opt_val );
+					break;
+
+				// b for benchmark: run after all the settings are applied
+				case 'b':
+					rc = ata_strtolong(arg, &bench_secs);
+					if( rc || (bench_secs < 2) ) {
+						printf("invalid benchmark duration\n");
+						rc = -1;
+					}
+					break;
+
+				// B to benchmark each APM or AAC level in turn
+				case 'B':
+					sweep = arg;
+					break;
+
+				// T to tune APM and AAC for an objective
+				case 'T':
+					slospec = arg;
+					break;
+
+				// Q for the NCQ queue depth
+				case 'Q':
+					rc = ata_strtolong(arg, &opt_val);
+					if( rc || (opt_val < 1) ) {
+						printf("invalid queue depth\n");
+						rc = -1;
+					} else if( (rc = ata_setqueuedepth(ata, chan, dev, opt_val)) )
+						perror("Set queue depth failed");
+					else
+						printf("Queue depth set to %ld\n", opt_val);
+					break;
+
+				// q to tune the queue depth for an objective
+				case 'q':
+					depthspec = arg;
+					break;
+
+				// a to apply the drive's policy
+				case 'a':
+					apply = true;
+					break;
+
+				// D to run as a daemon
+				case 'D':
+					daemon = true;
+					break;
+
+				// M for the daemon's metrics file
+				case 'M':
+					metrics = arg;
+					break;
+
+				// F for flush, seen above
+				case 'F':
+					break;
+
+				// U for power-up in standby
+				case 'U':
+					rc = ata_strtolong(arg, &opt_val);
+					if(rc)
+						printf("invalid power-up in standby value\n");
+					else
+						rc = ata_setpuis( ata, chan, dev, opt_val );
+					break;
+
+				// X for the transfer mode
+				case 'X':
+					rc = ata_setxfermode( ata, chan, dev, arg );
+					break;
+
+				// Z for the host's link power policy
+				case 'Z':
+					rc = ata_linkpmset( ata, chan, dev, arg );
+					break;
+
+				// z measures what each link power policy adds to
+				// the first read after the link has been idle
+				case 'z':
+					rc = ata_strtolong(arg, &opt_val);
+					if( rc || (opt_val < 1) ) {
+						printf("invalid number of probes\n");
+						rc = -1;
+					} else
+						rc = ata_linkpmprobe( ata, chan, dev, opt_val );
+					break;
+
+				// u spins up the given drive, or every drive in
+				// the policy's order, once it's been loaded
+				case 'u':
+					if(needchandev || ata->devpath[0])
+						rc = ata_spinup( ata, chan, dev );
+					else
+						spinup = true;
+					break;
+
+				// G reads the given drive's Device Statistics, or
+				// every drive's once the jobs limits are known
+				case 'G':
+					if(needchandev || ata->devpath[0]) {
+						struct ata_devstats stats;
+
+						rc = ata_devstatsread( ata, chan, dev, &stats );
+						if(rc)
+							perror("error reading the Device Statistics log");
+						else
+							ata_devstatsshow( &stats );
+					} else
+						devstats = true;
+					break;
+
+				// t for the live view, every so many seconds
+				case 't':
+					rc = ata_strtolong(arg, &opt_val);
+					if( rc || (opt_val < 1) ) {
+						printf("invalid interval\n");
+						rc = -1;
+					} else
+						topinterval = opt_val;
+					break;
+
+				// w to find out who wakes the drives up
+				case 'w':
+					whowoke = true;
+					break;
+
+				// f for the policy file
+				case 'f':
+					policyfile = arg;
+					break;
+
+				// j and J limit the commands in flight across all the
+				// drives, and on any one controller
+				case 'j':
+				case 'J':
+					rc = ata_strtolong(arg, &opt_val);
+					if( rc || (opt_val < 1) ) {
+						printf("invalid number of jobs\n");
+						rc = -1;
+					} else if(ch == 'j')
+						jobs = opt_val;
+					else
+						ctrljobs = opt_val;
+					break;
+
+				// k and K to snapshot and restore every drive's settings
+				case 'k':
+					snapshot = arg;
+					break;
+
+				case 'K':
+					restore = arg;
+					break;
+
+				// L to probe every drive's command latency
+				case 'L':
+					rc = ata_strtolong(arg, &opt_val);
+					if( rc || (opt_val < 1) ) {
+						printf("invalid number of probes\n");
+						rc = -1;
+					} else
+						probes = opt_val;
+					break;
+
+				// n to list the drives in a file of IDENTIFY pages
+				case 'n':
+					rc = ata_inventory(arg);
+					break;
+
 				case 'l':
 					printf("Listing Devices:\n\n");
 					ata_listdevices(ata);
+					if( !havedevtable && !ata_devtablebuild(ata, &devtable) )
+						havedevtable = true;
+					if(havedevtable) {
+						ata_devtableidentify(&devtable, jobs, ctrljobs);
+						ata_devtablelist(&devtable);
+					}
 					break;
 					
 				// h is help
@@ -172,18 +474,206 @@ int main( int argc, char ** argv )
 		}
 	}
 
-	// fall-through: check if we've just got 2 arguments,
-	// the channel and device: if so, just show information
+	// the policy is applied and tuning done once all the options
+	// have been read, since they depend on the policy file.
+	if( !rc && (apply || slospec || depthspec || daemon || spinup || topinterval) ) {
+		rc = ata_policyload(&policy, policyfile);
+		if(rc)
+			printf("could not load policy file %s\n", policyfile);
+
+		// drives are spun up before anything else is done to them
+		if(!rc && spinup) {
+			if(!havedevtable)
+				rc = ata_devtablebuild(ata, &devtable);
+			havedevtable = true;
+			if(!rc)
+				rc = ata_spinupall(&devtable, &policy, jobs, ctrljobs);
+		}
+
+		// with no drive given, the policy goes to every drive
+		if(!rc && apply && (needchandev || ata->devpath[0]))
+			rc = ata_policyapplydev(ata, chan, dev, &policy);
+		else if(!rc && apply) {
+			if(!havedevtable)
+				rc = ata_devtablebuild(ata, &devtable);
+			havedevtable = true;
+			if(!rc)
+				rc = ata_policyapplyall(&devtable, &policy, jobs, ctrljobs);
+		}
+
+		if(!rc && slospec) {
+			struct ata_slo slo;
+
+			rc = ata_parseslo(slospec, &slo);
+			if(!rc)
+				rc = ata_autotune(ata, chan, dev, (bench_secs)? bench_secs : 4,
+								&slo, &policy);
+			bench_secs = 0;
+		}
+
+		if(!rc && depthspec) {
+			struct ata_slo slo;
+
+			rc = ata_parseslo(depthspec, &slo);
+			if(!rc)
+				rc = ata_tunedepth(ata, chan, dev, (bench_secs)? bench_secs : 4,
+								&slo, &policy);
+			bench_secs = 0;
+		}
+
+		// the daemon manages the given drive, or
+		// every drive which has a ladder policy
+		if(!rc && daemon) {
+			struct ata_daemon d;
+			uint32_t i;
+
+			memset(&d, 0, sizeof(d));
+			d.interval = 1;
+			d.store = &policy;
+			d.metrics = metrics;
+
+			if(needchandev || ata->devpath[0])
+				rc = (ata_daemonadd(ata, &d, chan, dev, &policy) < 0)? -1 : 0;
+			else {
+				if(!havedevtable)
+					rc = ata_devtablebuild(ata, &devtable);
+				havedevtable = true;
+
+				for(i = 0; !rc && (i < devtable.nents); i++) {
+					strcpy(ata->devpath, devtable.ents[i].devpath);
+					rc = (ata_daemonadd(ata, &d, devtable.ents[i].chan,
+								devtable.ents[i].dev, &policy) < 0)? -1 : 0;
+				}
+				ata->devpath[0] = 0;
+			}
+
+			if(!rc)
+				rc = ata_daemonrun(ata, &d);
+			ata_daemonfree(&d);
+		}
+
+		// the live view shows the given drive, or every drive, against
+		// its standby time from the policy
+		if(!rc && topinterval) {
+			struct ata_top t;
+			uint32_t i;
+
+			memset(&t, 0, sizeof(t));
+			t.interval = topinterval;
+			t.store = &policy;
+
+			if(needchandev || ata->devpath[0])
+				rc = ata_topadd(ata, &t, chan, dev);
+			else {
+				if(!havedevtable)
+					rc = ata_devtablebuild(ata, &devtable);
+				havedevtable = true;
+
+				for(i = 0; !rc && (i < devtable.nents); i++) {
+					strcpy(ata->devpath, devtable.ents[i].devpath);
+					rc = ata_topadd(ata, &t, devtable.ents[i].chan,
+								devtable.ents[i].dev);
+				}
+				ata->devpath[0] = 0;
+			}
+
+			if(!rc)
+				rc = ata_toprun(ata, &t);
+			ata_topfree(&t);
+		}
+
+		ata_policyfree(&policy);
+	}
+
+	// snapshots cover every drive, once the jobs limits are known
+	if( !rc && (snapshot || restore) ) {
+		if(!havedevtable)
+			rc = ata_devtablebuild(ata, &devtable);
+		havedevtable = true;
+		if(!rc && snapshot)
+			rc = ata_snapshot(&devtable, snapshot, jobs, ctrljobs);
+		if(!rc && restore)
+			rc = ata_restore(&devtable, restore, jobs, ctrljobs);
+	}
+
+	// as does the latency probe, which compares each drive with its peers
+	if(!rc && probes) {
+		if(!havedevtable)
+			rc = ata_devtablebuild(ata, &devtable);
+		havedevtable = true;
+		if(!rc)
+			rc = ata_latencyprobe(&devtable, probes, jobs, ctrljobs);
+	}
+
+	// and the statistics of every drive are read in parallel
+	if(!rc && devstats) {
+		if(!havedevtable)
+			rc = ata_devtablebuild(ata, &devtable);
+		havedevtable = true;
+		if(!rc)
+			rc = ata_devstatsall(&devtable, jobs, ctrljobs);
+	}
+
+	// the wake monitor watches the given drive, or every drive
+	if(!rc && whowoke) {
+		struct ata_wakemon mon;
+		uint32_t i;
+
+		memset(&mon, 0, sizeof(mon));
+		mon.interval = 1;
+
+		if(needchandev || ata->devpath[0])
+			rc = (ata_wakeadd(ata, &mon, chan, dev) < 0)? -1 : 0;
+		else {
+			if(!havedevtable)
+				rc = ata_devtablebuild(ata, &devtable);
+			havedevtable = true;
+
+			for(i = 0; !rc && (i < devtable.nents); i++) {
+				strcpy(ata->devpath, devtable.ents[i].devpath);
+				rc = (ata_wakeadd(ata, &mon, devtable.ents[i].chan,
+							devtable.ents[i].dev) < 0)? -1 : 0;
+			}
+			ata->devpath[0] = 0;
+		}
+
+		if(!rc)
+			rc = ata_wakerun(ata, &mon);
+		ata_wakefree(&mon);
+	}
+
+	// the benchmark runs last, so that it measures the drive
+	// with any settings given on the same command line.
+	if( !rc && (bench_secs || sweep) ) {
+		struct ata_benchresult res;
+
+		if(bench_secs == 0)
+			bench_secs = 10;
+
+		if(sweep)
+			rc = ata_benchsweep(ata, chan, dev, bench_secs, sweep);
+		else {
+			rc = ata_bench(ata, chan, dev, bench_secs, &res);
+			if(!rc) {
+				ata_printbenchheader("");
+				ata_printbenchresult("", &res);
+			}
+		}
+	}
+
+	// fall-through: check if we've just got the channel and
+	// device, or the drive's name: if so, just show information
 	// about that device.
-	if( argc == 3 && !rc ) {
+	if( (nposargs == argc - 1) && !rc ) {
 		printf("Device Info:\n\n");
 		ata_showdeviceinfo(ata, chan, dev);
 	}
 
 	// if we successfully opened the ata control
 	// device, now's the time to close it.
+	if(havedevtable)
+		ata_devtablefree(&devtable);
 	ata_close(ata);
-	free(ata);
 	
 	return rc;
 }
@@ -7,21 +7,65 @@
 static const uint32_t ATA__SETFEATURES			= 0xEF;
 static const uint32_t ATA__IDENTIFY				= 0xEC;
 static const uint32_t ATA__ATAPI_IDENTIFY		= 0xA1;
+static const uint32_t ATA__READ_LOG_EXT			= 0x2F;
+static const uint32_t ATA__SMART				= 0xB0;
 static const uint32_t ATA_IDLE					= 0xE3;
 static const uint32_t ATA_IDLE_IMMEDIATE		= 0xE1;
 static const uint32_t ATA_STANDBY				= 0xE2;
 static const uint32_t ATA_STANDBY_IMMEDIATE 	= 0xE0;
+static const uint32_t ATA_UNLOAD_FEATURE		= 0x44;
+static const uint32_t ATA_UNLOAD_LBA			= 0x554E4C;
 static const uint32_t ATA_AUTOACOUSTIC_ENABLE 	= 0x42;
 static const uint32_t ATA_AUTOACOUSTIC_DISABLE	= 0xC2;
 static const uint32_t ATA_APM_ENABLE			= 0x05;
 static const uint32_t ATA_APM_DISABLE			= 0x85;
+static const uint32_t ATA_WCACHE_ENABLE			= 0x02;
+static const uint32_t ATA_WCACHE_DISABLE		= 0x82;
+static const uint32_t ATA_LOOKAHEAD_ENABLE		= 0xAA;
+static const uint32_t ATA_LOOKAHEAD_DISABLE		= 0x55;
+static const uint32_t ATA_PUIS_ENABLE			= 0x06;
+static const uint32_t ATA_PUIS_DISABLE			= 0x86;
+static const uint32_t ATA_PUIS_SPINUP			= 0x07;
+static const uint32_t ATA_XFER_PIO			= 0x08;	// SET FEATURES 0x03 modes,
+static const uint32_t ATA_XFER_MDMA			= 0x20;	// in the sector count
+static const uint32_t ATA_XFER_UDMA			= 0x40;
+static const uint32_t ATA_IDENT_SPINUP_PARTIAL	= 0x37C8;	// IDENTIFY word 2 of a drive
+static const uint32_t ATA_IDENT_SPINUP_FULL		= 0x738C;	// needing ATA_PUIS_SPINUP, before
+														// and after the page is complete
+static const uint32_t ATA_EPC					= 0x4A;
+static const uint32_t ATA_EPC_SET_TIMER			= 0x02;
+static const uint32_t ATA_EPC_ENABLE			= 0x04;
+static const uint32_t ATA_EPC_DISABLE			= 0x05;
+static const uint32_t ATA_LOG_DIRECTORY		= 0x00;
+static const uint32_t ATA_LOG_DEVICE_STATISTICS	= 0x04;
+static const uint32_t ATA_LOG_POWER_CONDITIONS	= 0x08;
+static const uint32_t ATA_SMART_READ_DATA		= 0xD0;
+static const uint32_t ATA_SMART_READ_LOG		= 0xD5;
+static const uint32_t ATA_SMART_LBA				= 0xC24F00;
+static const uint32_t ATA_SMART_START_STOP		= 4;
+static const uint32_t ATA_SMART_LOAD_CYCLE		= 193;
 static const uint32_t ATA_AUTOACOUSTIC_MAXPERF 	= 0xFE;
 static const uint32_t ATA_AUTOACOUSTIC_MINPERF 	= 0x80;
 static const uint32_t ATA_APM_MINPOWER_NO_STANDBY = 0x80;
 static const uint32_t ATA_APM_MINPERF			= 0x01;
 static const uint32_t ATA_APM_MAXPERF			= 0xFE;
 static const uint32_t ATA_POWERSTATUS_GET		= 0xE5;
+static const uint32_t ATA_FLUSH_CACHE			= 0xE7;
+static const uint32_t ATA_FLUSH_CACHE_EXT		= 0xEA;
+static const uint32_t ATA_POWERMODE_STANDBY		= 0x00;
+static const uint32_t ATA_POWERMODE_STANDBY_Y	= 0x01;	// EPC
+static const uint32_t ATA_POWERMODE_IDLE		= 0x80;
+static const uint32_t ATA_POWERMODE_IDLE_C		= 0x83;	// EPC idle_a to idle_c after IDLE
+static const uint32_t ATA_POWERMODE_ACTIVE		= 0xFF;
 static const uint32_t ATA_CMD_TIMEOUT			= 10;
-static const uint32_t ATA_IDLEVAL_IMMEDIATE		= 900;
+static const uint8_t  ATA_TIMER_VENDOR			= 253;
+
+#ifdef __FreeBSD__
+static const char * const ATA_POLICY_FILE		= "/usr/local/etc/ataidle.conf";
+static const char * const ATA_WEAR_FILE			= "/var/db/ataidle.wear";
+#else
+static const char * const ATA_POLICY_FILE		= "/etc/ataidle.conf";
+static const char * const ATA_WEAR_FILE			= "/var/lib/ataidle.wear";
+#endif
 
 #endif
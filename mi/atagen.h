@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __FreeBSD__
 	#include <sys/ata.h>
@@ -79,21 +80,63 @@ struct ATA {
 	uint32_t dev;
 	uint32_t cmd;
 	struct ata_cmd atacmd;
+	char devpath[64];	// device node to use instead of chan and dev
+	char label[80];		// for messages, from ata_devlabel()
+	bool flush;			// flush dirty data before any standby
+	uint8_t *logbuf;	// data buffer kept between commands, see ata_logbuf()
+	size_t logbuflen;
+	struct ata_transport *transports;	// each drive's, see ata_isscsi()
+	size_t ntransports;
+	size_t maxtransports;
 };
 
+// uevents the daemon acts on, from ata_hotplugread()
+enum ata_hotplugevent {
+	HOTPLUG_NONE,
+	HOTPLUG_ADD,
+	HOTPLUG_CHANGE,
+	HOTPLUG_REMOVE
+};
+
+
+// a process's storage I/O, from ata_getprocio()
+struct ata_procio {
+	int32_t		pid;
+	char		comm[17];
+	uint64_t	iobytes;	// bytes it has caused to be read or written
+};
+
+// the direction of a SCSI command's data, for ata_scsicmd()
+enum ata_scsidir {
+	SCSI_DIR_NONE,
+	SCSI_DIR_IN,		// from the drive
+	SCSI_DIR_OUT
+};
 
 int     ata_open( struct ATA *ata );
 void	ata_close(struct ATA *ata );
 int32_t ata_setidle( struct ATA *ata, uint32_t ata_chan, 
-				uint32_t ata_dev, uint32_t idle_mins );
+				uint32_t ata_dev, uint8_t timer_val );
+int32_t ata_idleimmediate( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
 
 int32_t ata_setstandby( struct ATA *ata, uint32_t ata_chan, 
-				uint32_t ata_dev, uint32_t standby_mins );
+				uint32_t ata_dev, uint8_t timer_val );
+int32_t ata_setstandbytimer( struct ATA *ata, uint32_t ata_chan,
+				uint32_t ata_dev, uint8_t timer_val );
+int32_t ata_standbyimmediate( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
 int32_t ata_getmaxchan( struct ATA *ata, uint32_t *maxchan );
 int32_t ata_setacoustic(struct ATA *ata, int ata_chan, 
 				int ata_dev, uint32_t acoustic_val);
 int32_t ata_setapm( struct ATA *ata, int ata_chan, 
 				int ata_dev, uint32_t apm_val);
+int32_t ata_setwritecache( struct ATA *ata, int ata_chan,
+				int ata_dev, uint32_t wc_val);
+int32_t ata_setlookahead( struct ATA *ata, int ata_chan,
+				int ata_dev, uint32_t la_val);
+int32_t ata_setpuis( struct ATA *ata, int ata_chan,
+				int ata_dev, uint32_t puis_val);
+int32_t ata_setxfermode( struct ATA *ata, int ata_chan,
+				int ata_dev, const char *spec);
 int32_t ata_cmd(struct ATA *ata, int chan, int dev, int atacmd, 
 				int drivercmd );
 void    ata_listdevices( struct ATA *ata );
@@ -104,6 +147,43 @@ void    ata_showdeviceinfo( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev
 void 	ata_setfeature_param( struct ATA *ata, int feature_val);
 int32_t ata_setataparams( struct ATA *ata, int seccount, int count);
 void    ata_setdataout_params( struct ATA *ata, char ** databuf, int nbytes);
+void    ata_setlba( struct ATA *ata, uint32_t lba );
+int32_t ata_readlogpages( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, uint16_t npages, bool smart,
+				uint8_t *buf );
+int32_t ata_scsicmd( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const uint8_t *cdb, size_t cdblen, uint8_t *buf, uint32_t len,
+				enum ata_scsidir dir );
+int32_t ata_setmode( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t mode );
+int     ata_getresult( struct ATA *ata );
+int32_t ata_getpowermode( struct ATA *ata, uint32_t ata_chan,
+				uint32_t ata_dev, uint8_t *mode );
+int32_t ata_unload( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+int32_t ata_smartread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char **databuf );
+int32_t ata_flush( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+int32_t ata_syncdev( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t *nsynced );
+int32_t ata_getiocount( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint64_t *ios );
+int32_t ata_getiocounts( const char * const *names, size_t n, uint64_t *ios );
+int32_t ata_getlinkpm( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *policy, size_t len );
+int32_t ata_setlinkpm( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const char *policy );
+int32_t ata_getqueuedepth( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t *depth );
+int32_t ata_setqueuedepth( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t depth );
+int32_t ata_getprocio( struct ata_procio **procs, size_t *nprocs );
+int32_t ata_getprocfiles( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				int32_t pid, uint32_t *nfiles );
+int     ata_hotplugopen( void );
+enum ata_hotplugevent ata_hotplugread( int fd, char *devnode, size_t len );
+void    ata_getdevname( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *name, size_t len);
+int32_t ata_getdevsize( int fd, uint64_t *size );
 
 #endif /* _ATAIDLE_H_ */
 
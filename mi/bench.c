@@ -0,0 +1,499 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// read-only throughput and latency benchmark, used to quantify what
+// a given APM or AAC setting costs in performance.   All reads are
+// done with O_DIRECT so that the page cache doesn't hide the drive.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "bench.h"
+
+static const uint32_t BENCH_SEQ_BLKSIZE		= 1048576;
+static const uint32_t BENCH_RAND_BLKSIZE	= 4096;
+static const uint32_t BENCH_MAXSWEEP		= 256;
+
+// return a monotonic timestamp in seconds
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// xorshift64 generator for random offsets: cheap, and the same sequence
+// on every run so results are comparable between settings.
+static uint64_t bench_nextrand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static int bench_cmpdouble(const void *a, const void *b)
+{
+	double da = *(const double*) a;
+	double db = *(const double*) b;
+
+	return (da > db) - (da < db);
+}
+
+// sequential reads in 1MB blocks from the start of the device
+static int32_t
+bench_seq(int fd, char *buf, uint64_t devsize, double secs, struct ata_benchresult *res)
+{
+	uint64_t offset = 0, nbytes = 0;
+	double start = bench_now(), elapsed = 0;
+
+	while( elapsed < secs ) {
+		if( offset + BENCH_SEQ_BLKSIZE > devsize )
+			offset = 0;
+
+		if( pread(fd, buf, BENCH_SEQ_BLKSIZE, offset) != BENCH_SEQ_BLKSIZE ) {
+			perror("sequential read failed");
+			return -1;
+		}
+
+		offset += BENCH_SEQ_BLKSIZE;
+		nbytes += BENCH_SEQ_BLKSIZE;
+		elapsed = bench_now() - start;
+	}
+
+	res->seq_mbps = (nbytes / 1048576.0) / elapsed;
+	return 0;
+}
+
+// random 4KB reads across the whole device, recording the latency of each
+static int32_t
+bench_rand(int fd, char *buf, uint64_t devsize, double secs, struct ata_benchresult *res)
+{
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	uint64_t nblocks = devsize / BENCH_RAND_BLKSIZE;
+	size_t nlat = 0, maxlat = 4096;
+	double *lat = (double*) malloc(maxlat * sizeof(double));
+	double start = bench_now(), elapsed = 0;
+
+	if(lat == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	while( elapsed < secs ) {
+		uint64_t offset = (bench_nextrand(&seed) % nblocks) * BENCH_RAND_BLKSIZE;
+		double t0 = bench_now();
+
+		if( pread(fd, buf, BENCH_RAND_BLKSIZE, offset) != BENCH_RAND_BLKSIZE ) {
+			perror("random read failed");
+			free(lat);
+			return -1;
+		}
+
+		elapsed = bench_now() - start;
+
+		if( nlat == maxlat ) {
+			double *newlat = (double*) realloc(lat, 2 * maxlat * sizeof(double));
+			if(newlat == 0) {
+				fprintf(stderr, "malloc failed\n");
+				free(lat);
+				return -1;
+			}
+			lat = newlat;
+			maxlat *= 2;
+		}
+		lat[nlat++] = (bench_now() - t0) * 1000.0;
+	}
+
+	qsort(lat, nlat, sizeof(double), bench_cmpdouble);
+	res->rand_iops = nlat / elapsed;
+	res->lat_p50 = lat[((nlat-1) * 50) / 100];
+	res->lat_p95 = lat[((nlat-1) * 95) / 100];
+	res->lat_p99 = lat[((nlat-1) * 99) / 100];
+	res->lat_max = lat[nlat-1];
+
+	free(lat);
+	return 0;
+}
+
+// run the sequential and random workloads against the drive for secs
+// seconds in total, half each.   The drive is only ever read from.
+int32_t
+ata_bench(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t secs,
+				struct ata_benchresult *res)
+{
+	int32_t rc = 0;
+	int fd;
+	char device[64];
+	char *buf = NULL;
+	uint64_t devsize = 0;
+
+	memset(res, 0, sizeof(struct ata_benchresult));
+	ata_getdevname(ata, chan, dev, device, sizeof(device));
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if( fd < 0 ) {
+		perror("error opening device for benchmark");
+		return -1;
+	}
+
+	rc = ata_getdevsize(fd, &devsize);
+	if( !rc && (devsize < BENCH_SEQ_BLKSIZE) ) {
+		printf("device too small to benchmark\n");
+		rc = -1;
+	}
+
+	if( !rc && posix_memalign((void**) &buf, BENCH_RAND_BLKSIZE, BENCH_SEQ_BLKSIZE) ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+
+	if(!rc)
+		rc = bench_seq(fd, buf, devsize, secs / 2.0, res);
+
+	if(!rc)
+		rc = bench_rand(fd, buf, devsize, secs / 2.0, res);
+
+	free(buf);
+	close(fd);
+	return rc;
+}
+
+// time a single read, which after a period of idle includes the time
+// the drive takes to come out of its power saving mode.   A random
+// block includes a seek; the first block, read before, is in the
+// drive's cache, which leaves just the drive's and the link's wake.
+static int32_t
+bench_wake(struct ATA *ata, uint32_t chan, uint32_t dev, bool random, double *ms)
+{
+	static uint64_t seed = 0x2545F4914F6CDD1DULL;
+	int32_t rc = 0;
+	int fd;
+	char device[64];
+	char *buf = NULL;
+	uint64_t devsize = 0;
+	double t0;
+
+	ata_getdevname(ata, chan, dev, device, sizeof(device));
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if( fd < 0 ) {
+		perror("error opening device for benchmark");
+		return -1;
+	}
+
+	rc = ata_getdevsize(fd, &devsize);
+
+	if( !rc && posix_memalign((void**) &buf, BENCH_RAND_BLKSIZE, BENCH_RAND_BLKSIZE) ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+
+	if(!rc) {
+		uint64_t offset = (!random)? 0 :
+				(bench_nextrand(&seed) % (devsize / BENCH_RAND_BLKSIZE)) *
+				BENCH_RAND_BLKSIZE;
+
+		t0 = bench_now();
+		if( pread(fd, buf, BENCH_RAND_BLKSIZE, offset) != BENCH_RAND_BLKSIZE ) {
+			perror("random read failed");
+			rc = -1;
+		} else
+			*ms = (bench_now() - t0) * 1000.0;
+	}
+
+	free(buf);
+	close(fd);
+	return rc;
+}
+
+int32_t
+ata_benchwake(struct ATA *ata, uint32_t chan, uint32_t dev, double *ms)
+{
+	return bench_wake(ata, chan, dev, true, ms);
+}
+
+int32_t
+ata_benchwakecached(struct ATA *ata, uint32_t chan, uint32_t dev, double *ms)
+{
+	return bench_wake(ata, chan, dev, false, ms);
+}
+
+// one of the readers keeping the drive's queue full
+struct bench_reader {
+	int				fd;
+	uint64_t		nblocks;
+	double			secs;
+	uint64_t		seed;
+	double			*lat;
+	size_t			nlat;
+	size_t			maxlat;
+	double			elapsed;
+	int32_t			rc;
+	pthread_t		thread;
+};
+
+static void * bench_readerrun( void *arg )
+{
+	struct bench_reader *r = (struct bench_reader*) arg;
+	double start = bench_now();
+	char *buf = NULL;
+
+	r->rc = -1;
+	if( posix_memalign((void**) &buf, BENCH_RAND_BLKSIZE, BENCH_RAND_BLKSIZE) )
+		return NULL;
+
+	while( r->elapsed < r->secs ) {
+		uint64_t offset = (bench_nextrand(&r->seed) % r->nblocks) * BENCH_RAND_BLKSIZE;
+		double t0 = bench_now();
+
+		if( pread(r->fd, buf, BENCH_RAND_BLKSIZE, offset) != BENCH_RAND_BLKSIZE ) {
+			free(buf);
+			return NULL;
+		}
+		r->elapsed = bench_now() - start;
+
+		if( r->nlat == r->maxlat ) {
+			size_t newmax = (r->maxlat)? r->maxlat * 2 : 4096;
+			double *newlat = (double*) realloc(r->lat, newmax * sizeof(double));
+			if(newlat == 0) {
+				free(buf);
+				return NULL;
+			}
+			r->lat = newlat;
+			r->maxlat = newmax;
+		}
+		r->lat[r->nlat++] = (bench_now() - t0) * 1000.0;
+	}
+
+	free(buf);
+	r->rc = 0;
+	return NULL;
+}
+
+// random 4KB reads for secs seconds with depth of them in flight at
+// once, for the IOPS and latency the drive gives at that queue depth.
+// Each reader has its own descriptor and offsets, so that the reads
+// reach the drive's queue independently.
+int32_t
+ata_benchdepth(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t secs,
+				uint32_t depth, struct ata_benchresult *res)
+{
+	struct bench_reader *readers;
+	char device[64];
+	uint64_t devsize = 0;
+	double *lat = NULL, elapsed = 0;
+	size_t nlat = 0;
+	uint32_t i, nstarted = 0;
+	int32_t rc = 0;
+
+	memset(res, 0, sizeof(struct ata_benchresult));
+	ata_getdevname(ata, chan, dev, device, sizeof(device));
+
+	readers = (struct bench_reader*) calloc(depth, sizeof(struct bench_reader));
+	if(readers == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	for(i = 0; !rc && (i < depth); i++) {
+		readers[i].fd = open(device, O_RDONLY | O_DIRECT);
+		if( readers[i].fd < 0 ) {
+			perror("error opening device for benchmark");
+			rc = -1;
+			break;
+		}
+		if( (i == 0) && !(rc = ata_getdevsize(readers[i].fd, &devsize)) &&
+				(devsize < BENCH_SEQ_BLKSIZE) ) {
+			printf("device too small to benchmark\n");
+			rc = -1;
+		}
+		readers[i].nblocks = devsize / BENCH_RAND_BLKSIZE;
+		readers[i].secs = secs;
+		readers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+
+	for(i = 0; !rc && (i < depth); i++) {
+		if( pthread_create(&readers[i].thread, NULL, bench_readerrun, &readers[i]) ) {
+			perror("error starting benchmark");
+			rc = -1;
+		} else
+			nstarted++;
+	}
+
+	for(i = 0; i < nstarted; i++) {
+		pthread_join(readers[i].thread, NULL);
+		if(readers[i].rc) {
+			if(!rc)
+				perror("random read failed");
+			rc = -1;
+		}
+		nlat += readers[i].nlat;
+		if(readers[i].elapsed > elapsed)
+			elapsed = readers[i].elapsed;
+	}
+
+	if( !rc && (nlat == 0) )
+		rc = -1;
+	if( !rc && ((lat = (double*) malloc(nlat * sizeof(double))) == 0) ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+
+	if(!rc) {
+		nlat = 0;
+		for(i = 0; i < depth; i++) {
+			memcpy(lat + nlat, readers[i].lat, readers[i].nlat * sizeof(double));
+			nlat += readers[i].nlat;
+		}
+		qsort(lat, nlat, sizeof(double), bench_cmpdouble);
+		res->rand_iops = nlat / elapsed;
+		res->lat_p50 = lat[((nlat-1) * 50) / 100];
+		res->lat_p95 = lat[((nlat-1) * 95) / 100];
+		res->lat_p99 = lat[((nlat-1) * 99) / 100];
+		res->lat_max = lat[nlat-1];
+	}
+
+	for(i = 0; i < depth; i++) {
+		if(readers[i].fd > 0)
+			close(readers[i].fd);
+		free(readers[i].lat);
+	}
+	free(readers);
+	free(lat);
+	return rc;
+}
+
+void ata_printbenchheader( const char *setting )
+{
+	printf("%-8s %10s %10s %10s %10s %10s %10s\n", setting, "seq MB/s",
+			"rand IOPS", "p50 ms", "p95 ms", "p99 ms", "max ms");
+}
+
+void ata_printbenchresult( const char *label, struct ata_benchresult *res )
+{
+	printf("%-8s %10.1f %10.1f %10.2f %10.2f %10.2f %10.2f\n", label,
+			res->seq_mbps, res->rand_iops, res->lat_p50,
+			res->lat_p95, res->lat_p99, res->lat_max);
+}
+
+// benchmark the drive at each APM or AAC level, as given by sweep in the
+// form "apm[:step]" or "aac[:step]", then print a table of the results.
+// The drive's original setting is restored afterwards.
+int32_t
+ata_benchsweep(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t secs,
+				char *sweep)
+{
+	int32_t rc = 0;
+	bool apm = (strncmp(sweep, "apm", 3) == 0);
+	uint32_t maxval = (apm)? ATA_APM_MAXPERF : ATA_AUTOACOUSTIC_MAXPERF - 127;
+	uint32_t origval = 0, step = 16, val, nres = 0, i;
+	long lstep;
+	struct ata_ident ident;
+	struct ata_benchresult *res;
+
+	if( !apm && (strncmp(sweep, "aac", 3) != 0) ) {
+		printf("invalid sweep: must be apm or aac\n");
+		return -1;
+	}
+
+	if( sweep[3] == ':' ) {
+		if( ata_strtolong(sweep+4, &lstep) || (lstep < 1) ) {
+			printf("invalid sweep step\n");
+			return -1;
+		}
+		step = lstep;
+	}
+
+	// remember the current setting so we can put it back afterwards.
+	// AAC is restored as disabled (0) unless word 86 says it's enabled
+	// with a valid level: those below 128 are reserved.
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+
+	if( apm && (ident.cmd_enabled2 & 8) )
+		origval = ident.apm_value & 0xFF;
+	else if( !apm && (ident.cmd_enabled2 & 0x200) &&
+			((ident.aac_value & 0xFF) > 127) )
+		origval = (ident.aac_value & 0xFF) - 127;
+
+	res = (struct ata_benchresult*) calloc(BENCH_MAXSWEEP, sizeof(struct ata_benchresult));
+	if(res == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	// always include the maximum performance setting as the last entry
+	for(val = 1; !rc && (nres < BENCH_MAXSWEEP); val += step) {
+		if(val > maxval)
+			val = maxval;
+
+		rc = (apm)? ata_setapm(ata, chan, dev, val) :
+				ata_setacoustic(ata, chan, dev, val);
+
+		if(!rc)
+			rc = ata_bench(ata, chan, dev, secs, &res[nres]);
+		if(!rc)
+			nres++;
+
+		if(val == maxval)
+			break;
+	}
+
+	if( (apm)? ata_setapm(ata, chan, dev, origval) :
+			ata_setacoustic(ata, chan, dev, origval) )
+		printf("warning: could not restore original setting\n");
+
+	printf("\n");
+	ata_printbenchheader( (apm)? "APM" : "AAC" );
+	for(i = 0, val = 1; i < nres; i++, val += step) {
+		char label[8];
+		snprintf(label, sizeof(label), "%u", (val > maxval)? maxval : val);
+		ata_printbenchresult(label, &res[i]);
+	}
+
+	free(res);
+	return rc;
+}
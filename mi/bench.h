@@ -0,0 +1,30 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+
+#include "atagen.h"
+
+struct ata_benchresult {
+	double		seq_mbps;	// sequential read throughput, MB/s
+	double		rand_iops;	// random 4KB reads per second
+	double		lat_p50;	// random read latency percentiles, ms
+	double		lat_p95;
+	double		lat_p99;
+	double		lat_max;
+};
+
+int32_t ata_bench( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs, struct ata_benchresult *res );
+int32_t ata_benchdepth( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs, uint32_t depth, struct ata_benchresult *res );
+int32_t ata_benchwake( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				double *ms );
+int32_t ata_benchwakecached( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				double *ms );
+int32_t ata_benchsweep( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs, char *sweep );
+void	ata_printbenchheader( const char *setting );
+void	ata_printbenchresult( const char *label, struct ata_benchresult *res );
+
+#endif
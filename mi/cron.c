@@ -0,0 +1,188 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// crontab(5) style schedules, for switching policy profiles at set
+// times of day.   Each field can be "*", a number, a range "a-b", any
+// of those with a step "/n", or a comma separated list of them.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "cron.h"
+
+// parse one field, with values from min to max, into a bitmask
+static int32_t cron_field( const char *field, int min, int max, uint64_t *bits )
+{
+	const char *p = field;
+
+	*bits = 0;
+	while(*p) {
+		long lo, hi, step = 1;
+		char *end;
+		int i;
+
+		if(*p == '*') {
+			lo = min;
+			hi = max;
+			p++;
+		} else {
+			lo = hi = strtol(p, &end, 10);
+			if(end == p)
+				return -1;
+			p = end;
+			if(*p == '-') {
+				hi = strtol(++p, &end, 10);
+				if(end == p)
+					return -1;
+				p = end;
+			}
+		}
+
+		if(*p == '/') {
+			step = strtol(++p, &end, 10);
+			if( (end == p) || (step < 1) )
+				return -1;
+			p = end;
+		}
+
+		if( (lo < min) || (hi > max) || (lo > hi) )
+			return -1;
+		for(i = lo; i <= hi; i += step)
+			*bits |= 1ULL << i;
+
+		if(*p == ',')
+			p++;
+		else if(*p)
+			return -1;
+	}
+
+	return (*bits)? 0 : -1;
+}
+
+int32_t ata_cronparse( const char *spec, struct ata_cron *cron )
+{
+	char fields[5][64];
+	uint64_t bits;
+
+	memset(cron, 0, sizeof(struct ata_cron));
+	if( sscanf(spec, "%63s %63s %63s %63s %63s", fields[0], fields[1],
+			fields[2], fields[3], fields[4]) != 5 )
+		return -1;
+
+	if( cron_field(fields[0], 0, 59, &cron->minutes) )
+		return -1;
+	if( cron_field(fields[1], 0, 23, &bits) )
+		return -1;
+	cron->hours = bits;
+	if( cron_field(fields[2], 1, 31, &bits) )
+		return -1;
+	cron->mdays = bits;
+	if( cron_field(fields[3], 1, 12, &bits) )
+		return -1;
+	cron->months = bits;
+
+	// Sunday can be either 0 or 7
+	if( cron_field(fields[4], 0, 7, &bits) )
+		return -1;
+	cron->wdays = (bits | (bits >> 7)) & 0x7F;
+
+	cron->anymday = (strcmp(fields[2], "*") == 0);
+	cron->anywday = (strcmp(fields[4], "*") == 0);
+
+	return 0;
+}
+
+// as in cron(8), if both day fields are restricted,
+// a day matching either of them will do
+static bool cron_daymatch( const struct ata_cron *cron, const struct tm *tm )
+{
+	bool mday = (cron->mdays >> tm->tm_mday) & 1;
+	bool wday = (cron->wdays >> tm->tm_wday) & 1;
+
+	if( !((cron->months >> (tm->tm_mon + 1)) & 1) )
+		return false;
+	if(cron->anymday)
+		return wday;
+	if(cron->anywday)
+		return mday;
+	return mday || wday;
+}
+
+bool ata_cronmatch( const struct ata_cron *cron, const struct tm *tm )
+{
+	return cron_daymatch(cron, tm) && ((cron->hours >> tm->tm_hour) & 1) &&
+			((cron->minutes >> tm->tm_min) & 1);
+}
+
+// return the last time at or before now that the schedule fired, or
+// -1 if it hasn't in the last year.   Rather than step back a minute at
+// a time, this steps back a day at a time to one which matches, and
+// then takes the latest hour and minute in it.
+time_t ata_cronprev( const struct ata_cron *cron, time_t now )
+{
+	struct tm tm;
+	int day, hour, min;
+
+	localtime_r(&now, &tm);
+
+	for(day = 0; day <= 366; day++) {
+		// the hours and minutes left today, or all of an earlier day
+		int maxhour = (day == 0)? tm.tm_hour : 23;
+
+		if(day > 0) {
+			tm.tm_mday--;
+			tm.tm_hour = 12;	// so DST changes can't move the date
+			tm.tm_isdst = -1;
+			mktime(&tm);
+		}
+
+		if( !cron_daymatch(cron, &tm) )
+			continue;
+
+		for(hour = maxhour; hour >= 0; hour--) {
+			int maxmin = ((day == 0) && (hour == tm.tm_hour))? tm.tm_min : 59;
+
+			if( !((cron->hours >> hour) & 1) )
+				continue;
+			for(min = maxmin; min >= 0; min--)
+				if( (cron->minutes >> min) & 1 ) {
+					tm.tm_hour = hour;
+					tm.tm_min = min;
+					tm.tm_sec = 0;
+					tm.tm_isdst = -1;
+					return mktime(&tm);
+				}
+		}
+	}
+
+	return (time_t) -1;
+}
@@ -0,0 +1,24 @@
+#ifndef _CRON_H_
+#define _CRON_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// a crontab(5) style schedule, "minute hour day-of-month month
+// day-of-week", as a bitmask of the values each field matches
+struct ata_cron {
+	uint64_t	minutes;	// bits 0-59
+	uint32_t	hours;		// bits 0-23
+	uint32_t	mdays;		// bits 1-31
+	uint16_t	months;		// bits 1-12
+	uint8_t		wdays;		// bits 0-6, Sunday is 0
+	bool		anymday;	// the day fields were "*", which matters
+	bool		anywday;	// when only one of them is
+};
+
+int32_t	ata_cronparse( const char *spec, struct ata_cron *cron );
+bool	ata_cronmatch( const struct ata_cron *cron, const struct tm *tm );
+time_t	ata_cronprev( const struct ata_cron *cron, time_t now );
+
+#endif
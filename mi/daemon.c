@@ -0,0 +1,526 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// daemon mode: watch the drives' I/O and step each one down a power
+// ladder as it stays idle, for drives without EPC, which can't do this
+// by themselves.   Unloading the heads saves much of the power of
+// spinning down, but the drive recovers in well under a second, so
+// lightly used drives don't keep paying the multi-second spin-up.
+//
+// The daemon also listens for drives being hot-plugged, and applies
+// their policy as soon as they arrive.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "policy.h"
+#include "scsi.h"
+#include "daemon.h"
+#include "wear.h"
+
+// how often to check each drive's cycle budget, in seconds
+#define DAEMON_WEARCHECK	3600
+
+// and how often to write out the metrics
+#define DAEMON_METRICS		15
+
+// how often to compare each drive's command latency with its peers
+#define DAEMON_LATENCYCHECK	60
+
+// when switching profiles, seconds between starting on one drive and
+// the next, so as not to hit every drive at once
+#define DAEMON_STAGGER		2
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+static double daemon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// work out the drive's settings from its own entry with the profile in
+// force on top.   The timeouts are only stretched to the drive's cycle
+// budget while it's spinning, since reading SMART could spin it up.
+static void
+daemon_settings( struct ATA *ata, struct ata_daemon *daemon,
+				struct ata_daemondrive *drive, bool spinning )
+{
+	int i;
+
+	for(i = 0; i < POLICY_NKEYS; i++)
+		drive->effective.val[i] = (drive->policy)? drive->policy->val[i] : POLICY_UNSET;
+	ata_policyoverlay(&drive->effective, daemon->profile);
+	if(!drive->canunload)
+		drive->effective.val[POLICY_UNLOAD] = POLICY_UNSET;
+
+	if( !spinning || ata_wearadjust(ata, drive->chan, drive->dev,
+			&drive->effective, drive->val) )
+		memcpy(drive->val, drive->effective.val, sizeof(drive->val));
+}
+
+// set whatever differs from what the drive was last given
+static void
+daemon_applydiff( struct ATA *ata, struct ata_daemondrive *drive )
+{
+	int i;
+
+	for(i = 0; i < POLICY_NKEYS; i++) {
+		if( (drive->val[i] == POLICY_UNSET) || (drive->val[i] == drive->applied[i]) )
+			continue;
+		if( !ata_policyapplykey(ata, drive->chan, drive->dev, i, drive->val[i]) )
+			drive->applied[i] = drive->val[i];
+	}
+}
+
+// find a device node in the list of those seen
+static size_t
+daemon_findknown( struct ata_daemon *daemon, const char *devnode )
+{
+	size_t i;
+
+	for(i = 0; i < daemon->nknown; i++)
+		if( strcmp(daemon->known[i], devnode) == 0 )
+			break;
+
+	return i;
+}
+
+// note a device node as seen, whether the drive was there at startup or
+// hot-plugged, so that the change uevents udev sends whenever a writer
+// closes it don't have the drive identified and added again
+static void
+daemon_addknown( struct ata_daemon *daemon, const char *devnode )
+{
+	if( daemon_findknown(daemon, devnode) < daemon->nknown )
+		return;
+
+	if( daemon->nknown == daemon->maxknown ) {
+		size_t newmax = (daemon->maxknown)? daemon->maxknown * 2 : 16;
+		char (*known)[64] = realloc(daemon->known, newmax * 64);
+		if(known == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return;
+		}
+		daemon->known = known;
+		daemon->maxknown = newmax;
+	}
+	snprintf(daemon->known[daemon->nknown++], 64, "%s", devnode);
+}
+
+// add the drive at chan, dev to the daemon, if its policy gives it a
+// ladder, or there are profiles to switch.   Returns 1 if the drive
+// was skipped.
+int32_t
+ata_daemonadd( struct ATA *ata, struct ata_daemon *daemon, uint32_t chan,
+				uint32_t dev, struct ata_policystore *store )
+{
+	struct ata_ident ident;
+	uint16_t *buf = (uint16_t*) &ident;
+	struct ata_daemondrive *drive;
+	struct ata_policy *policy;
+	char model[41], serial[21], label[64], devnode[64];
+	int i;
+
+	snprintf(label, sizeof(label), "%s", ata_devlabel(ata, chan, dev));
+	ata_getdevname(ata, chan, dev, devnode, sizeof(devnode));
+	daemon_addknown(daemon, devnode);
+
+	if( ata_ident(ata, chan, dev, &ident) )
+		return 1;
+	ata_identstrings(&ident, model, serial);
+
+	policy = ata_policyfind(store, model, serial);
+	if( !ata_policyscheduled(store) && ((policy == NULL) ||
+			((policy->val[POLICY_UNLOAD] == POLICY_UNSET) &&
+			(policy->val[POLICY_SPINDOWN] == POLICY_UNSET))) ) {
+		printf("%s (%s): no unload or spindown policy, skipping\n",
+				label, model);
+		return 1;
+	}
+
+	if( (buf[119] & 0x80) && (buf[120] & 0x80) ) {
+		printf("%s (%s): EPC is enabled, use -E instead\n",
+				label, model);
+		return 1;
+	}
+
+	if( (policy != NULL) && (policy->val[POLICY_UNLOAD] != POLICY_UNSET) &&
+			!(buf[84] & 0x2000) )
+		printf("%s (%s): drive can't unload its heads\n",
+				label, model);
+
+	if( daemon->ndrives == daemon->maxdrives ) {
+		size_t newmax = (daemon->maxdrives)? daemon->maxdrives * 2 : 8;
+		struct ata_daemondrive *drives = (struct ata_daemondrive*)
+				realloc(daemon->drives, newmax * sizeof(struct ata_daemondrive));
+		if(drives == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return -1;
+		}
+		daemon->drives = drives;
+		daemon->maxdrives = newmax;
+	}
+
+	drive = &daemon->drives[daemon->ndrives++];
+	memset(drive, 0, sizeof(struct ata_daemondrive));
+	drive->chan = chan;
+	drive->dev = dev;
+	strcpy(drive->devpath, ata->devpath);
+	strcpy(drive->label, label);
+	drive->policy = policy;
+	drive->canunload = (buf[84] & 0x2000) != 0;
+	drive->effective.match = POLICY_NONE;
+	for(i = 0; i < POLICY_NKEYS; i++)
+		drive->applied[i] = POLICY_UNSET;
+	daemon_settings(ata, daemon, drive, false);
+	strcpy(drive->model, model);
+	strcpy(drive->serial, serial);
+	drive->step = LADDER_ACTIVE;
+	drive->lastio = daemon_now();
+	ata_getiocount(ata, chan, dev, &drive->ios);
+	ata_statsinit(&drive->stats, label, model, serial,
+			&drive->effective.val[POLICY_ACTIVE_MW]);
+
+	// with profiles, the drive is given its settings by the daemon
+	if( ata_policyscheduled(store) )
+		drive->applyat = drive->lastio;
+
+	return 0;
+}
+
+// move a drive down the ladder if it has been idle long enough
+static void
+daemon_ladder( struct ATA *ata, struct ata_daemon *daemon,
+				struct ata_daemondrive *drive, double now )
+{
+	int32_t unload, spindown;
+	double idle = now - drive->lastio, t;
+	uint64_t ios;
+	uint8_t mode;
+	bool havemode;
+
+	strcpy(ata->devpath, drive->devpath);
+	if( ata_getiocount(ata, drive->chan, drive->dev, &ios) )
+		return;
+
+	// CHECK POWER MODE never touches the media, so how long it
+	// takes is a baseline for spotting a drive going slow
+	t = daemon_now();
+	havemode = !ata_getpowermode(ata, drive->chan, drive->dev, &mode);
+	ata_latencyadd(&drive->stats.latency, (daemon_now() - t) * 1000);
+	if(havemode)
+		ata_statssample(&drive->stats, mode, now);
+
+	// a new profile, or the drive's first settings
+	if( drive->applyat && (now >= drive->applyat) ) {
+		daemon_settings(ata, daemon, drive, havemode && (mode != ATA_POWERMODE_STANDBY));
+		daemon_applydiff(ata, drive);
+		drive->applyat = 0;
+	}
+
+	// reading SMART could spin the drive up, so the cycle
+	// budget is only checked while it's known to be spinning
+	if( (drive->step == LADDER_ACTIVE) && (now >= drive->wearcheck) &&
+			havemode && (mode != ATA_POWERMODE_STANDBY) ) {
+		daemon_settings(ata, daemon, drive, true);
+		if( ata_policyscheduled(daemon->store) )
+			daemon_applydiff(ata, drive);
+		drive->wearcheck = now + DAEMON_WEARCHECK;
+	}
+	unload = drive->val[POLICY_UNLOAD];
+	spindown = drive->val[POLICY_SPINDOWN];
+
+	// any I/O puts the drive back at the bottom of the ladder
+	if(ios != drive->ios) {
+		drive->ios = ios;
+		drive->lastio = now;
+		drive->step = LADDER_ACTIVE;
+		return;
+	}
+
+	if( (drive->step < LADDER_STANDBY) && (spindown != POLICY_UNSET) &&
+		(idle >= spindown) ) {
+		if( !ata_standbyimmediate(ata, drive->chan, drive->dev) ) {
+			drive->step = LADDER_STANDBY;
+			drive->stats.standbys++;
+
+			// don't count our own flush as I/O
+			if(ata->flush)
+				ata_getiocount(ata, drive->chan, drive->dev, &drive->ios);
+		}
+	} else if( (drive->step < LADDER_UNLOADED) && (unload != POLICY_UNSET) &&
+		(idle >= unload) ) {
+		if( !ata_unload(ata, drive->chan, drive->dev) ) {
+			drive->step = LADDER_UNLOADED;
+			drive->stats.unloads++;
+		}
+	}
+}
+
+// stop managing a drive which has been removed
+static void
+daemon_remove( struct ata_daemon *daemon, const char *devnode )
+{
+	size_t i = daemon_findknown(daemon, devnode);
+
+	if(i < daemon->nknown)
+		memcpy(daemon->known[i], daemon->known[--daemon->nknown], 64);
+
+	for(i = 0; i < daemon->ndrives; i++)
+		if( strcmp(daemon->drives[i].devpath, devnode) == 0 ) {
+			printf("%s removed\n", devnode);
+			daemon->drives[i] = daemon->drives[--daemon->ndrives];
+			break;
+		}
+}
+
+// handle a uevent.   A drive which has been added is identified, its
+// policy applied and, if it has one, its ladder started.   Change events
+// for drives which have already been seen are ignored, so that drives
+// aren't identified again unless they have been replaced.
+static void
+daemon_hotplug( struct ATA *ata, struct ata_daemon *daemon )
+{
+	struct ata_ident ident;
+	struct ata_policy *policy;
+	char devnode[64], model[41], serial[21];
+	enum ata_hotplugevent event;
+
+	event = ata_hotplugread(daemon->hotplugfd, devnode, sizeof(devnode));
+
+	if(event == HOTPLUG_REMOVE) {
+		daemon_remove(daemon, devnode);
+		ata_scsiforget(ata, devnode);
+	}
+
+	if( ((event != HOTPLUG_ADD) && (event != HOTPLUG_CHANGE)) ||
+		(daemon_findknown(daemon, devnode) < daemon->nknown) )
+		return;
+
+	daemon_addknown(daemon, devnode);
+
+	// not an ATA drive
+	strcpy(ata->devpath, devnode);
+	if( ata_ident(ata, 0, 0, &ident) )
+		return;
+
+	ata_identstrings(&ident, model, serial);
+	policy = ata_policyfind(daemon->store, model, serial);
+	printf("%s added: %s (serial %s)\n", devnode, model, serial);
+
+	// with profiles, the daemon applies the drive's settings itself
+	if( ata_policyscheduled(daemon->store) )
+		ata_daemonadd(ata, daemon, 0, 0, daemon->store);
+	else if(policy != NULL) {
+		ata_policyapply(ata, 0, 0, policy);
+		if( (policy->val[POLICY_UNLOAD] != POLICY_UNSET) ||
+			(policy->val[POLICY_SPINDOWN] != POLICY_UNSET) )
+			ata_daemonadd(ata, daemon, 0, 0, daemon->store);
+	}
+}
+
+// check the schedule once a minute, and if another profile has come
+// into force, set each drive's applyat a little after the last's
+static void
+daemon_schedule( struct ata_daemon *daemon, double now )
+{
+	time_t t = time(NULL);
+	struct ata_policy *profile;
+	size_t i;
+
+	if( (t / 60) == daemon->lastminute )
+		return;
+	daemon->lastminute = t / 60;
+
+	profile = ata_policyprofile(daemon->store, t);
+	if(profile == daemon->profile)
+		return;
+
+	printf("switching to profile %s\n", (profile)? profile->key : "(none)");
+	daemon->profile = profile;
+	for(i = 0; i < daemon->ndrives; i++)
+		daemon->drives[i].applyat = now + (i * DAEMON_STAGGER);
+}
+
+// compare each drive's command latency with the others of its model,
+// reporting the drives which have become slow, or recovered, since
+static void
+daemon_latency( struct ata_daemon *daemon )
+{
+	struct ata_latencypeer *peers;
+	size_t i;
+
+	peers = (struct ata_latencypeer*) calloc(daemon->ndrives + 1,
+					sizeof(struct ata_latencypeer));
+	if(peers == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return;
+	}
+
+	// a minute's samples at least, before judging a drive
+	for(i = 0; i < daemon->ndrives; i++) {
+		struct ata_drivestats *stats = &daemon->drives[i].stats;
+
+		peers[i].model = stats->model;
+		if(stats->latency.n >= DAEMON_LATENCYCHECK / daemon->interval)
+			peers[i].median = ata_latencymedian(&stats->latency);
+	}
+	ata_latencycompare(peers, daemon->ndrives);
+
+	for(i = 0; i < daemon->ndrives; i++) {
+		struct ata_drivestats *stats = &daemon->drives[i].stats;
+
+		if( peers[i].slow && !stats->slow )
+			printf("%s is slow: %.1fms to answer against %.1fms for "
+					"%u others of its model\n", stats->label,
+					peers[i].median, peers[i].peers, peers[i].npeers);
+		else if( !peers[i].slow && stats->slow )
+			printf("%s is no longer slow\n", stats->label);
+		stats->slow = peers[i].slow;
+	}
+	free(peers);
+}
+
+// write out every drive's counters to the metrics file
+static void
+daemon_metrics( struct ata_daemon *daemon )
+{
+	struct ata_drivestats **stats;
+	size_t i;
+
+	stats = (struct ata_drivestats**) calloc(daemon->ndrives + 1,
+					sizeof(struct ata_drivestats*));
+	if(stats == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return;
+	}
+
+	for(i = 0; i < daemon->ndrives; i++)
+		stats[i] = &daemon->drives[i].stats;
+	ata_statswrite(daemon->metrics, stats, daemon->ndrives);
+	free(stats);
+}
+
+// run until interrupted, sampling every drive each interval, and
+// handling hot-plug events as they arrive
+int32_t
+ata_daemonrun( struct ATA *ata, struct ata_daemon *daemon )
+{
+	struct sigaction sa;
+	double next = 0, nextmetrics = 0, nextlatency = 0;
+	size_t i;
+
+	daemon->hotplugfd = ata_hotplugopen();
+
+	if( (daemon->ndrives == 0) && (daemon->hotplugfd < 0) ) {
+		printf("no drives to manage\n");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("managing %lu drive%s%s\n", (unsigned long) daemon->ndrives,
+			(daemon->ndrives == 1)? "" : "s",
+			(daemon->hotplugfd < 0)? "" : ", watching for new drives");
+	fflush(stdout);
+
+	while(!daemon_stop) {
+		double now = daemon_now();
+
+		if(now >= next) {
+			if( ata_policyscheduled(daemon->store) )
+				daemon_schedule(daemon, now);
+			for(i = 0; i < daemon->ndrives; i++)
+				daemon_ladder(ata, daemon, &daemon->drives[i], now);
+			next = now + daemon->interval;
+		}
+
+		if(now >= nextlatency) {
+			if(nextlatency)
+				daemon_latency(daemon);
+			nextlatency = now + DAEMON_LATENCYCHECK;
+		}
+
+		if( daemon->metrics && (now >= nextmetrics) ) {
+			daemon_metrics(daemon);
+			nextmetrics = now + DAEMON_METRICS;
+		}
+
+		fflush(stdout);
+
+		if(daemon->hotplugfd >= 0) {
+			struct pollfd pfd;
+
+			pfd.fd = daemon->hotplugfd;
+			pfd.events = POLLIN;
+			if( poll(&pfd, 1, (int) ((next - now) * 1000) + 1) > 0 )
+				daemon_hotplug(ata, daemon);
+		} else
+			sleep(daemon->interval);
+	}
+
+	if(daemon->hotplugfd >= 0)
+		close(daemon->hotplugfd);
+
+	if(daemon->metrics)
+		daemon_metrics(daemon);
+	for(i = 0; i < daemon->ndrives; i++)
+		ata_statsprint(&daemon->drives[i].stats);
+
+	return 0;
+}
+
+void ata_daemonfree( struct ata_daemon *daemon )
+{
+	free(daemon->drives);
+	free(daemon->known);
+	daemon->drives = NULL;
+	daemon->known = NULL;
+	daemon->ndrives = daemon->maxdrives = 0;
+	daemon->nknown = daemon->maxknown = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "atagen.h"
+#include "policy.h"
+#include "stats.h"
+
+// the power ladder: after the policy's unload seconds without I/O the
+// heads are unloaded, and after spindown seconds the drive is put into
+// standby.   Any I/O puts the drive back at the bottom.
+enum ata_ladderstep {
+	LADDER_ACTIVE,
+	LADDER_UNLOADED,
+	LADDER_STANDBY
+};
+
+struct ata_daemondrive {
+	uint32_t			chan;
+	uint32_t			dev;
+	char				devpath[64];	// or the device node, if hot-plugged
+	char				label[64];		// for messages
+	char				model[41];
+	char				serial[21];
+	struct ata_policy	*policy;	// the drive's own entry, or NULL
+	struct ata_policy	effective;	// the entry with the profile on top
+	int32_t				val[POLICY_NKEYS];	// effective, after ata_wearadjust()
+	int32_t				applied[POLICY_NKEYS];	// as last set on the drive
+	double				applyat;	// when to apply a new profile, or 0
+	double				wearcheck;	// when to check the cycle budget again
+	bool				canunload;
+	uint64_t			ios;		// I/O count at the last sample
+	double				lastio;		// when I/O was last seen
+	enum ata_ladderstep	step;
+	struct ata_drivestats	stats;
+};
+
+struct ata_daemon {
+	struct ata_daemondrive	*drives;
+	size_t					ndrives;
+	size_t					maxdrives;
+	uint32_t				interval;	// seconds between samples
+	struct ata_policystore	*store;
+	int						hotplugfd;	// uevent socket, or -1
+	char					(*known)[64];	// device nodes which have
+	size_t					nknown;		// been seen
+	size_t					maxknown;
+	const char				*metrics;	// Prometheus text file, or NULL
+	struct ata_policy		*profile;	// the profile in force
+	time_t					lastminute;	// when the schedule was last checked
+};
+
+int32_t	ata_daemonadd( struct ATA *ata, struct ata_daemon *daemon,
+				uint32_t ata_chan, uint32_t ata_dev, struct ata_policystore *store );
+int32_t	ata_daemonrun( struct ATA *ata, struct ata_daemon *daemon );
+void	ata_daemonfree( struct ata_daemon *daemon );
+
+#endif
@@ -0,0 +1,294 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// the device table: every drive in the system, addressable by WWN,
+// serial number, /dev/disk/by-id name or device node rather than by
+// channel and device, which change meaning whenever the probe order
+// does.   The backend fills the table in with ata_devscan().
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "devtable.h"
+#include "identify.h"
+#include "util.h"
+#include "sched.h"
+
+// FNV-1a, which is quick and spreads short similar keys well
+static uint32_t devtable_hash( const char *key )
+{
+	uint32_t h = 2166136261U;
+
+	while(*key) {
+		h ^= (unsigned char) *key++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static void devtable_insert( struct ata_devtable *table, uint32_t keyidx )
+{
+	size_t mask = table->nslots - 1;
+	size_t i = devtable_hash(table->keys[keyidx].key) & mask;
+
+	while(table->slots[i] != 0)
+		i = (i + 1) & mask;
+	table->slots[i] = keyidx + 1;
+}
+
+// keep the hash table at most a quarter full, so probe sequences stay short
+static int32_t devtable_grow( struct ata_devtable *table )
+{
+	size_t nslots = (table->nslots)? table->nslots * 2 : 64;
+	uint32_t *slots = (uint32_t*) calloc(nslots, sizeof(uint32_t));
+	size_t i;
+
+	if(slots == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->nslots = nslots;
+	for(i = 0; i < table->nkeys; i++)
+		devtable_insert(table, i);
+
+	return 0;
+}
+
+static struct ata_devkey * devtable_lookup( struct ata_devtable *table, const char *key )
+{
+	size_t mask = table->nslots - 1;
+	size_t i;
+
+	if(table->nslots == 0)
+		return NULL;
+
+	for(i = devtable_hash(key) & mask; table->slots[i] != 0; i = (i + 1) & mask)
+		if( strcmp(table->keys[table->slots[i] - 1].key, key) == 0 )
+			return &table->keys[table->slots[i] - 1];
+
+	return NULL;
+}
+
+// index ent under "kind:name".   WWNs are compared in lower case.
+int32_t ata_devtablekey( struct ata_devtable *table, struct ata_devent *ent,
+				const char *kind, const char *name )
+{
+	struct ata_devkey *key;
+	char *p;
+
+	if( (name == NULL) || (*name == 0) )
+		return 0;
+
+	if( table->nkeys == table->maxkeys ) {
+		size_t newmax = (table->maxkeys)? table->maxkeys * 2 : 64;
+		struct ata_devkey *keys = (struct ata_devkey*) realloc(table->keys,
+						newmax * sizeof(struct ata_devkey));
+		if(keys == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return -1;
+		}
+		table->keys = keys;
+		table->maxkeys = newmax;
+	}
+
+	key = &table->keys[table->nkeys];
+	snprintf(key->key, sizeof(key->key), "%s:%s", kind, name);
+	if( strcmp(kind, "wwn") == 0 )
+		for(p = key->key; *p; p++)
+			*p = tolower((unsigned char) *p);
+	key->ent = ent - table->ents;
+
+	// a name already indexed keeps pointing at the first drive with it
+	if( devtable_lookup(table, key->key) != NULL )
+		return 0;
+
+	// growing the hash table inserts every key, including this one
+	table->nkeys++;
+	if(table->nkeys * 4 > table->nslots)
+		return devtable_grow(table);
+	devtable_insert(table, table->nkeys - 1);
+
+	return 0;
+}
+
+// return the entry for the device node devpath, adding it if it's new
+struct ata_devent * ata_devtableadd( struct ata_devtable *table, const char *devpath )
+{
+	struct ata_devkey *key;
+	struct ata_devent *ent;
+	char devkey[160];
+
+	snprintf(devkey, sizeof(devkey), "dev:%s", devpath);
+	key = devtable_lookup(table, devkey);
+	if(key != NULL)
+		return &table->ents[key->ent];
+
+	// the keys refer to entries by index, so they survive this
+	if( table->nents == table->maxents ) {
+		size_t newmax = (table->maxents)? table->maxents * 2 : 32;
+		struct ata_devent *ents = (struct ata_devent*) realloc(table->ents,
+						newmax * sizeof(struct ata_devent));
+		if(ents == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return NULL;
+		}
+		table->ents = ents;
+		table->maxents = newmax;
+	}
+
+	ent = &table->ents[table->nents++];
+	memset(ent, 0, sizeof(struct ata_devent));
+	snprintf(ent->devpath, sizeof(ent->devpath), "%s", devpath);
+
+	if( ata_devtablekey(table, ent, "dev", devpath) )
+		return NULL;
+
+	return ent;
+}
+
+int32_t ata_devtablebuild( struct ATA *ata, struct ata_devtable *table )
+{
+	memset(table, 0, sizeof(struct ata_devtable));
+	return ata_devscan(ata, table);
+}
+
+void ata_devtablefree( struct ata_devtable *table )
+{
+	free(table->ents);
+	free(table->keys);
+	free(table->slots);
+	memset(table, 0, sizeof(struct ata_devtable));
+}
+
+// find the drive named by spec, which can be "wwn:<wwn>",
+// "serial:<serial>", a /dev/disk/by-id path or name, a device node,
+// or a bare WWN or serial number.
+struct ata_devent * ata_devtablefind( struct ata_devtable *table, const char *spec )
+{
+	static const char * const kinds[] = { "id", "serial", "wwn" };
+	struct ata_devkey *key = NULL;
+	char keybuf[160], *p;
+	char resolved[PATH_MAX];
+	size_t i;
+
+	if( (strncmp(spec, "wwn:", 4) == 0) || (strncmp(spec, "serial:", 7) == 0) ) {
+		snprintf(keybuf, sizeof(keybuf), "%s", spec);
+		if( strncmp(spec, "wwn:", 4) == 0 )
+			for(p = keybuf; *p; p++)
+				*p = tolower((unsigned char) *p);
+		key = devtable_lookup(table, keybuf);
+	} else if( strncmp(spec, "/dev/disk/by-id/", 16) == 0 ) {
+		snprintf(keybuf, sizeof(keybuf), "id:%s", spec + 16);
+		key = devtable_lookup(table, keybuf);
+	} else if( strncmp(spec, "/dev/", 5) == 0 ) {
+		if( realpath(spec, resolved) == NULL )
+			snprintf(resolved, sizeof(resolved), "%s", spec);
+		snprintf(keybuf, sizeof(keybuf), "dev:%.150s", resolved);
+		key = devtable_lookup(table, keybuf);
+	} else
+		for(i = 0; (key == NULL) && (i < sizeof(kinds)/sizeof(kinds[0])); i++) {
+			snprintf(keybuf, sizeof(keybuf), "%s:%s", kinds[i], spec);
+			if(i == 2)
+				for(p = keybuf; *p; p++)
+					*p = tolower((unsigned char) *p);
+			key = devtable_lookup(table, keybuf);
+		}
+
+	return (key == NULL)? NULL : &table->ents[key->ent];
+}
+
+void ata_devtablelist( struct ata_devtable *table )
+{
+	size_t i;
+
+	for(i = 0; i < table->nents; i++) {
+		struct ata_devent *ent = &table->ents[i];
+
+		printf("%s\n", ent->devpath);
+		if(ent->model[0])
+			printf("\tModel: %s\n", ent->model);
+		if(ent->serial[0])
+			printf("\tSerial: %s\n", ent->serial);
+		if(ent->wwn[0])
+			printf("\tWWN: %s\n", ent->wwn);
+		if(ent->byid[0])
+			printf("\tID: %s\n", ent->byid);
+		if(ent->controller[0])
+			printf("\tController: %s\n", ent->controller);
+		if(ent->degraded[0])
+			printf("\tDegraded: %s\n", ent->degraded);
+		printf("\n");
+	}
+}
+
+// fill in whatever the backend couldn't get from the names, such as the
+// serial number of a drive only known by its WWN, from the drive itself
+static int32_t devtable_identifyjob( struct ATA *ata, struct ata_devent *ent,
+				void *arg )
+{
+	struct ata_ident ident;
+	struct ata_identinfo info;
+	char model[41], serial[21], wwn[24];
+
+	// a drive which doesn't answer IDENTIFY isn't an error: it's
+	// most likely not an ATA drive at all
+	if( ata_ident(ata, ent->chan, ent->dev, &ident) )
+		return 0;
+
+	// a drive which fell back to a slower transfer mode is worth knowing about
+	ata_identdecode(&ident, &info);
+	ata_identdegraded(&info, ent->degraded, sizeof(ent->degraded));
+
+	ata_identstrings(&ident, model, serial);
+	ata_identwwn(&ident, wwn);
+	if(ent->model[0] == 0)
+		strcpy(ent->model, model);
+	if(ent->serial[0] == 0)
+		strcpy(ent->serial, serial);
+	if(ent->wwn[0] == 0)
+		strcpy(ent->wwn, wwn);
+
+	return 0;
+}
+
+int32_t ata_devtableidentify( struct ata_devtable *table,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	return ata_schedrun(table, devtable_identifyjob, NULL, jobs, ctrljobs);
+}
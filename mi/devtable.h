@@ -0,0 +1,60 @@
+#ifndef _DEVTABLE_H_
+#define _DEVTABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "atagen.h"
+
+// one drive, with the stable names it can be addressed by
+struct ata_devent {
+	char		devpath[64];	// device node, e.g. /dev/sdb
+	char		byid[128];		// preferred /dev/disk/by-id name
+	char		model[41];
+	char		serial[21];
+	char		wwn[24];		// e.g. 0x5000c500a1b2c3d4
+	char		controller[64];	// the host adapter the drive hangs off
+	char		degraded[64];	// why it's running below its capability, if it is
+	uint32_t	chan;			// how the backend addresses it, for
+	uint32_t	dev;			// backends without device nodes
+};
+
+// a key, such as "wwn:0x5000c500a1b2c3d4", and the drive it names
+struct ata_devkey {
+	char		key[160];
+	uint32_t	ent;
+};
+
+// the device table, built once per run and indexed by an open addressing
+// hash table over every key, so that drives are found in O(1) however
+// many there are.
+struct ata_devtable {
+	struct ata_devent	*ents;
+	size_t				nents;
+	size_t				maxents;
+	struct ata_devkey	*keys;
+	size_t				nkeys;
+	size_t				maxkeys;
+	uint32_t			*slots;		// key index + 1, or 0 if empty
+	size_t				nslots;
+};
+
+int32_t	ata_devtablebuild( struct ATA *ata, struct ata_devtable *table );
+void	ata_devtablefree( struct ata_devtable *table );
+struct ata_devent * ata_devtableadd( struct ata_devtable *table,
+				const char *devpath );
+int32_t	ata_devtablekey( struct ata_devtable *table, struct ata_devent *ent,
+				const char *kind, const char *name );
+struct ata_devent * ata_devtablefind( struct ata_devtable *table,
+				const char *spec );
+void	ata_devtablelist( struct ata_devtable *table );
+int32_t	ata_devtableidentify( struct ata_devtable *table,
+				uint32_t jobs, uint32_t ctrljobs );
+
+// implemented by each backend: add every drive to the table, and
+// address a drive named by its device node without building it
+int32_t	ata_devscan( struct ATA *ata, struct ata_devtable *table );
+bool	ata_devnode( struct ATA *ata, const char *spec,
+				uint32_t *chan, uint32_t *dev );
+
+#endif
@@ -0,0 +1,242 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// Extended Power Conditions (EPC) support.   EPC drives have three idle
+// conditions, Idle_a (electronics partly off), Idle_b (heads unloaded)
+// and Idle_c (heads unloaded, spindle slowed), and two standby
+// conditions, Standby_y and Standby_z (spun down), each with its own
+// timer in 100ms steps, rather than the single coarse standby timer.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "gplog.h"
+#include "epc.h"
+
+// where each condition's 64 byte descriptor is in the Power Conditions
+// log: the idle conditions are on page 0, the standby ones on page 1
+static const struct {
+	const char	*name;
+	uint8_t		id;
+	uint8_t		page;
+	uint16_t	offset;
+} epc_conds[EPC_NCONDS] = {
+	{ "idle_a",		0x81,	0,	0x000 },
+	{ "idle_b",		0x82,	0,	0x040 },
+	{ "idle_c",		0x83,	0,	0x080 },
+	{ "standby_y",	0x01,	1,	0x180 },
+	{ "standby_z",	0x00,	1,	0x1C0 },
+};
+
+static uint32_t epc_getle32(unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// read the state of every power condition from the Power Conditions log
+int32_t
+ata_epcread(struct ATA *ata, uint32_t chan, uint32_t dev,
+				struct ata_epcinfo info[EPC_NCONDS])
+{
+	int32_t rc = 0;
+	char *buf = NULL;
+	int page, i;
+
+	memset(info, 0, EPC_NCONDS * sizeof(struct ata_epcinfo));
+
+	for(page = 0; !rc && (page < 2); page++) {
+		rc = ata_readlog(ata, chan, dev, ATA_LOG_POWER_CONDITIONS, page, &buf);
+
+		for(i = 0; !rc && (i < EPC_NCONDS); i++) {
+			unsigned char *desc = (unsigned char*) buf + epc_conds[i].offset;
+
+			if(epc_conds[i].page != page)
+				continue;
+
+			info[i].name = epc_conds[i].name;
+			info[i].supported = (desc[1] & 0x80) != 0;
+			info[i].changeable = (desc[1] & 0x20) != 0;
+			info[i].enabled = (desc[1] & 0x04) != 0;
+			info[i].deflt = epc_getle32(desc + 4);
+			info[i].timer = epc_getle32(desc + 12);
+			info[i].recovery = epc_getle32(desc + 16);
+			info[i].minimum = epc_getle32(desc + 20);
+			info[i].maximum = epc_getle32(desc + 24);
+		}
+	}
+
+	return rc;
+}
+
+// send an EPC SET FEATURES subcommand, with its parameters in the
+// sector count and LBA registers
+static int32_t
+epc_cmd(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t count, uint32_t lba)
+{
+	ata_setataparams(ata, count, 0);
+	ata_setfeature_param(ata, ATA_EPC);
+	ata_setlba(ata, lba);
+	return ata_cmd(ata, chan, dev, ATA__SETFEATURES, 0);
+}
+
+// set the timer for one condition, or disable it if ms is 0.   Timers
+// which don't fit in 16 bits of 100ms are set in minutes instead.
+static int32_t
+epc_settimer(struct ATA *ata, uint32_t chan, uint32_t dev, int cond, uint64_t ms)
+{
+	uint32_t timer = (ms + 50) / 100;
+	uint32_t lba = ATA_EPC_SET_TIMER | ((uint32_t) epc_conds[cond].id << 8);
+
+	if(timer > 0xFFFF) {
+		timer = (ms + 30000) / 60000;
+		lba |= 0x80;
+		if(timer > 0xFFFF)
+			timer = 0xFFFF;
+	}
+
+	if(ms != 0)
+		lba |= 0x20;
+	lba |= (timer & 0xFF00) << 8;
+
+	return epc_cmd(ata, chan, dev, timer & 0xFF, lba);
+}
+
+// set EPC timers from a list such as "idle_a=2s,idle_b=30s,standby_z=2h",
+// where "off" disables a condition, or disable EPC altogether with "off".
+// EPC is enabled first if it isn't already.
+int32_t
+ata_setepc(struct ATA *ata, uint32_t chan, uint32_t dev, char *spec)
+{
+	int32_t rc = 0;
+	struct ata_ident ident;
+	uint16_t *buf = (uint16_t*) &ident;
+	char *p = spec;
+
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+
+	if( !(buf[119] & 0x80) ) {
+		printf("drive does not support EPC\n");
+		return -1;
+	}
+
+	if( strcmp(spec, "off") == 0 ) {
+		rc = epc_cmd(ata, chan, dev, 0, ATA_EPC_DISABLE);
+		if(rc)
+			perror("Disable EPC failed");
+		else
+			printf("EPC disabled\n");
+		return rc;
+	}
+
+	if( !(buf[120] & 0x80) ) {
+		rc = epc_cmd(ata, chan, dev, 0, ATA_EPC_ENABLE);
+		if(rc) {
+			perror("Enable EPC failed");
+			return rc;
+		}
+		printf("EPC enabled\n");
+	}
+
+	while( !rc && *p ) {
+		char *eq = strchr(p, '=');
+		char *comma = strchr(p, ',');
+		char value[32];
+		uint64_t ms = 0;
+		int i;
+
+		if(comma == NULL)
+			comma = p + strlen(p);
+
+		for(i = 0; (eq != NULL) && (eq < comma) && (i < EPC_NCONDS); i++)
+			if( (strlen(epc_conds[i].name) == (size_t) (eq - p)) &&
+				(strncmp(p, epc_conds[i].name, eq - p) == 0) )
+				break;
+
+		if( (eq == NULL) || (eq > comma) || (i == EPC_NCONDS) ||
+			((size_t) (comma - eq) > sizeof(value)) ) {
+			printf("invalid EPC condition: must be idle_a, idle_b, idle_c,"
+					" standby_y or standby_z\n");
+			return -1;
+		}
+
+		memset(value, 0, sizeof(value));
+		memcpy(value, eq+1, comma - eq - 1);
+		if( (strcmp(value, "off") != 0) &&
+			(ata_parseduration(value, 1000, &ms) || (ms == 0)) ) {
+			printf("invalid EPC timer for %s\n", epc_conds[i].name);
+			return -1;
+		}
+
+		rc = epc_settimer(ata, chan, dev, i, ms);
+		if(rc)
+			perror("Set EPC timer failed");
+		else if(ms == 0)
+			printf("Disabled %s\n", epc_conds[i].name);
+		else
+			printf("Set %s timer to %.1fs\n", epc_conds[i].name, ms / 1000.0);
+
+		p = (*comma)? comma+1 : comma;
+	}
+
+	return rc;
+}
+
+// show the state of each power condition
+void
+ata_showepc(struct ATA *ata, uint32_t chan, uint32_t dev)
+{
+	struct ata_epcinfo info[EPC_NCONDS];
+	int i;
+
+	if( ata_epcread(ata, chan, dev, info) ) {
+		printf("Could not read the Power Conditions log\n");
+		return;
+	}
+
+	printf("%-12s%-12s%12s%12s%12s\n", "Condition", "State", "Timer",
+			"Default", "Recovery");
+	for(i = 0; i < EPC_NCONDS; i++) {
+		if(!info[i].supported)
+			printf("%-12s%-12s\n", info[i].name, "unsupported");
+		else
+			printf("%-12s%-12s%11.1fs%11.1fs%11.1fs\n", info[i].name,
+					(info[i].enabled)? "enabled" : "disabled",
+					info[i].timer / 10.0, info[i].deflt / 10.0,
+					info[i].recovery / 10.0);
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef _EPC_H_
+#define _EPC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+
+#define EPC_NCONDS	5
+
+// the state of one EPC power condition, from the Power Conditions
+// log.   Timers are in units of 100ms.
+struct ata_epcinfo {
+	const char	*name;
+	bool		supported;
+	bool		changeable;
+	bool		enabled;
+	uint32_t	timer;
+	uint32_t	deflt;
+	uint32_t	minimum;
+	uint32_t	maximum;
+	uint32_t	recovery;
+};
+
+int32_t	ata_epcread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_epcinfo info[EPC_NCONDS] );
+int32_t	ata_setepc( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				char *spec );
+void	ata_showepc( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+
+#endif
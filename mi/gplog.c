@@ -0,0 +1,336 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "sched.h"
+#include "gplog.h"
+
+// log reading.   The General Purpose Logs run to hundreds of pages, and
+// READ LOG EXT and SMART READ LOG can each fetch many of them at once,
+// so rather than a command per 512 byte page the pages are read in one
+// go into a buffer each struct ATA keeps, and which only grows, so that
+// a worker reading the same logs from drive after drive allocates once.
+
+// the smallest the buffer is allocated, enough for the Device
+// Statistics log of any drive seen so far
+#define LOG_BUFMIN		(16 * 512)
+
+// the most pages SMART READ LOG can read, its count being 8 bits
+#define LOG_SMARTPAGES	255
+
+// return a buffer of at least len bytes, reusing the last one if it's
+// big enough, or NULL if it can't be allocated
+uint8_t *ata_logbuf( struct ATA *ata, size_t len )
+{
+	if(len > ata->logbuflen) {
+		size_t newlen = (len < LOG_BUFMIN)? LOG_BUFMIN : len;
+		uint8_t *buf = (uint8_t*) realloc(ata->logbuf, newlen);
+
+		if(buf == NULL)
+			return NULL;
+		ata->logbuf = buf;
+		ata->logbuflen = newlen;
+	}
+
+	return ata->logbuf;
+}
+
+void ata_logfree( struct ATA *ata )
+{
+	free(ata->logbuf);
+	ata->logbuf = NULL;
+	ata->logbuflen = 0;
+}
+
+// read npages pages of a log, starting at page, into the log buffer.
+// data is left pointing at them, until the next command.
+int32_t ata_logread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, uint16_t npages, bool smart,
+				uint8_t **data )
+{
+	uint8_t *buf = ata_logbuf(ata, (size_t) npages * 512);
+
+	if(buf == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	memset(buf, 0, (size_t) npages * 512);
+	*data = buf;
+	return ata_readlogpages(ata, ata_chan, ata_dev, log, page, npages, smart, buf);
+}
+
+// find how many pages a log has from the log directory, trying the
+// General Purpose one and then, on drives without GPL, the SMART one,
+// and say which of them the log is to be read with.   Both give the
+// page count of each log as a 16 bit word at twice its address.
+int32_t ata_logpages( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, bool *smart, uint16_t *npages )
+{
+	uint8_t *dir;
+	int32_t rc;
+
+	*smart = false;
+	rc = ata_logread(ata, ata_chan, ata_dev, ATA_LOG_DIRECTORY, 0, 1,
+			false, &dir);
+	if(rc) {
+		*smart = true;
+		rc = ata_logread(ata, ata_chan, ata_dev, ATA_LOG_DIRECTORY, 0, 1,
+				true, &dir);
+	}
+	if(rc)
+		return rc;
+
+	*npages = dir[log * 2] | (dir[log * 2 + 1] << 8);
+	if(*smart && (*npages > LOG_SMARTPAGES))
+		*npages = LOG_SMARTPAGES;
+	if(*npages == 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	return 0;
+}
+
+// read one page of a General Purpose Log, as the EPC code wants it
+int32_t ata_readlog( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, char **databuf )
+{
+	return ata_logread(ata, ata_chan, ata_dev, log, page, 1, false,
+			(uint8_t**) databuf);
+}
+
+// Device Statistics.   Each page of the log holds a header and then
+// one 8 byte little-endian entry per statistic, with the value in the
+// low bits and flags in the top byte saying whether the drive supports
+// the statistic and whether the value is valid.
+
+enum devstat_kind {
+	DEVSTAT_COUNT,		// 48 bit count
+	DEVSTAT_CELSIUS,	// signed byte, -128 if unknown
+	DEVSTAT_PERCENT		// byte
+};
+
+static const struct {
+	const char			*name;		// for key=value output
+	const char			*label;		// for people
+	uint8_t				page;
+	uint16_t			offset;
+	enum devstat_kind	kind;
+} devstat_table[DEVSTAT_NSTATS] = {
+	{ "poweron_resets",		"Power-On Resets",		1, 8,	DEVSTAT_COUNT },
+	{ "poweron_hours",		"Power-On Hours",		1, 16,	DEVSTAT_COUNT },
+	{ "sectors_written",	"Sectors Written",		1, 24,	DEVSTAT_COUNT },
+	{ "sectors_read",		"Sectors Read",			1, 40,	DEVSTAT_COUNT },
+	{ "head_loads",			"Head Load Events",		3, 24,	DEVSTAT_COUNT },
+	{ "reallocated",		"Reallocated Sectors",	3, 32,	DEVSTAT_COUNT },
+	{ "start_failures",		"Start Failures",		3, 48,	DEVSTAT_COUNT },
+	{ "pending",			"Pending Sectors",		3, 56,	DEVSTAT_COUNT },
+	{ "uncorrectable",		"Uncorrectable Errors",	4, 8,	DEVSTAT_COUNT },
+	{ "timeout_resets",		"Command Timeouts",		4, 16,	DEVSTAT_COUNT },
+	{ "temperature",		"Temperature",			5, 8,	DEVSTAT_CELSIUS },
+	{ "temperature_max",	"Highest Temperature",	5, 32,	DEVSTAT_CELSIUS },
+	{ "temperature_min",	"Lowest Temperature",	5, 40,	DEVSTAT_CELSIUS },
+	{ "temperature_limit",	"Temperature Limit",	5, 88,	DEVSTAT_CELSIUS },
+	{ "hardware_resets",	"Hardware Resets",		6, 8,	DEVSTAT_COUNT },
+	{ "crc_errors",			"Interface CRC Errors",	6, 24,	DEVSTAT_COUNT },
+	{ "endurance_used",		"Endurance Used",		7, 8,	DEVSTAT_PERCENT }
+};
+
+// the flags in the top byte of each entry
+#define DEVSTAT_SUPPORTED	0x80
+#define DEVSTAT_VALID		0x40
+
+const char *ata_devstatname( enum ata_devstat stat, bool label )
+{
+	return (label)? devstat_table[stat].label : devstat_table[stat].name;
+}
+
+// decode the statistics from npages pages of the log, as read from
+// its first page.   A page the drive doesn't have is read back with
+// a header naming another page, or none, and is skipped.
+void ata_devstatsdecode( const uint8_t *log, uint16_t npages,
+				struct ata_devstats *stats )
+{
+	uint32_t i;
+	int j;
+
+	memset(stats->valid, 0, sizeof(stats->valid));
+	memset(stats->value, 0, sizeof(stats->value));
+
+	for(i = 0; i < DEVSTAT_NSTATS; i++) {
+		const uint8_t *page, *entry;
+		uint64_t raw = 0;
+
+		if(devstat_table[i].page >= npages)
+			continue;
+		page = log + devstat_table[i].page * 512;
+		if( (page[2] != devstat_table[i].page) || ((page[0] | page[1]) == 0) )
+			continue;
+
+		entry = page + devstat_table[i].offset;
+		if( (entry[7] & (DEVSTAT_SUPPORTED | DEVSTAT_VALID)) !=
+				(DEVSTAT_SUPPORTED | DEVSTAT_VALID) )
+			continue;
+
+		for(j = 5; j >= 0; j--)
+			raw = (raw << 8) | entry[j];
+
+		switch(devstat_table[i].kind) {
+			case DEVSTAT_COUNT:
+				stats->value[i] = (int64_t) raw;
+				break;
+
+			case DEVSTAT_CELSIUS:
+				if(entry[0] == 0x80)
+					continue;
+				stats->value[i] = (int8_t) entry[0];
+				break;
+
+			case DEVSTAT_PERCENT:
+				stats->value[i] = entry[0];
+				break;
+		}
+		stats->valid[i] = true;
+	}
+}
+
+// read the whole Device Statistics log with a single command, after
+// the one finding its length
+int32_t ata_devstatsread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_devstats *stats )
+{
+	uint8_t *log;
+	uint16_t npages;
+	int32_t rc;
+
+	memset(stats, 0, sizeof(struct ata_devstats));
+	rc = ata_logpages(ata, ata_chan, ata_dev, ATA_LOG_DEVICE_STATISTICS,
+			&stats->smart, &npages);
+	if(!rc)
+		rc = ata_logread(ata, ata_chan, ata_dev, ATA_LOG_DEVICE_STATISTICS,
+				0, npages, stats->smart, &log);
+	if(!rc)
+		ata_devstatsdecode(log, npages, stats);
+
+	return rc;
+}
+
+// print the statistics the drive reported, lined up as device info is
+void ata_devstatsshow( const struct ata_devstats *stats )
+{
+	uint32_t i;
+
+	for(i = 0; i < DEVSTAT_NSTATS; i++) {
+		if(!stats->valid[i])
+			continue;
+
+		printf("%s:%s", devstat_table[i].label,
+				(strlen(devstat_table[i].label) < 15)? "\t\t" : "\t");
+
+		switch(devstat_table[i].kind) {
+			case DEVSTAT_COUNT:
+				printf("%lld\n", (long long) stats->value[i]);
+				break;
+
+			case DEVSTAT_CELSIUS:
+				printf("%lld C\n", (long long) stats->value[i]);
+				break;
+
+			case DEVSTAT_PERCENT:
+				printf("%lld%%\n", (long long) stats->value[i]);
+				break;
+		}
+	}
+}
+
+struct devstats_run {
+	struct ata_devtable		*table;
+	struct ata_devstats		*stats;
+	int32_t					*rcs;
+};
+
+static int32_t devstats_job( struct ATA *ata, struct ata_devent *ent, void *arg )
+{
+	struct devstats_run *run = (struct devstats_run*) arg;
+	size_t i = ent - run->table->ents;
+
+	run->rcs[i] = ata_devstatsread(ata, ent->chan, ent->dev, &run->stats[i]);
+	return 0;
+}
+
+// read every drive's statistics, in parallel, and print one line of
+// key=value pairs per drive with those it reports, for monitoring
+int32_t ata_devstatsall( struct ata_devtable *table, uint32_t jobs,
+				uint32_t ctrljobs )
+{
+	struct devstats_run run;
+	size_t i, j;
+	int32_t rc;
+
+	run.table = table;
+	run.stats = (struct ata_devstats*) calloc(table->nents + 1,
+					sizeof(struct ata_devstats));
+	run.rcs = (int32_t*) calloc(table->nents + 1, sizeof(int32_t));
+	if( (run.stats == NULL) || (run.rcs == NULL) ) {
+		fprintf(stderr, "malloc failed\n");
+		free(run.stats);
+		free(run.rcs);
+		return -1;
+	}
+
+	rc = ata_schedrun(table, devstats_job, &run, jobs, ctrljobs);
+
+	for(i = 0; !rc && (i < table->nents); i++) {
+		printf("drive=%s wwn=%s", table->ents[i].devpath,
+				(table->ents[i].wwn[0])? table->ents[i].wwn : "-");
+		if(run.rcs[i]) {
+			printf(" status=unsupported\n");
+			continue;
+		}
+
+		printf(" log=%s", (run.stats[i].smart)? "smart" : "gpl");
+		for(j = 0; j < DEVSTAT_NSTATS; j++)
+			if(run.stats[i].valid[j])
+				printf(" %s=%lld", devstat_table[j].name,
+						(long long) run.stats[i].value[j]);
+		printf(" status=ok\n");
+	}
+
+	free(run.stats);
+	free(run.rcs);
+	return rc;
+}
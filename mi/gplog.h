@@ -0,0 +1,57 @@
+#ifndef _GPLOG_H_
+#define _GPLOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+#include "devtable.h"
+
+// the statistics decoded from the Device Statistics log
+enum ata_devstat {
+	DEVSTAT_POWERON_RESETS,
+	DEVSTAT_POWERON_HOURS,
+	DEVSTAT_SECTORS_WRITTEN,
+	DEVSTAT_SECTORS_READ,
+	DEVSTAT_HEAD_LOADS,
+	DEVSTAT_REALLOCATED,
+	DEVSTAT_START_FAILURES,
+	DEVSTAT_PENDING,
+	DEVSTAT_UNCORRECTABLE,
+	DEVSTAT_TIMEOUT_RESETS,
+	DEVSTAT_TEMPERATURE,
+	DEVSTAT_TEMPERATURE_MAX,
+	DEVSTAT_TEMPERATURE_MIN,
+	DEVSTAT_TEMPERATURE_LIMIT,
+	DEVSTAT_HARDWARE_RESETS,
+	DEVSTAT_CRC_ERRORS,
+	DEVSTAT_ENDURANCE_USED,
+	DEVSTAT_NSTATS
+};
+
+struct ata_devstats {
+	bool		valid[DEVSTAT_NSTATS];	// reported by the drive
+	int64_t		value[DEVSTAT_NSTATS];
+	bool		smart;					// read with SMART READ LOG
+};
+
+uint8_t *	ata_logbuf( struct ATA *ata, size_t len );
+void	ata_logfree( struct ATA *ata );
+int32_t	ata_logread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, uint16_t npages, bool smart,
+				uint8_t **data );
+int32_t	ata_logpages( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, bool *smart, uint16_t *npages );
+int32_t	ata_readlog( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t log, uint16_t page, char **databuf );
+const char *	ata_devstatname( enum ata_devstat stat, bool label );
+void	ata_devstatsdecode( const uint8_t *log, uint16_t npages,
+				struct ata_devstats *stats );
+int32_t	ata_devstatsread( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_devstats *stats );
+void	ata_devstatsshow( const struct ata_devstats *stats );
+int32_t	ata_devstatsall( struct ata_devtable *table, uint32_t jobs,
+				uint32_t ctrljobs );
+
+#endif
@@ -0,0 +1,356 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+// IDENTIFY page decoding.   Everything ataidle wants from a page is
+// decoded in one pass into a struct ata_identinfo, rather than each
+// user testing bits in the raw words; this is also what the inventory
+// runs over thousands of captured pages.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "identify.h"
+
+// where each feature's supported and enabled bits are.   Those with
+// no separate enabled bit are given the supported one twice.
+static const struct ident_bit {
+	uint32_t	feature;
+	const char	*name;
+	uint8_t		suppword, suppbit;
+	uint8_t		enword, enbit;
+} ident_bits[] = {
+	{ IDENT_SMART,		"smart",	 82,  0,  85,  0 },
+	{ IDENT_SECURITY,	"security",	 82,  1,  85,  1 },
+	{ IDENT_WCACHE,		"wcache",	 82,  5,  85,  5 },
+	{ IDENT_LOOKAHEAD,	"lookahead", 82,  6,  85,  6 },
+	{ IDENT_HPA,		"hpa",		 82, 10,  85, 10 },
+	{ IDENT_APM,		"apm",		 83,  3,  86,  3 },
+	{ IDENT_PUIS,		"puis",		 83,  5,  86,  5 },
+	{ IDENT_PUISSPINUP,	"puisspinup", 83, 6,  86,  6 },
+	{ IDENT_AAC,		"aac",		 83,  9,  86,  9 },
+	{ IDENT_LBA48,		"lba48",	 83, 10,  86, 10 },
+	{ IDENT_FLUSHEXT,	"flushext",	 83, 13,  86, 13 },
+	{ IDENT_GPL,		"gpl",		 84,  5,  87,  5 },
+	{ IDENT_WWN,		"wwn",		 84,  8,  87,  8 },
+	{ IDENT_UNLOAD,		"unload",	 84, 13,  84, 13 },
+	{ IDENT_NCQ,		"ncq",		 76,  8,  76,  8 },
+	{ IDENT_HIPM,		"hipm",		 76,  9,  76,  9 },
+	{ IDENT_DIPM,		"dipm",		 78,  3,  79,  3 },
+	{ IDENT_DEVSLEEP,	"devsleep",	 78,  8,  79,  8 },
+	{ IDENT_TRIM,		"trim",		169,  0, 169,  0 },
+	{ IDENT_EPC,		"epc",		119,  7, 120,  7 }
+};
+
+#define IDENT_NBITS (sizeof(ident_bits) / sizeof(ident_bits[0]))
+
+// swap the bytes of each 16 bit word in x
+static uint64_t ident_swap64( uint64_t x )
+{
+	return ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+}
+
+// copy len bytes of an IDENTIFY string to dst, which must hold len+1,
+// as a C string.   The bytes of each word are swapped eight at a time,
+// and the padding spaces are trimmed from both ends in place.
+void ata_identstring( char *dst, const uint8_t *src, size_t len )
+{
+	size_t i, start = 0, end;
+	uint64_t x;
+
+	for(i = 0; i + 8 <= len; i += 8) {
+		memcpy(&x, src+i, 8);
+		x = ident_swap64(x);
+		memcpy(dst+i, &x, 8);
+	}
+	for(; i + 2 <= len; i += 2) {
+		dst[i] = src[i+1];
+		dst[i+1] = src[i];
+	}
+
+	end = i;
+	while( (end > 0) && ((dst[end-1] == ' ') || (dst[end-1] == 0)) )
+		end--;
+	while( (start < end) && (dst[start] == ' ') )
+		start++;
+	if(start)
+		memmove(dst, dst+start, end-start);
+	dst[end-start] = 0;
+}
+
+// the highest bit set of the first n in bits, or -1 if none are
+static int8_t ident_highbit( uint16_t bits, int n )
+{
+	int i;
+
+	for(i = n - 1; i >= 0; i--)
+		if( bits & (1 << i) )
+			return i;
+	return -1;
+}
+
+// decode the transfer modes, multiple sector setting and SATA link
+// speed, each only if the words which give it are valid
+static void ident_xfer( const uint16_t *w, struct ata_identinfo *info )
+{
+	info->udma = info->udmamax = -1;
+	info->mdma = info->mdmamax = -1;
+
+	// word 53 bit 2 says word 88 is valid, and bit 1 words 64-70
+	if( (w[53] != 0xFFFF) && (w[53] & 0x0004) ) {
+		info->udmamax = ident_highbit(w[88], 7);
+		info->udma = ident_highbit(w[88] >> 8, 7);
+	}
+	info->mdmamax = ident_highbit(w[63], 3);
+	info->mdma = ident_highbit(w[63] >> 8, 3);
+
+	// PIO modes 3 and 4 have bits of their own, the others
+	// are in the old PIO timing mode of word 51
+	if( (w[53] != 0xFFFF) && (w[53] & 0x0002) && (w[64] & 0x0003) )
+		info->piomax = (w[64] & 0x0002)? 4 : 3;
+	else
+		info->piomax = ((w[51] >> 8) > 2)? 2 : (w[51] >> 8);
+
+	info->multsectmax = w[47] & 0xFF;
+	if(w[59] & 0x0100)
+		info->multsect = w[59] & 0xFF;
+
+	// words 76 and 77 give the generations the drive supports, and the
+	// one the link came up at
+	if( (w[76] != 0) && (w[76] != 0xFFFF) && (w[76] & 0x000E) ) {
+		info->satamax = ident_highbit(w[76] & 0x000E, 4);
+		if(w[77] != 0xFFFF)
+			info->sata = (w[77] >> 1) & 0x7;
+	}
+}
+
+// decode an IDENTIFY page, as the drive returned it
+void ata_identdecode( const struct ata_ident *ident, struct ata_identinfo *info )
+{
+	const uint16_t *w = (const uint16_t*) ident;
+	size_t i;
+
+	memset(info, 0, sizeof(struct ata_identinfo));
+	ata_identstring(info->model, ident->model, sizeof(ident->model));
+	ata_identstring(info->serial, ident->serial, sizeof(ident->serial));
+	ata_identstring(info->firmware, ident->firmware, sizeof(ident->firmware));
+
+	// words which are all ones aren't implemented
+	for(i = 0; i < IDENT_NBITS; i++) {
+		const struct ident_bit *b = &ident_bits[i];
+
+		if( (w[b->suppword] != 0xFFFF) && (w[b->suppword] & (1 << b->suppbit)) ) {
+			info->supported |= b->feature;
+			if( (w[b->enword] != 0xFFFF) && (w[b->enword] & (1 << b->enbit)) )
+				info->enabled |= b->feature;
+		}
+	}
+
+	if( info->supported & IDENT_LBA48 )
+		info->sectors = (uint64_t) w[100] | ((uint64_t) w[101] << 16) |
+				((uint64_t) w[102] << 32) | ((uint64_t) w[103] << 48);
+	else
+		info->sectors = (uint64_t) w[60] | ((uint64_t) w[61] << 16);
+
+	// word 106 says if the logical sectors are longer than 512 bytes,
+	// in which case words 117-118 give their length in words
+	info->sectorsize = 512;
+	if( ((w[106] & 0xC000) == 0x4000) && (w[106] & 0x1000) )
+		info->sectorsize = 2 * ((uint32_t) w[117] | ((uint32_t) w[118] << 16));
+
+	if( (w[87] & 0xC100) == 0x4100 )
+		info->wwn = ((uint64_t) w[108] << 48) | ((uint64_t) w[109] << 32) |
+				((uint64_t) w[110] << 16) | (uint64_t) w[111];
+
+	if( (w[80] != 0) && (w[80] != 0xFFFF) )
+		for(i = 14; i > 0; i--)
+			if( w[80] & (1 << i) ) {
+				info->version = i;
+				break;
+			}
+
+	info->rpm = w[217];
+	info->cyls = w[1];
+	info->heads = w[3];
+	info->spt = w[6];
+	info->apm = w[91] & 0xFF;
+	info->aac = w[94] & 0xFF;
+	info->aacrecommended = w[94] >> 8;
+	if( info->supported & IDENT_NCQ )
+		info->queuedepth = (w[75] & 0x1F) + 1;
+
+	ident_xfer(w, info);
+
+	// word 2 says whether the drive needs ATA_PUIS_SPINUP after power
+	// on, and whether the rest of the page is complete.   Only an
+	// incomplete page means it hasn't spun up yet: 0x738C is also what
+	// a drive which needs the subcommand reports once it's spinning.
+	info->waiting = (w[2] == ATA_IDENT_SPINUP_PARTIAL);
+}
+
+// return a monotonic timestamp in seconds
+static double ident_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// the fastest transfer mode selected, or with max the fastest the
+// drive supports, as e.g. "UDMA5"
+char * ata_identxfer( const struct ata_identinfo *info, bool max,
+				char *buf, size_t len )
+{
+	int8_t udma = (max)? info->udmamax : info->udma;
+	int8_t mdma = (max)? info->mdmamax : info->mdma;
+
+	if(udma >= 0)
+		snprintf(buf, len, "UDMA%d", udma);
+	else if(mdma >= 0)
+		snprintf(buf, len, "MDMA%d", mdma);
+	else
+		snprintf(buf, len, "PIO%d", info->piomax);
+	return buf;
+}
+
+// whether the drive is running below what it's capable of, as after a
+// cable error makes the host fall back to a slower mode or even PIO, or
+// the SATA link comes up at a lower generation, and if so why in buf.
+// The link can also be held back by the controller, or a port multiplier.
+bool ata_identdegraded( const struct ata_identinfo *info, char *buf, size_t len )
+{
+	char cur[16], max[16];
+
+	if( ((info->udmamax >= 0) && (info->udma < info->udmamax)) ||
+			((info->udmamax < 0) && (info->mdmamax >= 0) &&
+			(info->mdma < info->mdmamax)) ) {
+		snprintf(buf, len, "%s, the drive supports %s",
+				ata_identxfer(info, false, cur, sizeof(cur)),
+				ata_identxfer(info, true, max, sizeof(max)));
+		return true;
+	}
+	if( info->sata && (info->sata < info->satamax) ) {
+		snprintf(buf, len, "SATA link at Gen%u, the drive supports Gen%u",
+				info->sata, info->satamax);
+		return true;
+	}
+	buf[0] = 0;
+	return false;
+}
+
+// read path, a file of IDENTIFY pages such as captured from many drives,
+// and list the drives in it.   The decoding is timed over repeated
+// passes of at least a second, to give the pages decoded per second.
+int32_t ata_inventory( const char *path )
+{
+	struct ata_identinfo *infos = NULL;
+	struct ata_ident *pages = NULL;
+	size_t npages = 0, maxpages = 0, i, j, passes = 0;
+	double start, elapsed;
+	FILE *fp;
+	int32_t rc = 0;
+
+	fp = fopen(path, "rb");
+	if(fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	for(;;) {
+		if(npages == maxpages) {
+			struct ata_ident *p;
+
+			maxpages = maxpages? maxpages * 2 : 256;
+			p = (struct ata_ident*) realloc(pages, maxpages * sizeof(struct ata_ident));
+			if(p == NULL) {
+				fprintf(stderr, "malloc failed\n");
+				rc = -1;
+				break;
+			}
+			pages = p;
+		}
+		if( fread(&pages[npages], sizeof(struct ata_ident), 1, fp) != 1 )
+			break;
+		npages++;
+	}
+	if( !rc && ferror(fp) ) {
+		perror(path);
+		rc = -1;
+	}
+	fclose(fp);
+
+	if( !rc && (npages == 0) ) {
+		printf("%s: no IDENTIFY pages\n", path);
+		rc = -1;
+	}
+	if( !rc && ((infos = (struct ata_identinfo*)
+			malloc(npages * sizeof(struct ata_identinfo))) == NULL) ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+	if(rc) {
+		free(pages);
+		return rc;
+	}
+
+	start = ident_now();
+	do {
+		for(i = 0; i < npages; i++)
+			ata_identdecode(&pages[i], &infos[i]);
+		passes++;
+		elapsed = ident_now() - start;
+	} while(elapsed < 1.0);
+
+	printf("%-40s %-20s %-8s %10s  %s\n", "Model", "Serial", "Firmware",
+			"Capacity", "Features");
+	for(i = 0; i < npages; i++) {
+		struct ata_identinfo *info = &infos[i];
+
+		printf("%-40s %-20s %-8s %8.1fGB ", info->model, info->serial,
+				info->firmware, (double) info->sectors * info->sectorsize / 1e9);
+		for(j = 0; j < IDENT_NBITS; j++)
+			if(info->supported & ident_bits[j].feature)
+				printf(" %s%s", ident_bits[j].name,
+						(info->enabled & ident_bits[j].feature)? "" : "(off)");
+		printf("\n");
+	}
+
+	printf("\ndecoded %lu pages %lu times in %.2fs: %.0f pages/sec\n",
+			(unsigned long) npages, (unsigned long) passes, elapsed,
+			npages * passes / elapsed);
+
+	free(infos);
+	free(pages);
+	return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef _IDENTIFY_H_
+#define _IDENTIFY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+
+// the features ata_identdecode() reports as supported and enabled
+enum ata_identfeature {
+	IDENT_SMART		= 0x00000001,
+	IDENT_SECURITY	= 0x00000002,
+	IDENT_WCACHE	= 0x00000004,
+	IDENT_LOOKAHEAD	= 0x00000008,
+	IDENT_HPA		= 0x00000010,	// host protected area
+	IDENT_APM		= 0x00000020,
+	IDENT_PUIS		= 0x00000040,	// power-up in standby
+	IDENT_AAC		= 0x00000080,
+	IDENT_LBA48		= 0x00000100,
+	IDENT_FLUSHEXT	= 0x00000200,
+	IDENT_GPL		= 0x00000400,	// general purpose logging
+	IDENT_WWN		= 0x00000800,
+	IDENT_UNLOAD	= 0x00001000,
+	IDENT_NCQ		= 0x00002000,
+	IDENT_HIPM		= 0x00004000,	// host initiated link power management
+	IDENT_DIPM		= 0x00008000,	// device initiated link power management
+	IDENT_TRIM		= 0x00010000,
+	IDENT_EPC		= 0x00020000,
+	IDENT_PUISSPINUP	= 0x00040000,	// PUIS drive waits for SET FEATURES to spin up
+	IDENT_DEVSLEEP	= 0x00080000	// SATA DevSleep
+};
+
+// everything ataidle uses from an IDENTIFY page, decoded
+struct ata_identinfo {
+	char		model[41];		// without the padding spaces
+	char		serial[21];
+	char		firmware[9];
+	uint64_t	sectors;		// 48 bit when the drive supports it
+	uint32_t	sectorsize;		// logical, in bytes
+	uint64_t	wwn;			// 0 if the drive doesn't report one
+	uint32_t	supported;		// enum ata_identfeature bits
+	uint32_t	enabled;
+	uint16_t	version;		// highest ATA/ATAPI major version, 0 if unknown
+	uint16_t	rpm;			// 0 if not reported, 1 if not rotating
+	uint16_t	cyls, heads, spt;
+	uint8_t		apm;			// current APM level
+	uint8_t		aac;			// current and vendor recommended AAC
+	uint8_t		aacrecommended;
+	uint8_t		queuedepth;		// NCQ queue depth
+	bool		waiting;		// powered up in standby, waiting to be spun up
+	int8_t		udma, udmamax;	// selected and highest UDMA modes, -1 if none
+	int8_t		mdma, mdmamax;	// and multiword DMA modes
+	int8_t		piomax;			// highest PIO mode
+	uint8_t		multsect;		// sectors per READ/WRITE MULTIPLE block, 0 if off
+	uint8_t		multsectmax;
+	uint8_t		sata, satamax;	// SATA generation of the link and the
+								// drive's highest, 0 if not reported
+};
+
+void	ata_identstring( char *dst, const uint8_t *src, size_t len );
+void	ata_identdecode( const struct ata_ident *ident, struct ata_identinfo *info );
+char *	ata_identxfer( const struct ata_identinfo *info, bool max,
+				char *buf, size_t len );
+bool	ata_identdegraded( const struct ata_identinfo *info, char *buf, size_t len );
+int32_t	ata_inventory( const char *path );
+
+#endif
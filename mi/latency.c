@@ -0,0 +1,298 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "identify.h"
+#include "sched.h"
+#include "latency.h"
+
+// fail-slow detection.   A drive on its way out often takes seconds to
+// answer commands which never touch the media, such as IDENTIFY and
+// CHECK POWER MODE, long before it starts returning errors, and drags
+// the latency of its whole array down with it.   Each drive keeps the
+// latencies of its last few such commands, and the median of those is
+// compared with the medians of the other drives of the same model, so
+// a shelf of slow but healthy drives isn't flagged while one drive a
+// hundred times slower than its twins is.
+
+// a drive is slow if its median is this many times its peers', and
+// more than LATENCY_MARGIN_MS more, so that noise at a fraction of a
+// millisecond doesn't count
+#define LATENCY_FACTOR		10
+#define LATENCY_MARGIN_MS	10
+
+// or, whatever its peers do, if its median is this long
+#define LATENCY_ABSOLUTE_MS	500
+
+// peers needed for the comparison to mean anything
+#define LATENCY_MINPEERS	2
+
+// between rounds of probes, in microseconds, so that each round finds
+// the drive's queue as the rest of the system leaves it
+#define LATENCY_PROBEGAP	50000
+
+void ata_latencyadd( struct ata_latency *lat, double ms )
+{
+	lat->samples[lat->n % ATA_LATENCY_WINDOW] = ms;
+	lat->n++;
+}
+
+static int latency_cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+
+	return (x > y) - (x < y);
+}
+
+// the median of the samples in the window, or 0 if there are none
+double ata_latencymedian( const struct ata_latency *lat )
+{
+	double sorted[ATA_LATENCY_WINDOW];
+	size_t n = (lat->n < ATA_LATENCY_WINDOW)? lat->n : ATA_LATENCY_WINDOW;
+
+	if(n == 0)
+		return 0;
+
+	memcpy(sorted, lat->samples, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), latency_cmpdouble);
+	return (n % 2)? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+double ata_latencymax( const struct ata_latency *lat )
+{
+	size_t n = (lat->n < ATA_LATENCY_WINDOW)? lat->n : ATA_LATENCY_WINDOW;
+	double max = 0;
+	size_t i;
+
+	for(i = 0; i < n; i++)
+		if(lat->samples[i] > max)
+			max = lat->samples[i];
+	return max;
+}
+
+// order drives by model, then by median
+static int latency_cmppeer(const void *a, const void *b)
+{
+	const struct ata_latencypeer *x = *(struct ata_latencypeer * const *) a;
+	const struct ata_latencypeer *y = *(struct ata_latencypeer * const *) b;
+	int c = strcmp(x->model, y->model);
+
+	if(c)
+		return c;
+	return (x->median > y->median) - (x->median < y->median);
+}
+
+// the median of a sorted group of medians, leaving out the one at skip
+static double latency_peermedian( struct ata_latencypeer **group, size_t n,
+				size_t skip )
+{
+	size_t m = n - 1, lo = (m - 1) / 2, hi = m / 2;
+
+	// indices into the group with skip taken out
+	lo += (lo >= skip);
+	hi += (hi >= skip);
+	return (group[lo]->median + group[hi]->median) / 2;
+}
+
+// compare each drive with the others of its model, setting peers,
+// npeers and slow, and return how many are slow.   Drives without
+// samples, with a median of 0, are left out.
+size_t ata_latencycompare( struct ata_latencypeer *drives, size_t n )
+{
+	struct ata_latencypeer **sorted;
+	size_t i, j, k, nsorted = 0, nslow = 0;
+
+	sorted = (struct ata_latencypeer**) calloc(n + 1, sizeof(struct ata_latencypeer*));
+	if(sorted == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		return 0;
+	}
+
+	for(i = 0; i < n; i++) {
+		drives[i].peers = 0;
+		drives[i].npeers = 0;
+		drives[i].slow = false;
+		if(drives[i].median > 0)
+			sorted[nsorted++] = &drives[i];
+	}
+	qsort(sorted, nsorted, sizeof(struct ata_latencypeer*), latency_cmppeer);
+
+	// each run of the same model is a group of peers
+	for(i = 0; i < nsorted; i = j) {
+		for(j = i + 1; j < nsorted; j++)
+			if( strcmp(sorted[i]->model, sorted[j]->model) != 0 )
+				break;
+
+		for(k = i; k < j; k++) {
+			struct ata_latencypeer *drive = sorted[k];
+
+			drive->npeers = j - i - 1;
+			if(drive->npeers >= LATENCY_MINPEERS) {
+				drive->peers = latency_peermedian(&sorted[i], j - i, k - i);
+				drive->slow = (drive->median > drive->peers * LATENCY_FACTOR) &&
+						(drive->median > drive->peers + LATENCY_MARGIN_MS);
+			}
+			if(drive->median >= LATENCY_ABSOLUTE_MS)
+				drive->slow = true;
+			if(drive->slow)
+				nslow++;
+		}
+	}
+
+	free(sorted);
+	return nslow;
+}
+
+struct latency_result {
+	struct ata_latency	lat;
+	char				model[41];
+	char				wwn[24];
+	uint32_t			errors;
+};
+
+struct latency_run {
+	struct ata_devtable		*table;
+	struct latency_result	*results;
+	uint32_t				probes;
+};
+
+static double latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// probe one drive with rounds of CHECK POWER MODE and IDENTIFY.   A
+// command which fails still counts, for the time it took to fail.
+static int32_t latency_probejob( struct ATA *ata, struct ata_devent *ent, void *arg )
+{
+	struct latency_run *run = (struct latency_run*) arg;
+	struct latency_result *res = &run->results[ent - run->table->ents];
+	struct ata_identinfo info;
+	struct ata_ident ident;
+	bool haveident = false;
+	uint8_t mode;
+	uint32_t i;
+	double t;
+
+	for(i = 0; i < run->probes; i++) {
+		if(i)
+			usleep(LATENCY_PROBEGAP);
+
+		t = latency_now();
+		if( ata_getpowermode(ata, ent->chan, ent->dev, &mode) )
+			res->errors++;
+		ata_latencyadd(&res->lat, (latency_now() - t) * 1000);
+
+		t = latency_now();
+		if( ata_ident(ata, ent->chan, ent->dev, &ident) )
+			res->errors++;
+		else
+			haveident = true;
+		ata_latencyadd(&res->lat, (latency_now() - t) * 1000);
+	}
+
+	// the model the drive reports is the one its peers are found by
+	snprintf(res->model, sizeof(res->model), "%s", ent->model);
+	snprintf(res->wwn, sizeof(res->wwn), "%s", ent->wwn);
+	if(haveident) {
+		ata_identdecode(&ident, &info);
+		if(info.model[0])
+			snprintf(res->model, sizeof(res->model), "%s", info.model);
+		if( (res->wwn[0] == 0) && info.wwn )
+			snprintf(res->wwn, sizeof(res->wwn), "0x%016llx",
+					(unsigned long long) info.wwn);
+	}
+	return 0;
+}
+
+// probe every drive in the table, compare each with its peers and
+// print one line of key=value pairs per drive.   Returns
+// ATA_LATENCY_SLOW if any drive is slow.
+int32_t ata_latencyprobe( struct ata_devtable *table, uint32_t probes,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	struct latency_run run;
+	struct ata_latencypeer *peers;
+	size_t i, nslow = 0;
+	int32_t rc;
+
+	memset(&run, 0, sizeof(run));
+	run.table = table;
+	run.probes = probes;
+	run.results = (struct latency_result*) calloc(table->nents + 1,
+					sizeof(struct latency_result));
+	peers = (struct ata_latencypeer*) calloc(table->nents + 1,
+					sizeof(struct ata_latencypeer));
+	if( (run.results == NULL) || (peers == NULL) ) {
+		fprintf(stderr, "malloc failed\n");
+		free(run.results);
+		free(peers);
+		return -1;
+	}
+
+	rc = ata_schedrun(table, latency_probejob, &run, jobs, ctrljobs);
+
+	if(!rc) {
+		for(i = 0; i < table->nents; i++) {
+			peers[i].model = run.results[i].model;
+			peers[i].median = ata_latencymedian(&run.results[i].lat);
+		}
+		nslow = ata_latencycompare(peers, table->nents);
+
+		for(i = 0; i < table->nents; i++) {
+			struct latency_result *res = &run.results[i];
+
+			printf("drive=%s wwn=%s model=\"%s\" median_ms=%.3f max_ms=%.3f "
+					"peers_ms=%.3f peers=%u errors=%u status=%s\n",
+					table->ents[i].devpath, (res->wwn[0])? res->wwn : "-",
+					res->model, peers[i].median, ata_latencymax(&res->lat),
+					peers[i].peers, peers[i].npeers, res->errors,
+					(peers[i].slow)? "slow" : "ok");
+		}
+		printf("%lu of %lu drive%s slow\n", (unsigned long) nslow,
+				(unsigned long) table->nents, (table->nents == 1)? "" : "s");
+	}
+
+	free(peers);
+	free(run.results);
+	if( !rc && nslow )
+		rc = ATA_LATENCY_SLOW;
+	return rc;
+}
@@ -0,0 +1,39 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+#include "devtable.h"
+
+// samples kept in each drive's rolling baseline
+#define ATA_LATENCY_WINDOW	64
+
+// exit status of a probe run which found a slow drive
+#define ATA_LATENCY_SLOW	2
+
+// the latest non-media command latencies of a drive, in ms
+struct ata_latency {
+	double		samples[ATA_LATENCY_WINDOW];	// a ring
+	uint32_t	n;			// samples taken altogether
+};
+
+// a drive as compared with the others of its model
+struct ata_latencypeer {
+	const char	*model;
+	double		median;		// the drive's own, in ms
+	double		peers;		// the median of its peers' medians, or 0
+	uint32_t	npeers;
+	bool		slow;
+};
+
+void	ata_latencyadd( struct ata_latency *lat, double ms );
+double	ata_latencymedian( const struct ata_latency *lat );
+double	ata_latencymax( const struct ata_latency *lat );
+size_t	ata_latencycompare( struct ata_latencypeer *drives, size_t n );
+int32_t	ata_latencyprobe( struct ata_devtable *table, uint32_t probes,
+				uint32_t jobs, uint32_t ctrljobs );
+
+#endif
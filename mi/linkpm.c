@@ -0,0 +1,167 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "identify.h"
+#include "latency.h"
+#include "bench.h"
+#include "linkpm.h"
+
+// SATA link power management.   Besides the drive's own power states,
+// the link between it and the host can drop into Partial or Slumber,
+// and with DevSleep the drive's PHY can be turned off altogether, each
+// saving more power and taking longer to wake for the next command.
+// The host's policy decides how far the link goes, with HIPM the host
+// asking for the low power states, and with DIPM the drive; libata
+// sets DIPM on the drive as the policy calls for.
+
+// after each read, how long to leave the link idle so it can drop into
+// its low power states, in microseconds
+#define LINKPM_IDLE		500000
+
+static const char * const linkpm_names[LINKPM_N] = {
+	"max_performance", "medium_power", "med_power_with_dipm", "min_power"
+};
+
+int32_t ata_linkpmparse( const char *name )
+{
+	int32_t i;
+
+	for(i = 0; i < LINKPM_N; i++)
+		if( strcmp(name, linkpm_names[i]) == 0 )
+			return i;
+	return -1;
+}
+
+const char *ata_linkpmname( int32_t pm )
+{
+	return ( (pm >= 0) && (pm < LINKPM_N) )? linkpm_names[pm] : "unknown";
+}
+
+int32_t ata_linkpmset( struct ATA *ata, uint32_t chan, uint32_t dev,
+				const char *name )
+{
+	if( ata_linkpmparse(name) < 0 ) {
+		printf("invalid link power policy: use max_performance, medium_power,\n"
+				"med_power_with_dipm or min_power\n");
+		return -1;
+	}
+
+	if( ata_setlinkpm(ata, chan, dev, name) ) {
+		perror("Set link power policy failed");
+		return -1;
+	}
+
+	printf("Link power policy set to %s\n", name);
+	return 0;
+}
+
+// measure how much each policy adds to the first read after the link
+// has been left idle.   The same block is read each time, from the
+// drive's cache, so that neither seeks nor the drive's own power
+// states hide the link's wake, and the drive's policy is put back at
+// the end.
+int32_t ata_linkpmprobe( struct ATA *ata, uint32_t chan, uint32_t dev,
+				uint32_t probes )
+{
+	struct ata_identinfo info;
+	struct ata_ident ident;
+	char orig[32];
+	double base = 0, ms;
+	int32_t pm, rc = 0;
+	uint32_t i;
+
+	if( ata_getlinkpm(ata, chan, dev, orig, sizeof(orig)) ) {
+		perror("error reading the link power policy");
+		return -1;
+	}
+
+	if( !ata_ident(ata, chan, dev, &ident) ) {
+		ata_identdecode(&ident, &info);
+		printf("%s: HIPM %s, DIPM %s, DevSleep %s, policy %s\n",
+				ata_devlabel(ata, chan, dev),
+				(info.supported & IDENT_HIPM)? "supported" : "not supported",
+				(info.enabled & IDENT_DIPM)? "enabled" :
+				(info.supported & IDENT_DIPM)? "supported" : "not supported",
+				(info.enabled & IDENT_DEVSLEEP)? "enabled" :
+				(info.supported & IDENT_DEVSLEEP)? "supported" : "not supported",
+				orig);
+	}
+
+	if(probes > ATA_LATENCY_WINDOW)
+		probes = ATA_LATENCY_WINDOW;
+
+	// bring the block into the drive's cache, spinning it up if need be
+	rc = ata_benchwakecached(ata, chan, dev, &ms);
+
+	for(pm = 0; !rc && (pm < LINKPM_N); pm++) {
+		struct ata_latency lat;
+		uint32_t errors = 0;
+
+		if( ata_setlinkpm(ata, chan, dev, linkpm_names[pm]) ) {
+			printf("policy=%s status=unsupported\n", linkpm_names[pm]);
+			continue;
+		}
+
+		memset(&lat, 0, sizeof(lat));
+		for(i = 0; i < probes; i++) {
+			usleep(LINKPM_IDLE);
+			if( ata_benchwakecached(ata, chan, dev, &ms) )
+				errors++;
+			else
+				ata_latencyadd(&lat, ms);
+		}
+
+		if(lat.n == 0) {
+			printf("policy=%s errors=%u status=failed\n", linkpm_names[pm], errors);
+			continue;
+		}
+
+		if(pm == LINKPM_MAX_PERFORMANCE)
+			base = ata_latencymedian(&lat);
+		printf("policy=%s median_ms=%.3f max_ms=%.3f added_ms=%.3f errors=%u\n",
+				linkpm_names[pm], ata_latencymedian(&lat), ata_latencymax(&lat),
+				ata_latencymedian(&lat) - base, errors);
+		fflush(stdout);
+	}
+
+	if( ata_setlinkpm(ata, chan, dev, orig) ) {
+		perror("error restoring the link power policy");
+		rc = -1;
+	}
+
+	return rc;
+}
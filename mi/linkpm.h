@@ -0,0 +1,26 @@
+#ifndef _LINKPM_H_
+#define _LINKPM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+
+// the host link power management policies, from most to least power
+// used, as the policy file's link_pm values
+enum ata_linkpm {
+	LINKPM_MAX_PERFORMANCE,
+	LINKPM_MEDIUM_POWER,
+	LINKPM_MED_POWER_WITH_DIPM,
+	LINKPM_MIN_POWER,
+	LINKPM_N
+};
+
+int32_t	ata_linkpmparse( const char *name );
+const char *	ata_linkpmname( int32_t pm );
+int32_t	ata_linkpmset( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				const char *name );
+int32_t	ata_linkpmprobe( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t probes );
+
+#endif
@@ -0,0 +1,545 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// the policy store: a text file holding the settings to apply to drives,
+// matched by model or serial number, one entry per line:
+//
+//	# comment
+//	model "ST4000DM004-2CV104" apm=128 aac=0
+//	serial "WD-WCC4E1234567" standby=20
+//
+// The idle and standby timeouts are in minutes, or can be given with
+// a unit, as in standby=45s.
+// Named profiles hold settings which a crontab(5) style schedule
+// switches in on top of every drive's own, in the daemon:
+//
+//	profile night apm=128 standby=20 spindown=600
+//	profile day apm=254 standby=0
+//	schedule "0 20 * * *" night
+//	schedule "0 8 * * 1-5" day
+//
+// The tuner records the settings it finds here, and they can be applied
+// to a drive with --apply.  Comments and blank lines are preserved when
+// the file is rewritten.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "policy.h"
+#include "linkpm.h"
+#include "sched.h"
+#include "wear.h"
+
+static const char * const policy_keynames[POLICY_NKEYS] = {
+	"apm", "aac", "wcache", "lookahead", "idle", "standby",
+	"unload", "spindown", "cycles_per_day", "active_mw", "idle_mw",
+	"standby_mw", "puis", "spinup_order", "queue_depth", "link_pm"
+};
+
+// add a new, empty entry to the end of the store
+static struct ata_policy * policy_add( struct ata_policystore *store )
+{
+	struct ata_policy *policy;
+	int i;
+
+	if( store->nentries == store->maxentries ) {
+		size_t newmax = (store->maxentries)? store->maxentries * 2 : 16;
+		struct ata_policy *entries = (struct ata_policy*) realloc(store->entries,
+						newmax * sizeof(struct ata_policy));
+		if(entries == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return NULL;
+		}
+		store->entries = entries;
+		store->maxentries = newmax;
+	}
+
+	policy = &store->entries[store->nentries++];
+	memset(policy, 0, sizeof(struct ata_policy));
+	for(i = 0; i < POLICY_NKEYS; i++)
+		policy->val[i] = POLICY_UNSET;
+
+	return policy;
+}
+
+// parse one line of the policy file into policy.   Returns -1 if
+// the line isn't a valid entry.
+static int32_t policy_parse( char *line, struct ata_policy *policy )
+{
+	char *p = line, *end;
+	size_t len;
+	int i;
+
+	while(isspace((unsigned char) *p))
+		p++;
+
+	if( (*p == 0) || (*p == '#') ) {
+		policy->match = POLICY_NONE;
+		return 0;
+	}
+
+	if( strncmp(p, "schedule", 8) == 0 ) {
+		char *spec = p + 8, *name;
+
+		while(isspace((unsigned char) *spec))
+			spec++;
+		if( (*spec != '"') || ((end = strchr(++spec, '"')) == NULL) )
+			return -1;
+		*end = 0;
+		if( ata_cronparse(spec, &policy->cron) )
+			return -1;
+		*end = '"';
+
+		for(name = end + 1; isspace((unsigned char) *name); name++)
+			;
+		len = strcspn(name, " \t#");
+		if( (len == 0) || (len >= sizeof(policy->key)) )
+			return -1;
+		memcpy(policy->key, name, len);
+		policy->match = POLICY_SCHEDULE;
+		return 0;
+	}
+
+	if( strncmp(p, "model", 5) == 0 ) {
+		policy->match = POLICY_MODEL;
+		p += 5;
+	} else if( strncmp(p, "profile", 7) == 0 ) {
+		policy->match = POLICY_PROFILE;
+		p += 7;
+	} else if( strncmp(p, "serial", 6) == 0 ) {
+		policy->match = POLICY_SERIAL;
+		p += 6;
+	} else
+		return -1;
+
+	while(isspace((unsigned char) *p))
+		p++;
+
+	// the model or serial, in quotes if it contains spaces
+	if( *p == '"' ) {
+		end = strchr(++p, '"');
+		if(end == NULL)
+			return -1;
+	} else
+		for(end = p; *end && !isspace((unsigned char) *end); end++)
+			;
+
+	len = end - p;
+	if( (len == 0) || (len >= sizeof(policy->key)) )
+		return -1;
+	memcpy(policy->key, p, len);
+	p = (*end == '"')? end+1 : end;
+
+	// and then the settings, as key=value pairs
+	while(*p) {
+		long val;
+		char *eq;
+
+		while(isspace((unsigned char) *p))
+			p++;
+		if( (*p == 0) || (*p == '#') )
+			break;
+
+		eq = strchr(p, '=');
+		if(eq == NULL)
+			return -1;
+
+		for(i = 0; i < POLICY_NKEYS; i++)
+			if( (strlen(policy_keynames[i]) == (size_t) (eq - p)) &&
+				(strncmp(p, policy_keynames[i], eq - p) == 0) )
+				break;
+		if(i == POLICY_NKEYS)
+			return -1;
+
+		// the idle and standby timeouts are durations, in
+		// minutes if no unit is given, and are kept in seconds
+		if( (i == POLICY_IDLE) || (i == POLICY_STANDBY) ) {
+			char dur[32];
+			uint64_t ms;
+			size_t len = strcspn(eq+1, " \t#");
+
+			if( (len == 0) || (len >= sizeof(dur)) )
+				return -1;
+			memcpy(dur, eq+1, len);
+			dur[len] = 0;
+			if( ata_parseduration(dur, 60000, &ms) || (ms / 1000 > INT32_MAX) )
+				return -1;
+			val = (long) ((ms + 500) / 1000);
+			end = eq + 1 + len;
+		} else if(i == POLICY_LINK_PM) {
+			// the link policy is given by name
+			char name[32];
+			size_t len = strcspn(eq+1, " \t#");
+
+			if( (len == 0) || (len >= sizeof(name)) )
+				return -1;
+			memcpy(name, eq+1, len);
+			name[len] = 0;
+			if( (val = ata_linkpmparse(name)) < 0 )
+				return -1;
+			end = eq + 1 + len;
+		} else {
+			val = strtol(eq+1, &end, 10);
+			if( (end == eq+1) || (val < 0) )
+				return -1;
+		}
+
+		policy->val[i] = val;
+		p = end;
+	}
+
+	return 0;
+}
+
+// load the policy store from path.   A missing file is not an error,
+// it just gives an empty store.
+int32_t ata_policyload( struct ata_policystore *store, const char *path )
+{
+	FILE *fp;
+	char line[512];
+	int32_t rc = 0;
+	int lineno = 0;
+
+	memset(store, 0, sizeof(struct ata_policystore));
+	store->path = path;
+
+	fp = fopen(path, "r");
+	if(fp == NULL)
+		return (errno == ENOENT)? 0 : -1;
+
+	while( !rc && fgets(line, sizeof(line), fp) ) {
+		struct ata_policy *policy = policy_add(store);
+
+		lineno++;
+		line[strcspn(line, "\n")] = 0;
+
+		if(policy == NULL)
+			rc = -1;
+		else if( policy_parse(line, policy) ) {
+			printf("%s:%d: invalid policy entry\n", path, lineno);
+			rc = -1;
+		} else if( ((policy->match == POLICY_NONE) ||
+				(policy->match == POLICY_SCHEDULE)) &&
+				((policy->line = strdup(line)) == NULL) ) {
+			fprintf(stderr, "malloc failed\n");
+			rc = -1;
+		}
+	}
+
+	fclose(fp);
+	return rc;
+}
+
+// write the store back out to its file, replacing it atomically
+int32_t ata_policysave( struct ata_policystore *store )
+{
+	char tmppath[PATH_MAX];
+	FILE *fp;
+	size_t i;
+	int j;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", store->path);
+	fp = fopen(tmppath, "w");
+	if(fp == NULL) {
+		perror("error writing policy file");
+		return -1;
+	}
+
+	for(i = 0; i < store->nentries; i++) {
+		struct ata_policy *policy = &store->entries[i];
+
+		if( (policy->match == POLICY_NONE) || (policy->match == POLICY_SCHEDULE) ) {
+			fprintf(fp, "%s\n", policy->line);
+			continue;
+		}
+
+		fprintf(fp, "%s \"%s\"", (policy->match == POLICY_MODEL)? "model" :
+				(policy->match == POLICY_PROFILE)? "profile" : "serial",
+				policy->key);
+		for(j = 0; j < POLICY_NKEYS; j++) {
+			int32_t val = policy->val[j];
+
+			if(val == POLICY_UNSET)
+				continue;
+			if( ((j == POLICY_IDLE) || (j == POLICY_STANDBY)) && (val % 60) )
+				fprintf(fp, " %s=%ds", policy_keynames[j], val);
+			else if( (j == POLICY_IDLE) || (j == POLICY_STANDBY) )
+				fprintf(fp, " %s=%d", policy_keynames[j], val / 60);
+			else if(j == POLICY_LINK_PM)
+				fprintf(fp, " %s=%s", policy_keynames[j], ata_linkpmname(val));
+			else
+				fprintf(fp, " %s=%d", policy_keynames[j], val);
+		}
+		fprintf(fp, "\n");
+	}
+
+	if( (fclose(fp) != 0) || (rename(tmppath, store->path) != 0) ) {
+		perror("error writing policy file");
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ata_policyfree( struct ata_policystore *store )
+{
+	size_t i;
+
+	for(i = 0; i < store->nentries; i++)
+		free(store->entries[i].line);
+	free(store->entries);
+	store->entries = NULL;
+	store->nentries = store->maxentries = 0;
+}
+
+// find the policy for a drive: an entry for its serial number takes
+// priority over one for its model.
+struct ata_policy * ata_policyfind( struct ata_policystore *store,
+				const char *model, const char *serial )
+{
+	struct ata_policy *found = NULL;
+	size_t i;
+
+	for(i = 0; i < store->nentries; i++) {
+		struct ata_policy *policy = &store->entries[i];
+
+		if( (policy->match == POLICY_SERIAL) && (strcmp(policy->key, serial) == 0) )
+			return policy;
+		if( (found == NULL) && (policy->match == POLICY_MODEL) &&
+			(strcmp(policy->key, model) == 0) )
+			found = policy;
+	}
+
+	return found;
+}
+
+// return the entry matching exactly, creating it if there isn't one
+struct ata_policy * ata_policyset( struct ata_policystore *store,
+				enum ata_policymatch match, const char *key )
+{
+	struct ata_policy *policy;
+	size_t i;
+
+	for(i = 0; i < store->nentries; i++) {
+		policy = &store->entries[i];
+		if( (policy->match == match) && (strcmp(policy->key, key) == 0) )
+			return policy;
+	}
+
+	policy = policy_add(store);
+	if(policy != NULL) {
+		policy->match = match;
+		strncpy(policy->key, key, sizeof(policy->key) - 1);
+	}
+
+	return policy;
+}
+
+// does the store have any schedules, so the daemon has profiles to switch?
+bool ata_policyscheduled( struct ata_policystore *store )
+{
+	size_t i;
+
+	for(i = 0; i < store->nentries; i++)
+		if(store->entries[i].match == POLICY_SCHEDULE)
+			return true;
+
+	return false;
+}
+
+// return the profile in force at now: the one whose schedule fired
+// most recently.   Returns NULL if none has, or it names no profile.
+struct ata_policy * ata_policyprofile( struct ata_policystore *store, time_t now )
+{
+	struct ata_policy *latest = NULL;
+	time_t latesttime = -1;
+	size_t i;
+
+	for(i = 0; i < store->nentries; i++) {
+		struct ata_policy *policy = &store->entries[i];
+		time_t t;
+
+		if(policy->match != POLICY_SCHEDULE)
+			continue;
+		t = ata_cronprev(&policy->cron, now);
+		if( (t != (time_t) -1) && (t >= latesttime) ) {
+			latest = policy;
+			latesttime = t;
+		}
+	}
+
+	if(latest == NULL)
+		return NULL;
+
+	for(i = 0; i < store->nentries; i++)
+		if( (store->entries[i].match == POLICY_PROFILE) &&
+				(strcmp(store->entries[i].key, latest->key) == 0) )
+			return &store->entries[i];
+
+	printf("no profile named %s in %s\n", latest->key, store->path);
+	return NULL;
+}
+
+// put the settings profile holds on top of those in policy
+void ata_policyoverlay( struct ata_policy *policy, struct ata_policy *profile )
+{
+	int i;
+
+	if(profile == NULL)
+		return;
+	for(i = 0; i < POLICY_NKEYS; i++)
+		if(profile->val[i] != POLICY_UNSET)
+			policy->val[i] = profile->val[i];
+}
+
+// apply a single setting to the drive.   Those which aren't drive
+// settings, such as the daemon's thresholds, are ignored.
+int32_t ata_policyapplykey( struct ATA *ata, uint32_t chan, uint32_t dev,
+				enum ata_policykey key, int32_t val )
+{
+	uint8_t timer_val;
+
+	switch(key) {
+		case POLICY_APM:
+			return ata_setapm(ata, chan, dev, val);
+		case POLICY_AAC:
+			return ata_setacoustic(ata, chan, dev, val);
+		case POLICY_WCACHE:
+			return ata_setwritecache(ata, chan, dev, val);
+		case POLICY_LOOKAHEAD:
+			return ata_setlookahead(ata, chan, dev, val);
+		case POLICY_PUIS:
+			return ata_setpuis(ata, chan, dev, val);
+		case POLICY_QUEUE_DEPTH:
+			if( ata_setqueuedepth(ata, chan, dev, val) ) {
+				perror("Set queue depth failed");
+				return -1;
+			}
+			printf("Queue depth set to %d\n", val);
+			return 0;
+		case POLICY_LINK_PM:
+			return ata_linkpmset(ata, chan, dev, ata_linkpmname(val));
+		case POLICY_IDLE:
+			ata_timerencode(val, &timer_val);
+			return ata_setidle(ata, chan, dev, timer_val);
+		// the timer only: STANDBY would spin a busy drive down as
+		// soon as its policy was applied
+		case POLICY_STANDBY:
+			ata_timerencode(val, &timer_val);
+			return ata_setstandbytimer(ata, chan, dev, timer_val);
+		default:
+			return 0;
+	}
+}
+
+// apply each setting the policy holds to the drive
+int32_t ata_policyapply( struct ATA *ata, uint32_t chan, uint32_t dev,
+				struct ata_policy *policy )
+{
+	int32_t val[POLICY_NKEYS];
+	int32_t rc;
+	int i;
+
+	// the timeouts are stretched if the drive is over its cycle budget
+	rc = ata_wearadjust(ata, chan, dev, policy, val);
+	if(rc) {
+		printf("%s: can't check its cycle budget\n", ata_devlabel(ata, chan, dev));
+		memcpy(val, policy->val, sizeof(val));
+		rc = 0;
+	}
+
+	for(i = 0; !rc && (i < POLICY_NKEYS); i++)
+		if(val[i] != POLICY_UNSET)
+			rc = ata_policyapplykey(ata, chan, dev, i, val[i]);
+
+	return rc;
+}
+
+// look up the policy for the drive at chan, dev and apply it
+int32_t ata_policyapplydev( struct ATA *ata, uint32_t chan, uint32_t dev,
+				struct ata_policystore *store )
+{
+	struct ata_ident ident;
+	struct ata_policy *policy;
+	char model[41], serial[21];
+	int32_t rc;
+
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+
+	ata_identstrings(&ident, model, serial);
+	policy = ata_policyfind(store, model, serial);
+	if(policy == NULL) {
+		printf("No policy for %s (serial %s) in %s\n", model, serial, store->path);
+		return -1;
+	}
+
+	return ata_policyapply(ata, chan, dev, policy);
+}
+
+// apply its policy to one drive in the fleet: drives with no
+// policy are simply left alone
+static int32_t policy_applyjob( struct ATA *ata, struct ata_devent *ent,
+				void *arg )
+{
+	struct ata_policystore *store = (struct ata_policystore*) arg;
+	struct ata_ident ident;
+	struct ata_policy *policy;
+	char model[41], serial[21];
+
+	if( ata_ident(ata, ent->chan, ent->dev, &ident) )
+		return 0;
+
+	ata_identstrings(&ident, model, serial);
+	policy = ata_policyfind(store, model, serial);
+	if(policy == NULL)
+		return 0;
+
+	return ata_policyapply(ata, ent->chan, ent->dev, policy);
+}
+
+// apply the policy to every drive in the device table, through the
+// scheduler so that a controller only sees a few commands at a time
+int32_t ata_policyapplyall( struct ata_devtable *table,
+				struct ata_policystore *store, uint32_t jobs, uint32_t ctrljobs )
+{
+	return ata_schedrun(table, policy_applyjob, store, jobs, ctrljobs);
+}
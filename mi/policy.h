@@ -0,0 +1,79 @@
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "atagen.h"
+#include "devtable.h"
+#include "cron.h"
+
+// what a policy entry is matched against
+enum ata_policymatch {
+	POLICY_NONE,		// comment or blank line, kept verbatim
+	POLICY_MODEL,
+	POLICY_SERIAL,
+	POLICY_PROFILE,		// named settings, switched in by a schedule
+	POLICY_SCHEDULE		// when to switch to a profile, kept verbatim
+};
+
+// the settings a policy entry can hold
+enum ata_policykey {
+	POLICY_APM,
+	POLICY_AAC,
+	POLICY_WCACHE,
+	POLICY_LOOKAHEAD,
+	POLICY_IDLE,		// drive timers, in seconds
+	POLICY_STANDBY,
+	POLICY_UNLOAD,		// daemon: unload heads after this many seconds idle
+	POLICY_SPINDOWN,	// daemon: spin down after this many seconds idle
+	POLICY_CYCLES,		// start/stop or load cycles a day to stay within
+	POLICY_ACTIVE_MW,	// wattage profile for the energy estimate,
+	POLICY_IDLE_MW,		// in the order of enum ata_powerstate
+	POLICY_STANDBY_MW,
+	POLICY_PUIS,		// power-up in standby
+	POLICY_SPINUP_ORDER,	// wave the drive is spun up in, lowest first
+	POLICY_QUEUE_DEPTH,	// NCQ depth, 1 for NCQ off
+	POLICY_LINK_PM,		// host link power policy, an enum ata_linkpm
+	POLICY_NKEYS
+};
+
+static const int32_t POLICY_UNSET = -1;
+
+struct ata_policy {
+	enum ata_policymatch	match;
+	char					key[41];	// model, serial number or profile name
+	int32_t					val[POLICY_NKEYS];
+	char					*line;		// original text of POLICY_NONE
+										// and POLICY_SCHEDULE lines
+	struct ata_cron			cron;		// for POLICY_SCHEDULE
+};
+
+struct ata_policystore {
+	const char			*path;
+	struct ata_policy	*entries;
+	size_t				nentries;
+	size_t				maxentries;
+};
+
+int32_t	ata_policyload( struct ata_policystore *store, const char *path );
+int32_t	ata_policysave( struct ata_policystore *store );
+void	ata_policyfree( struct ata_policystore *store );
+struct ata_policy * ata_policyfind( struct ata_policystore *store,
+				const char *model, const char *serial );
+struct ata_policy * ata_policyset( struct ata_policystore *store,
+				enum ata_policymatch match, const char *key );
+struct ata_policy * ata_policyprofile( struct ata_policystore *store,
+				time_t now );
+bool	ata_policyscheduled( struct ata_policystore *store );
+void	ata_policyoverlay( struct ata_policy *policy, struct ata_policy *profile );
+int32_t	ata_policyapplykey( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				enum ata_policykey key, int32_t val );
+int32_t	ata_policyapply( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_policy *policy );
+int32_t	ata_policyapplydev( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_policystore *store );
+int32_t	ata_policyapplyall( struct ata_devtable *table,
+				struct ata_policystore *store, uint32_t jobs, uint32_t ctrljobs );
+
+#endif
@@ -0,0 +1,265 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// the fleet scheduler: runs a job against every drive in the device
+// table, with no more than jobs of them in flight at once and no more
+// than ctrljobs on any one controller, so that a big operation doesn't
+// swamp an HBA or port multiplier and stall the I/O of its other drives.
+//
+// Each controller has its own queue of drives.   Every worker starts on
+// a controller of its own, and once that one is drained or at its limit
+// steals from the next controller which has work it may start.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "devtable.h"
+#include "sched.h"
+
+struct sched_ctrl {
+	const char	*name;
+	size_t		first;		// this controller's drives are
+	size_t		last;		// order[first] to order[last - 1]
+	size_t		next;		// the next one to start
+	uint32_t	inflight;
+};
+
+struct sched {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;		// signalled whenever a job finishes
+	struct ata_devtable	*table;
+	ata_schedfn			fn;
+	void				*arg;
+	struct sched_ctrl	*ctrls;
+	size_t				nctrls;
+	size_t				*order;
+	size_t				pending;	// jobs not yet started
+	uint32_t			ctrljobs;
+	int32_t				rc;
+};
+
+struct sched_worker {
+	struct sched	*s;
+	size_t			home;
+	pthread_t		thread;
+};
+
+// find a controller with a drive we may start, trying home first
+static struct sched_ctrl * sched_take( struct sched *s, size_t home )
+{
+	size_t i;
+
+	for(i = 0; i < s->nctrls; i++) {
+		struct sched_ctrl *ctrl = &s->ctrls[(home + i) % s->nctrls];
+
+		if( (ctrl->next < ctrl->last) && (ctrl->inflight < s->ctrljobs) )
+			return ctrl;
+	}
+
+	return NULL;
+}
+
+static void * sched_worker( void *p )
+{
+	struct sched_worker *w = (struct sched_worker*) p;
+	struct sched *s = w->s;
+	struct ATA *ata = (struct ATA*) malloc(sizeof(struct ATA));
+
+	if(ata == 0) {
+		fprintf(stderr, "malloc failed\n");
+		pthread_mutex_lock(&s->lock);
+		s->rc = -1;
+		pthread_mutex_unlock(&s->lock);
+		return NULL;
+	}
+	memset(ata, 0, sizeof(struct ATA));
+	if( ata_open(ata) ) {
+		free(ata);
+		pthread_mutex_lock(&s->lock);
+		s->rc = -1;
+		pthread_mutex_unlock(&s->lock);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	while(s->pending > 0) {
+		struct sched_ctrl *ctrl = sched_take(s, w->home);
+		struct ata_devent *ent;
+		int32_t rc;
+
+		// everything left is on controllers already at their
+		// limit, so wait for one of their jobs to finish
+		if(ctrl == NULL) {
+			pthread_cond_wait(&s->cond, &s->lock);
+			continue;
+		}
+
+		ent = &s->table->ents[s->order[ctrl->next++]];
+		ctrl->inflight++;
+		s->pending--;
+		pthread_mutex_unlock(&s->lock);
+
+		memset(&ata->atacmd, 0, sizeof(ata->atacmd));
+		snprintf(ata->devpath, sizeof(ata->devpath), "%s", ent->devpath);
+		rc = s->fn(ata, ent, s->arg);
+
+		pthread_mutex_lock(&s->lock);
+		ctrl->inflight--;
+		if(rc)
+			s->rc = rc;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	ata_close(ata);
+	free(ata);
+
+	return NULL;
+}
+
+// put the drives into one queue per controller
+static int32_t sched_group( struct sched *s )
+{
+	struct ata_devtable *table = s->table;
+	size_t *ctrlof;
+	size_t i, j;
+
+	s->ctrls = (struct sched_ctrl*) calloc(table->nents, sizeof(struct sched_ctrl));
+	s->order = (size_t*) calloc(table->nents, sizeof(size_t));
+	ctrlof = (size_t*) calloc(table->nents, sizeof(size_t));
+	if( (s->ctrls == 0) || (s->order == 0) || (ctrlof == 0) ) {
+		fprintf(stderr, "malloc failed\n");
+		free(ctrlof);
+		return -1;
+	}
+
+	// there are only ever a handful of controllers, so a
+	// linear search of the ones seen so far is plenty
+	for(i = 0; i < table->nents; i++) {
+		const char *name = table->ents[i].controller;
+
+		for(j = 0; j < s->nctrls; j++)
+			if( strcmp(s->ctrls[j].name, name) == 0 )
+				break;
+		if(j == s->nctrls)
+			s->ctrls[s->nctrls++].name = name;
+		s->ctrls[j].last++;
+		ctrlof[i] = j;
+	}
+
+	for(j = 0; j < s->nctrls; j++) {
+		size_t n = s->ctrls[j].last;
+
+		s->ctrls[j].first = s->ctrls[j].next = (j == 0)? 0 : s->ctrls[j-1].last;
+		s->ctrls[j].last = s->ctrls[j].first + n;
+	}
+
+	for(i = 0; i < table->nents; i++) {
+		struct sched_ctrl *ctrl = &s->ctrls[ctrlof[i]];
+
+		s->order[ctrl->first + ctrl->inflight++] = i;
+	}
+	for(j = 0; j < s->nctrls; j++)
+		s->ctrls[j].inflight = 0;
+
+	free(ctrlof);
+	return 0;
+}
+
+// run fn against every drive in table.   Returns the last error a job
+// returned, though every job is run regardless.
+int32_t ata_schedrun( struct ata_devtable *table, ata_schedfn fn, void *arg,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	struct sched s;
+	struct sched_worker *workers;
+	uint32_t nworkers, i;
+	int32_t rc;
+
+	if(table->nents == 0)
+		return 0;
+
+	memset(&s, 0, sizeof(s));
+	s.table = table;
+	s.fn = fn;
+	s.arg = arg;
+	s.pending = table->nents;
+	s.ctrljobs = (ctrljobs)? ctrljobs : 1;
+
+	rc = sched_group(&s);
+	if(rc) {
+		free(s.ctrls);
+		free(s.order);
+		return rc;
+	}
+
+	// there's no point having more workers than drives
+	nworkers = (jobs)? jobs : 1;
+	if(nworkers > table->nents)
+		nworkers = table->nents;
+
+	workers = (struct sched_worker*) calloc(nworkers, sizeof(struct sched_worker));
+	if(workers == 0) {
+		fprintf(stderr, "malloc failed\n");
+		free(s.ctrls);
+		free(s.order);
+		return -1;
+	}
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+
+	for(i = 0; i < nworkers; i++) {
+		workers[i].s = &s;
+		workers[i].home = i % s.nctrls;
+		if( pthread_create(&workers[i].thread, NULL, sched_worker, &workers[i]) ) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	// the workers already running finish the queue between them
+	if(i == 0)
+		s.rc = -1;
+	nworkers = i;
+	for(i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+	free(workers);
+	free(s.ctrls);
+	free(s.order);
+
+	return s.rc;
+}
@@ -0,0 +1,21 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+
+#include "atagen.h"
+#include "devtable.h"
+
+// default limits on commands in flight, overall and on any one controller
+#define ATA_SCHED_JOBS		16
+#define ATA_SCHED_CTRLJOBS	2
+
+// a job, run once for each drive.   ata is private to the worker
+// running it, with devpath set to the drive's device node.
+typedef int32_t (*ata_schedfn)( struct ATA *ata, struct ata_devent *ent,
+				void *arg );
+
+int32_t	ata_schedrun( struct ata_devtable *table, ata_schedfn fn, void *arg,
+				uint32_t jobs, uint32_t ctrljobs );
+
+#endif
@@ -0,0 +1,406 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+// SCSI drives, such as SAS drives, don't understand the ATA commands, so
+// for those the power options are mapped onto their SCSI equivalents:
+// START STOP UNIT with a power condition to go idle or standby now, the
+// standby_z timer of the Power Condition mode page for the timeouts, and
+// REQUEST SENSE for the power mode.   IDENTIFY is made up from INQUIRY,
+// so that SCSI drives are listed, and matched in the policy file by
+// model and serial number, like any other.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "scsi.h"
+
+static const uint8_t SCSI_REQUEST_SENSE		= 0x03;
+static const uint8_t SCSI_INQUIRY			= 0x12;
+static const uint8_t SCSI_START_STOP_UNIT	= 0x1B;
+static const uint8_t SCSI_SYNCHRONIZE_CACHE	= 0x35;
+static const uint8_t SCSI_MODE_SELECT_10	= 0x55;
+static const uint8_t SCSI_MODE_SENSE_10		= 0x5A;
+static const uint8_t SCSI_READ_CAPACITY_16	= 0x9E;
+
+static const uint8_t SCSI_VPD_SERIAL		= 0x80;
+static const uint8_t SCSI_PAGE_POWER		= 0x1A;
+static const uint8_t SCSI_ASC_LOW_POWER		= 0x5E;
+
+// the Power Condition mode page holds its timers in 100ms units
+static const uint32_t SCSI_TIMER_UNITS		= 10;
+
+static uint32_t scsi_get32( const uint8_t *p )
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | p[3];
+}
+
+static void scsi_put32( uint8_t *p, uint32_t val )
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+// standard INQUIRY data, or a page of vital product data if vpd is set
+static int32_t scsi_inquiry( struct ATA *ata, uint32_t chan, uint32_t dev,
+				bool vpd, uint8_t page, uint8_t *buf, uint8_t len )
+{
+	uint8_t cdb[6];
+
+	memset(cdb, 0, sizeof(cdb));
+	memset(buf, 0, len);
+	cdb[0] = SCSI_INQUIRY;
+	cdb[1] = vpd;
+	cdb[2] = page;
+	cdb[4] = len;
+	return ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), buf, len, SCSI_DIR_IN);
+}
+
+// read the Power Condition mode page into buf, with its 8 byte MODE
+// SENSE (10) header, current values unless changeable is set.   Returns
+// a pointer to the page itself.
+static uint8_t * scsi_powerpage( struct ATA *ata, uint32_t chan, uint32_t dev,
+				bool changeable, uint8_t *buf, uint8_t len )
+{
+	uint8_t cdb[10];
+	uint8_t *page, *end;
+
+	memset(cdb, 0, sizeof(cdb));
+	memset(buf, 0, len);
+	cdb[0] = SCSI_MODE_SENSE_10;
+	cdb[1] = 0x08;						// no block descriptors
+	cdb[2] = (changeable << 6) | SCSI_PAGE_POWER;
+	cdb[8] = len;
+	if( ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), buf, len, SCSI_DIR_IN) )
+		return NULL;
+
+	// the mode data returned, which the whole page must lie within,
+	// and the drive may send block descriptors anyway
+	end = buf + 2 + ((buf[0] << 8) | buf[1]);
+	if(end > buf + len)
+		end = buf + len;
+	page = buf + 8 + ((buf[6] << 8) | buf[7]);
+	if( (page + 12 > end) || ((page[0] & 0x3F) != SCSI_PAGE_POWER) ||
+			(page[1] < 10) || (page + page[1] + 2 > end) ) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+	return page;
+}
+
+// a SCSI drive, rather than an ATA one, which would be a direct access
+// device from vendor "ATA" behind a SCSI/ATA translation layer.   Every
+// command asks, so the answer is kept for each device node, and only
+// forgotten when the drive there is removed.
+bool ata_isscsi( struct ATA *ata, uint32_t chan, uint32_t dev )
+{
+	struct ata_transport *t;
+	uint8_t inq[36];
+	char name[64];
+	bool scsi;
+	size_t i;
+
+	ata_getdevname(ata, chan, dev, name, sizeof(name));
+	for(i = 0; i < ata->ntransports; i++)
+		if( strcmp(ata->transports[i].name, name) == 0 )
+			return ata->transports[i].scsi;
+
+	// a failed INQUIRY isn't kept, the drive may answer next time
+	if( scsi_inquiry(ata, chan, dev, false, 0, inq, sizeof(inq)) )
+		return false;
+	scsi = ((inq[0] & 0x1F) == 0) && (memcmp(inq + 8, "ATA     ", 8) != 0);
+
+	if( ata->ntransports == ata->maxtransports ) {
+		size_t newmax = (ata->maxtransports)? ata->maxtransports * 2 : 8;
+		t = (struct ata_transport*) realloc(ata->transports,
+				newmax * sizeof(struct ata_transport));
+		if(t == 0)
+			return scsi;
+		ata->transports = t;
+		ata->maxtransports = newmax;
+	}
+	t = &ata->transports[ata->ntransports++];
+	snprintf(t->name, sizeof(t->name), "%s", name);
+	t->scsi = scsi;
+
+	return scsi;
+}
+
+// forget what's at a device node, when the drive there has gone and
+// another, of either kind, may take its place
+void ata_scsiforget( struct ATA *ata, const char *name )
+{
+	size_t i;
+
+	for(i = 0; i < ata->ntransports; i++)
+		if( strcmp(ata->transports[i].name, name) == 0 ) {
+			ata->transports[i] = ata->transports[--ata->ntransports];
+			break;
+		}
+}
+
+void ata_scsifree( struct ATA *ata )
+{
+	free(ata->transports);
+	ata->transports = NULL;
+	ata->ntransports = ata->maxtransports = 0;
+}
+
+// send START STOP UNIT with a power condition
+int32_t ata_scsipower( struct ATA *ata, uint32_t chan, uint32_t dev,
+				enum ata_scsipower condition, uint8_t modifier )
+{
+	uint8_t cdb[6];
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = SCSI_START_STOP_UNIT;
+	cdb[3] = modifier;
+	cdb[4] = condition << 4;
+	return ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), NULL, 0, SCSI_DIR_NONE);
+}
+
+// spin the drive up, as START STOP UNIT with START set and no power
+// condition does, for drives held stopped at power on
+int32_t ata_scsistart( struct ATA *ata, uint32_t chan, uint32_t dev )
+{
+	uint8_t cdb[6];
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = SCSI_START_STOP_UNIT;
+	cdb[4] = 0x01;
+	return ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), NULL, 0, SCSI_DIR_NONE);
+}
+
+// read the standby_z timer from the Power Condition mode page, in
+// seconds, or 0 if it's off
+int32_t ata_scsigettimer( struct ATA *ata, uint32_t chan, uint32_t dev,
+				uint32_t *secs )
+{
+	uint8_t buf[64];
+	uint8_t *page = scsi_powerpage(ata, chan, dev, false, buf, sizeof(buf));
+
+	if(page == NULL)
+		return -1;
+	*secs = (page[3] & 0x01)? scsi_get32(page + 8) / SCSI_TIMER_UNITS : 0;
+	return 0;
+}
+
+// set the standby_z timer in the Power Condition mode page to secs,
+// or turn it off for 0
+int32_t ata_scsisettimer( struct ATA *ata, uint32_t chan, uint32_t dev,
+				uint32_t secs )
+{
+	uint8_t buf[64], param[64], cdb[10];
+	uint8_t *page;
+	uint32_t len;
+
+	page = scsi_powerpage(ata, chan, dev, false, buf, sizeof(buf));
+	if(page == NULL)
+		return -1;
+
+	// MODE SELECT takes the page back behind a zeroed header
+	len = page[1] + 2;
+	if(len > sizeof(param) - 8)
+		len = sizeof(param) - 8;
+	memset(param, 0, sizeof(param));
+	memcpy(param + 8, page, len);
+	page = param + 8;
+	page[0] &= 0x3F;
+	if(secs) {
+		page[3] |= 0x01;
+		scsi_put32(page + 8, secs * SCSI_TIMER_UNITS);
+	} else
+		page[3] &= ~0x01;
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = SCSI_MODE_SELECT_10;
+	cdb[1] = 0x10;						// page format
+	cdb[8] = len + 8;
+	return ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), param, len + 8,
+			SCSI_DIR_OUT);
+}
+
+// set the standby_z timer to the duration of an ATA timer value
+int32_t ata_scsitimer( struct ATA *ata, uint32_t chan, uint32_t dev,
+				uint8_t timer_val )
+{
+	uint32_t secs;
+
+	if( ata_timerdecode(timer_val, &secs) ) {
+		errno = EINVAL;		// SCSI has no vendor defined timeout
+		return -1;
+	}
+	return ata_scsisettimer(ata, chan, dev, secs);
+}
+
+// find out the drive's power condition from the sense data REQUEST SENSE
+// returns, as a CHECK POWER MODE result
+int32_t ata_scsipowermode( struct ATA *ata, uint32_t chan, uint32_t dev,
+				uint8_t *mode )
+{
+	uint8_t cdb[6], sense[32];
+	uint8_t asc, ascq;
+
+	memset(cdb, 0, sizeof(cdb));
+	memset(sense, 0, sizeof(sense));
+	cdb[0] = SCSI_REQUEST_SENSE;
+	cdb[4] = sizeof(sense);
+	if( ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), sense, sizeof(sense),
+			SCSI_DIR_IN) )
+		return -1;
+
+	// fixed or descriptor format sense data
+	if( (sense[0] & 0x7F) >= 0x72 ) {
+		asc = sense[2];
+		ascq = sense[3];
+	} else {
+		asc = sense[12];
+		ascq = sense[13];
+	}
+
+	*mode = ATA_POWERMODE_ACTIVE;
+	if(asc == SCSI_ASC_LOW_POWER) {
+		switch(ascq) {
+			case 0x02:		// standby by timer, or command
+			case 0x04:
+			case 0x09:		// standby_y by timer, or command
+			case 0x0A:
+				*mode = ATA_POWERMODE_STANDBY;
+				break;
+			default:		// one of the idle conditions
+				*mode = ATA_POWERMODE_IDLE;
+				break;
+		}
+	}
+	return 0;
+}
+
+// write the drive's cache out with SYNCHRONIZE CACHE
+int32_t ata_scsiflush( struct ATA *ata, uint32_t chan, uint32_t dev )
+{
+	uint8_t cdb[10];
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = SCSI_SYNCHRONIZE_CACHE;
+	return ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), NULL, 0, SCSI_DIR_NONE);
+}
+
+// copy a string into IDENTIFY data, padded with spaces, with the bytes
+// of each word swapped as the drive would send them
+static void scsi_identstring( uint8_t *dst, const char *src, size_t len )
+{
+	size_t i, n = strlen(src);
+
+	for(i = 0; i < len; i++)
+		dst[i ^ 1] = (i < n)? src[i] : ' ';
+}
+
+// copy n bytes of INQUIRY data, without the padding spaces, to dst
+static void scsi_trim( char *dst, const uint8_t *src, size_t n )
+{
+	while( (n > 0) && ((src[n-1] == ' ') || (src[n-1] == 0)) )
+		n--;
+	while( (n > 0) && (*src == ' ') ) {
+		src++;
+		n--;
+	}
+	memcpy(dst, src, n);
+	dst[n] = 0;
+}
+
+// make up IDENTIFY data for a SCSI drive: "VENDOR PRODUCT" as its model,
+// the unit serial number, the revision as its firmware, its capacity
+// from READ CAPACITY (16), and the heads unloading if the idle_b
+// condition can be turned on.
+int32_t ata_scsiident( struct ATA *ata, uint32_t chan, uint32_t dev,
+				struct ata_ident *ident )
+{
+	uint16_t *w = (uint16_t*) ident;
+	uint8_t inq[36], vpd[64], cap[32], modebuf[64], cdb[16];
+	char vendor[9], product[17], model[41], serial[21], rev[5];
+	uint8_t *page;
+	int32_t rc;
+
+	memset(ident, 0, sizeof(struct ata_ident));
+	rc = scsi_inquiry(ata, chan, dev, false, 0, inq, sizeof(inq));
+	if(rc)
+		return rc;
+
+	scsi_trim(vendor, inq + 8, 8);
+	scsi_trim(product, inq + 16, 16);
+	scsi_trim(rev, inq + 32, 4);
+	snprintf(model, sizeof(model), "%s %s", vendor, product);
+	serial[0] = 0;
+	if( !scsi_inquiry(ata, chan, dev, true, SCSI_VPD_SERIAL, vpd, sizeof(vpd)) &&
+			(vpd[1] == SCSI_VPD_SERIAL) )
+		scsi_trim(serial, vpd + 4, (vpd[3] > 20)? 20 : vpd[3]);
+
+	scsi_identstring(ident->model, model, sizeof(ident->model));
+	scsi_identstring(ident->serial, serial, sizeof(ident->serial));
+	scsi_identstring(ident->firmware, rev, sizeof(ident->firmware));
+
+	memset(cdb, 0, sizeof(cdb));
+	memset(cap, 0, sizeof(cap));
+	cdb[0] = SCSI_READ_CAPACITY_16;
+	cdb[1] = 0x10;						// service action
+	cdb[13] = sizeof(cap);
+	if( !ata_scsicmd(ata, chan, dev, cdb, sizeof(cdb), cap, sizeof(cap),
+			SCSI_DIR_IN) ) {
+		uint64_t sectors = (((uint64_t) scsi_get32(cap) << 32) |
+				scsi_get32(cap + 4)) + 1;
+		uint32_t blocklen = scsi_get32(cap + 8);
+
+		w[83] |= 0x4400;				// 48-bit
+		w[86] |= 0x0400;
+		w[100] = sectors;
+		w[101] = sectors >> 16;
+		w[102] = sectors >> 32;
+		w[103] = sectors >> 48;
+		if(blocklen != 512) {
+			w[106] = 0x5000;
+			w[117] = blocklen / 2;
+			w[118] = (blocklen / 2) >> 16;
+		}
+	}
+
+	page = scsi_powerpage(ata, chan, dev, true, modebuf, sizeof(modebuf));
+	w[84] = 0x4000;
+	if( (page != NULL) && (page[3] & 0x04) )
+		w[84] |= 0x2000;
+
+	return 0;
+}
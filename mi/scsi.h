@@ -0,0 +1,47 @@
+#ifndef _SCSI_H_
+#define _SCSI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atagen.h"
+
+// START STOP UNIT power conditions.   The FORCE ones put the drive into
+// the condition now but leave its timers running, as the ATA IDLE and
+// STANDBY commands do; the others would stop the timers until a
+// LU_CONTROL.
+enum ata_scsipower {
+	SCSI_POWER_FORCE_IDLE_0		= 0xA,
+	SCSI_POWER_FORCE_STANDBY_0	= 0xB
+};
+
+// power condition modifiers for SCSI_POWER_FORCE_IDLE_0
+static const uint8_t SCSI_IDLE_A	= 0;	// electronics partly powered down
+static const uint8_t SCSI_IDLE_B	= 1;	// heads unloaded
+
+// whether the drive at a device node is a SCSI one, kept so that the
+// INQUIRY needn't be sent before every command
+struct ata_transport {
+	char	name[64];
+	bool	scsi;
+};
+
+bool	ata_isscsi( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+void	ata_scsiforget( struct ATA *ata, const char *name );
+void	ata_scsifree( struct ATA *ata );
+int32_t	ata_scsipower( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				enum ata_scsipower condition, uint8_t modifier );
+int32_t	ata_scsistart( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+int32_t	ata_scsitimer( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t timer_val );
+int32_t	ata_scsigettimer( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t *secs );
+int32_t	ata_scsisettimer( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs );
+int32_t	ata_scsipowermode( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint8_t *mode );
+int32_t	ata_scsiflush( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+int32_t	ata_scsiident( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_ident *ident );
+
+#endif
@@ -0,0 +1,520 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+// fleet snapshots: every drive's settings which can be read back, saved
+// to a file keyed by WWN, so they can be put back after a firmware
+// update or controller swap.   One line per drive:
+//
+//	wwn:0x5000c500a1b2c3d4 apm=128 aac=0 wcache=1 lookahead=1 epc=1 idle_a=2s
+//
+// Restoring compares each drive's live settings with the snapshot and
+// only sends the commands for those which differ.   The plain ATA idle
+// and standby timers can't be read from a drive, so they aren't kept;
+// the EPC timers, and a SCSI drive's standby_z timer, are.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "identify.h"
+#include "epc.h"
+#include "scsi.h"
+#include "sched.h"
+#include "snapshot.h"
+
+// the settings a snapshot records.   The EPC timers are in the same
+// order as the conditions in struct ata_epcinfo.
+enum snap_key {
+	SNAP_APM,			// level, or 0 if disabled
+	SNAP_AAC,			// level 1-127, or 0 if disabled
+	SNAP_WCACHE,
+	SNAP_LOOKAHEAD,
+	SNAP_PUIS,			// power-up in standby
+	SNAP_EPC,			// EPC enabled
+	SNAP_IDLE_A,		// EPC timers in ms, or 0 if disabled
+	SNAP_IDLE_B,
+	SNAP_IDLE_C,
+	SNAP_STANDBY_Y,
+	SNAP_STANDBY_Z,
+	SNAP_STANDBY,		// a SCSI drive's standby_z timer in ms
+	SNAP_NKEYS
+};
+
+static const char * const snap_keynames[SNAP_NKEYS] = {
+	"apm", "aac", "wcache", "lookahead", "puis", "epc", "idle_a", "idle_b",
+	"idle_c", "standby_y", "standby_z", "standby"
+};
+
+static const int32_t SNAP_UNSET = -1;
+
+// one drive's settings, keyed by "wwn:..." or, for drives without a
+// WWN, "serial:...", as they would be given on the command line
+struct snap_entry {
+	char		key[48];
+	char		serial[21];		// of a live drive, to match on if its
+								// snapshot entry is keyed by serial
+	int32_t		val[SNAP_NKEYS];
+};
+
+// what the workers share: the live settings of each drive in the device
+// table, and for a restore, the snapshot and which entry each drive
+// matched and how many of its settings were changed
+struct snap_run {
+	struct ata_devtable	*table;
+	struct snap_entry	*live;
+	struct snap_entry	*entries;
+	size_t				nentries;
+	int32_t				*match;
+	uint32_t			*changed;
+};
+
+static bool snap_istimer( int key )
+{
+	return (key >= SNAP_IDLE_A) && (key <= SNAP_STANDBY);
+}
+
+static int snap_cmp( const void *a, const void *b )
+{
+	return strcmp(((const struct snap_entry*) a)->key,
+			((const struct snap_entry*) b)->key);
+}
+
+// format a timer for the file, or for ata_setepc()
+static void snap_timerstring( int32_t ms, char *buf, size_t len )
+{
+	if(ms == 0)
+		snprintf(buf, len, "off");
+	else if(ms % 1000)
+		snprintf(buf, len, "%dms", ms);
+	else
+		snprintf(buf, len, "%ds", ms / 1000);
+}
+
+// read the drive's current settings.   Its key is the WWN it reports,
+// or failing that the one the device table has from its name, or its
+// serial number.
+static int32_t snap_read( struct ATA *ata, struct ata_devent *ent,
+				struct snap_entry *snap )
+{
+	struct ata_ident ident;
+	struct ata_identinfo info;
+	struct ata_epcinfo epc[EPC_NCONDS];
+	char wwn[24];
+	uint32_t secs;
+	int i;
+
+	for(i = 0; i < SNAP_NKEYS; i++)
+		snap->val[i] = SNAP_UNSET;
+	snap->key[0] = 0;
+
+	if( ata_ident(ata, ent->chan, ent->dev, &ident) )
+		return -1;
+	ata_identdecode(&ident, &info);
+	ata_identwwn(&ident, wwn);
+	strcpy(snap->serial, info.serial);
+
+	if(wwn[0] || ent->wwn[0])
+		snprintf(snap->key, sizeof(snap->key), "wwn:%s", (wwn[0])? wwn : ent->wwn);
+	else if(info.serial[0])
+		snprintf(snap->key, sizeof(snap->key), "serial:%s", info.serial);
+	else
+		return -1;
+
+	if(info.supported & IDENT_APM)
+		snap->val[SNAP_APM] = (info.enabled & IDENT_APM)? info.apm : 0;
+	// levels below 128 are reserved, so a drive reporting one is left
+	// unrecorded rather than given a level which can't be set
+	if( (info.supported & IDENT_AAC) && !(info.enabled & IDENT_AAC) )
+		snap->val[SNAP_AAC] = 0;
+	else if( (info.supported & IDENT_AAC) && (info.aac >= 128) )
+		snap->val[SNAP_AAC] = info.aac - 127;
+	if(info.supported & IDENT_WCACHE)
+		snap->val[SNAP_WCACHE] = (info.enabled & IDENT_WCACHE) != 0;
+	if(info.supported & IDENT_LOOKAHEAD)
+		snap->val[SNAP_LOOKAHEAD] = (info.enabled & IDENT_LOOKAHEAD) != 0;
+	if(info.supported & IDENT_PUIS)
+		snap->val[SNAP_PUIS] = (info.enabled & IDENT_PUIS) != 0;
+
+	if( ata_isscsi(ata, ent->chan, ent->dev) ) {
+		if( !ata_scsigettimer(ata, ent->chan, ent->dev, &secs) )
+			snap->val[SNAP_STANDBY] = (secs > INT32_MAX / 1000)?
+					INT32_MAX : (int32_t) (secs * 1000);
+	} else if(info.supported & IDENT_EPC) {
+		snap->val[SNAP_EPC] = (info.enabled & IDENT_EPC) != 0;
+		if( (info.enabled & IDENT_EPC) &&
+				!ata_epcread(ata, ent->chan, ent->dev, epc) )
+			for(i = 0; i < EPC_NCONDS; i++)
+				if(epc[i].supported && epc[i].changeable)
+					snap->val[SNAP_IDLE_A + i] = (!epc[i].enabled)? 0 :
+							(epc[i].timer > INT32_MAX / 100)?
+							INT32_MAX : (int32_t) (epc[i].timer * 100);
+	}
+
+	return 0;
+}
+
+static int32_t snap_readjob( struct ATA *ata, struct ata_devent *ent, void *arg )
+{
+	struct snap_run *run = (struct snap_run*) arg;
+
+	// drives which can't be read, or keyed, are left out
+	snap_read(ata, ent, &run->live[ent - run->table->ents]);
+	return 0;
+}
+
+// record the settings of every drive in the table to path
+int32_t ata_snapshot( struct ata_devtable *table, const char *path,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	struct snap_run run;
+	char tmppath[PATH_MAX], timer[32];
+	time_t now = time(NULL);
+	size_t i, n = 0;
+	int32_t rc;
+	FILE *fp;
+	int j;
+
+	memset(&run, 0, sizeof(run));
+	run.table = table;
+	run.live = (struct snap_entry*) calloc(table->nents + 1, sizeof(struct snap_entry));
+	if(run.live == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	rc = ata_schedrun(table, snap_readjob, &run, jobs, ctrljobs);
+	if(rc) {
+		free(run.live);
+		return rc;
+	}
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	fp = fopen(tmppath, "w");
+	if(fp == NULL) {
+		perror("error writing snapshot");
+		free(run.live);
+		return -1;
+	}
+
+	fprintf(fp, "# ataidle snapshot, %s", ctime(&now));
+	for(i = 0; i < table->nents; i++) {
+		struct snap_entry *snap = &run.live[i];
+
+		if(snap->key[0] == 0)
+			continue;
+		fprintf(fp, "%s", snap->key);
+		for(j = 0; j < SNAP_NKEYS; j++) {
+			if(snap->val[j] == SNAP_UNSET)
+				continue;
+			if( snap_istimer(j) ) {
+				snap_timerstring(snap->val[j], timer, sizeof(timer));
+				fprintf(fp, " %s=%s", snap_keynames[j], timer);
+			} else
+				fprintf(fp, " %s=%d", snap_keynames[j], snap->val[j]);
+		}
+		fprintf(fp, "\n");
+		n++;
+	}
+
+	if( (fclose(fp) != 0) || (rename(tmppath, path) != 0) ) {
+		perror("error writing snapshot");
+		unlink(tmppath);
+		rc = -1;
+	} else
+		printf("recorded the settings of %lu drive%s in %s\n",
+				(unsigned long) n, (n == 1)? "" : "s", path);
+
+	free(run.live);
+	return rc;
+}
+
+// parse one line of a snapshot file
+static int32_t snap_parse( char *line, struct snap_entry *snap )
+{
+	char *p, *eq;
+	int i;
+
+	for(i = 0; i < SNAP_NKEYS; i++)
+		snap->val[i] = SNAP_UNSET;
+
+	p = strtok(line, " \t");
+	if( (p == NULL) || (strlen(p) >= sizeof(snap->key)) )
+		return -1;
+	strcpy(snap->key, p);
+
+	while( (p = strtok(NULL, " \t")) != NULL ) {
+		uint64_t ms;
+		char *end;
+		long val;
+
+		eq = strchr(p, '=');
+		if(eq == NULL)
+			return -1;
+		*eq = 0;
+		for(i = 0; i < SNAP_NKEYS; i++)
+			if( strcmp(p, snap_keynames[i]) == 0 )
+				break;
+		if(i == SNAP_NKEYS)
+			return -1;
+
+		if( snap_istimer(i) ) {
+			if( strcmp(eq+1, "off") == 0 )
+				ms = 0;
+			else if( ata_parseduration(eq+1, 1000, &ms) || (ms > INT32_MAX) )
+				return -1;
+			snap->val[i] = (int32_t) ms;
+		} else {
+			val = strtol(eq+1, &end, 10);
+			if( (end == eq+1) || *end || (val < 0) || (val > 255) )
+				return -1;
+			snap->val[i] = val;
+		}
+	}
+
+	return 0;
+}
+
+// load the snapshot at path, sorted by key
+static int32_t snap_load( const char *path, struct snap_run *run )
+{
+	struct snap_entry *entries = NULL;
+	size_t n = 0, max = 0;
+	char line[512];
+	int lineno = 0;
+	int32_t rc = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if(fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	while( !rc && fgets(line, sizeof(line), fp) ) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = 0;
+		if( (line[0] == '#') || (line[strspn(line, " \t")] == 0) )
+			continue;
+
+		if(n == max) {
+			struct snap_entry *e;
+
+			max = (max)? max * 2 : 64;
+			e = (struct snap_entry*) realloc(entries, max * sizeof(struct snap_entry));
+			if(e == NULL) {
+				fprintf(stderr, "malloc failed\n");
+				rc = -1;
+				break;
+			}
+			entries = e;
+		}
+
+		if( snap_parse(line, &entries[n]) ) {
+			printf("%s:%d: invalid snapshot entry\n", path, lineno);
+			rc = -1;
+		} else
+			n++;
+	}
+	fclose(fp);
+
+	if(rc) {
+		free(entries);
+		return rc;
+	}
+
+	qsort(entries, n, sizeof(struct snap_entry), snap_cmp);
+	run->entries = entries;
+	run->nentries = n;
+	return 0;
+}
+
+// find the drive's snapshot entry, by its WWN or serial number
+static struct snap_entry * snap_find( struct snap_run *run,
+				struct snap_entry *live )
+{
+	struct snap_entry want, *found;
+
+	if(run->nentries == 0)
+		return NULL;
+	found = (struct snap_entry*) bsearch(live, run->entries, run->nentries,
+			sizeof(struct snap_entry), snap_cmp);
+	if( (found == NULL) && live->serial[0] ) {
+		snprintf(want.key, sizeof(want.key), "serial:%s", live->serial);
+		found = (struct snap_entry*) bsearch(&want, run->entries, run->nentries,
+				sizeof(struct snap_entry), snap_cmp);
+	}
+	return found;
+}
+
+// put back whichever of the drive's settings differ from the snapshot
+static int32_t snap_restorejob( struct ATA *ata, struct ata_devent *ent, void *arg )
+{
+	struct snap_run *run = (struct snap_run*) arg;
+	size_t idx = ent - run->table->ents;
+	struct snap_entry *live = &run->live[idx];
+	struct snap_entry *want;
+	char spec[256], timer[32];		// room for all five EPC timers
+	size_t speclen = 0;
+	uint32_t chan = ent->chan, dev = ent->dev;
+	int32_t rc = 0;
+	int i;
+
+	run->match[idx] = -1;
+	if( snap_read(ata, ent, live) )
+		return 0;
+	want = snap_find(run, live);
+	if(want == NULL)
+		return 0;
+	run->match[idx] = want - run->entries;
+
+	for(i = 0; i < SNAP_NKEYS; i++) {
+		if( (want->val[i] == SNAP_UNSET) || (live->val[i] == SNAP_UNSET) ||
+				(want->val[i] == live->val[i]) )
+			continue;
+
+		switch(i) {
+			case SNAP_APM:
+				rc |= ata_setapm(ata, chan, dev, want->val[i]);
+				break;
+			case SNAP_AAC:
+				rc |= ata_setacoustic(ata, chan, dev, want->val[i]);
+				break;
+			case SNAP_WCACHE:
+				rc |= ata_setwritecache(ata, chan, dev, want->val[i]);
+				break;
+			case SNAP_LOOKAHEAD:
+				rc |= ata_setlookahead(ata, chan, dev, want->val[i]);
+				break;
+			case SNAP_PUIS:
+				rc |= ata_setpuis(ata, chan, dev, want->val[i]);
+				break;
+			case SNAP_EPC:
+				break;			// see below
+			case SNAP_STANDBY:
+				rc |= ata_scsisettimer(ata, chan, dev, want->val[i] / 1000);
+				break;
+			default:
+				// the EPC timers all go in one ata_setepc()
+				snap_timerstring(want->val[i], timer, sizeof(timer));
+				speclen += snprintf(spec + speclen, sizeof(spec) - speclen,
+						"%s%s=%s", (speclen)? "," : "", snap_keynames[i], timer);
+				break;
+		}
+		run->changed[idx]++;
+	}
+
+	// turning EPC back on sets all of its timers, and turning it off
+	// leaves none to set
+	if( (want->val[SNAP_EPC] == 1) && (live->val[SNAP_EPC] == 0) )
+		for(i = SNAP_IDLE_A; i <= SNAP_STANDBY_Z; i++)
+			if(want->val[i] != SNAP_UNSET) {
+				snap_timerstring(want->val[i], timer, sizeof(timer));
+				speclen += snprintf(spec + speclen, sizeof(spec) - speclen,
+						"%s%s=%s", (speclen)? "," : "", snap_keynames[i], timer);
+			}
+	if( (want->val[SNAP_EPC] == 0) && (live->val[SNAP_EPC] == 1) )
+		speclen = snprintf(spec, sizeof(spec), "off");
+
+	// with no timers to set, an empty spec still turns EPC back on
+	spec[speclen] = 0;
+	if( speclen || ((want->val[SNAP_EPC] == 1) && (live->val[SNAP_EPC] == 0)) )
+		rc |= ata_setepc(ata, chan, dev, spec);
+
+	if(rc)
+		printf("%s: not all settings could be restored\n", ata_devlabel(ata, chan, dev));
+	return rc;
+}
+
+// put the settings recorded in the snapshot at path back on each drive
+// in the table, sending only the commands for those which have changed
+int32_t ata_restore( struct ata_devtable *table, const char *path,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	struct snap_run run;
+	uint32_t nchanged = 0, ndrives = 0, nmatched = 0;
+	bool *found = NULL;
+	size_t i;
+	int32_t rc;
+
+	memset(&run, 0, sizeof(run));
+	run.table = table;
+	rc = snap_load(path, &run);
+	if(rc)
+		return rc;
+
+	run.live = (struct snap_entry*) calloc(table->nents + 1, sizeof(struct snap_entry));
+	run.match = (int32_t*) calloc(table->nents + 1, sizeof(int32_t));
+	run.changed = (uint32_t*) calloc(table->nents + 1, sizeof(uint32_t));
+	found = (bool*) calloc(run.nentries + 1, sizeof(bool));
+	if( !run.live || !run.match || !run.changed || !found ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+
+	// a command failing on one drive doesn't stop the others being
+	// restored, so the summary is printed whatever the jobs return
+	if(!rc) {
+		for(i = 0; i < table->nents; i++)
+			run.match[i] = -1;
+		rc = ata_schedrun(table, snap_restorejob, &run, jobs, ctrljobs);
+
+		for(i = 0; i < table->nents; i++) {
+			if(run.match[i] < 0)
+				continue;
+			found[run.match[i]] = true;
+			nchanged += run.changed[i];
+			if(run.changed[i])
+				ndrives++;
+		}
+		for(i = 0; i < run.nentries; i++)
+			if(found[i])
+				nmatched++;
+			else
+				printf("%s: not found\n", run.entries[i].key);
+
+		printf("restored %u setting%s on %u of %u drive%s\n", nchanged,
+				(nchanged == 1)? "" : "s", ndrives, nmatched,
+				(nmatched == 1)? "" : "s");
+	}
+
+	free(found);
+	free(run.changed);
+	free(run.match);
+	free(run.live);
+	free(run.entries);
+	return rc;
+}
@@ -0,0 +1,14 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "atagen.h"
+#include "devtable.h"
+
+int32_t	ata_snapshot( struct ata_devtable *table, const char *path,
+				uint32_t jobs, uint32_t ctrljobs );
+int32_t	ata_restore( struct ata_devtable *table, const char *path,
+				uint32_t jobs, uint32_t ctrljobs );
+
+#endif
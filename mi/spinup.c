@@ -0,0 +1,239 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// controlled spin-up.   Drives with Power-Up In Standby enabled come up
+// from power on without spinning, and those which need it wait for
+// ATA_PUIS_SPINUP before they will.   Rather than spinning a whole
+// chassis up at once, and paying for it in PSU inrush, the drives are
+// brought up in waves by the 'spinup_order' in the policy file, lowest
+// first, with drives without one last:
+//
+//	model "ST4000NM0033" puis=1 spinup_order=2
+//	serial "Z1Z0ABCD" spinup_order=1
+//
+// The spin-up command only completes once the drive is spinning, so -j
+// and -J bound how many drives draw their spin-up current at once.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "identify.h"
+#include "scsi.h"
+#include "policy.h"
+#include "sched.h"
+#include "spinup.h"
+
+static double spinup_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// spin the drive up if it's waiting in standby, setting spun if it was
+static int32_t spinup_drive( struct ATA *ata, uint32_t chan, uint32_t dev,
+				bool *spun )
+{
+	struct ata_ident ident;
+	struct ata_identinfo info;
+	double start = spinup_now();
+	uint8_t mode;
+	int32_t rc;
+
+	*spun = false;
+
+	// SCSI drives held stopped at power on want a START STOP UNIT
+	if( ata_isscsi(ata, chan, dev) ) {
+		if( !ata_getpowermode(ata, chan, dev, &mode) &&
+				(mode != ATA_POWERMODE_STANDBY) )
+			return 0;
+		rc = ata_scsistart(ata, chan, dev);
+	} else {
+		rc = ata_ident(ata, chan, dev, &ident);
+		if(rc) {
+			printf("%s: could not get device information\n",
+					ata_devlabel(ata, chan, dev));
+			return rc;
+		}
+		ata_identdecode(&ident, &info);
+
+		if( ata_getpowermode(ata, chan, dev, &mode) )
+			mode = (info.waiting)? ATA_POWERMODE_STANDBY : ATA_POWERMODE_ACTIVE;
+		if( !info.waiting && (mode != ATA_POWERMODE_STANDBY) )
+			return 0;
+
+		// a drive in ordinary standby spins up on IDLE IMMEDIATE.   One
+		// which needs the spin-up subcommand but is still in standby
+		// after that must have powered up in standby with its IDENTIFY
+		// page already complete, so it's sent the subcommand as well.
+		ata_setataparams(ata, 0, 0);
+		if(!info.waiting)
+			rc = ata_cmd(ata, chan, dev, ATA_IDLE_IMMEDIATE, 0);
+		if( info.waiting || (!rc && (info.enabled & IDENT_PUISSPINUP) &&
+				!ata_getpowermode(ata, chan, dev, &mode) &&
+				(mode == ATA_POWERMODE_STANDBY)) ) {
+			ata_setataparams(ata, 0, 0);
+			ata_setfeature_param(ata, ATA_PUIS_SPINUP);
+			rc = ata_cmd(ata, chan, dev, ATA__SETFEATURES, 0);
+		}
+	}
+
+	if(rc)
+		printf("%s: spin-up failed\n", ata_devlabel(ata, chan, dev));
+	else {
+		printf("%s: spun up in %.1fs\n", ata_devlabel(ata, chan, dev),
+				spinup_now() - start);
+		*spun = true;
+	}
+	return rc;
+}
+
+// spin up the one drive, if it's waiting
+int32_t ata_spinup( struct ATA *ata, uint32_t chan, uint32_t dev )
+{
+	bool spun;
+	int32_t rc = spinup_drive(ata, chan, dev, &spun);
+
+	if( !rc && !spun )
+		printf("%s is already spinning\n", ata_devlabel(ata, chan, dev));
+	return rc;
+}
+
+// what the workers of a wave share: the wave's drives, and whether
+// each was spun up, or failed to be
+struct spinup_run {
+	struct ata_devtable	*wave;
+	int8_t				*result;	// 1 spun up, 0 already spinning, -1 failed
+};
+
+static int32_t spinup_job( struct ATA *ata, struct ata_devent *ent, void *arg )
+{
+	struct spinup_run *run = (struct spinup_run*) arg;
+	bool spun;
+
+	// one drive failing doesn't hold up the rest of the wave
+	if( spinup_drive(ata, ent->chan, ent->dev, &spun) )
+		run->result[ent - run->wave->ents] = -1;
+	else
+		run->result[ent - run->wave->ents] = spun;
+	return 0;
+}
+
+// spin up every drive in the table which is waiting, a wave at a time
+// in spinup_order
+int32_t ata_spinupall( struct ata_devtable *table, struct ata_policystore *store,
+				uint32_t jobs, uint32_t ctrljobs )
+{
+	struct ata_devtable wave;
+	struct spinup_run run;
+	int32_t *order;
+	int32_t cur, next;
+	uint32_t nspun = 0, nfailed = 0, nwaves = 0;
+	size_t i;
+	int32_t rc;
+
+	// the drives' models and serial numbers, to find their policy by
+	rc = ata_devtableidentify(table, jobs, ctrljobs);
+	if(rc)
+		return rc;
+
+	memset(&wave, 0, sizeof(wave));
+	memset(&run, 0, sizeof(run));
+	order = (int32_t*) calloc(table->nents + 1, sizeof(int32_t));
+	wave.ents = (struct ata_devent*) calloc(table->nents + 1, sizeof(struct ata_devent));
+	run.result = (int8_t*) calloc(table->nents + 1, sizeof(int8_t));
+	if( !order || !wave.ents || !run.result ) {
+		fprintf(stderr, "malloc failed\n");
+		free(order);
+		free(wave.ents);
+		free(run.result);
+		return -1;
+	}
+	run.wave = &wave;
+
+	for(i = 0; i < table->nents; i++) {
+		struct ata_policy *policy = ata_policyfind(store, table->ents[i].model,
+						table->ents[i].serial);
+
+		order[i] = ( (policy == NULL) ||
+				(policy->val[POLICY_SPINUP_ORDER] == POLICY_UNSET) )?
+				INT32_MAX : policy->val[POLICY_SPINUP_ORDER];
+	}
+
+	// each wave is the drives with the lowest order above the last's
+	for(cur = INT32_MIN; !rc; cur = next) {
+		bool found = false;
+
+		next = INT32_MAX;
+		for(i = 0; i < table->nents; i++)
+			if( (order[i] > cur) && (order[i] <= next) ) {
+				next = order[i];
+				found = true;
+			}
+		if(!found)
+			break;
+
+		wave.nents = 0;
+		for(i = 0; i < table->nents; i++)
+			if(order[i] == next)
+				wave.ents[wave.nents++] = table->ents[i];
+
+		memset(run.result, 0, wave.nents * sizeof(int8_t));
+		rc = ata_schedrun(&wave, spinup_job, &run, jobs, ctrljobs);
+		for(i = 0; i < wave.nents; i++)
+			if(run.result[i] > 0)
+				nspun++;
+			else if(run.result[i] < 0)
+				nfailed++;
+		nwaves++;
+
+		if(next == INT32_MAX)
+			break;
+	}
+
+	if(!rc)
+		printf("spun up %u drive%s in %u wave%s%s\n", nspun, (nspun == 1)? "" : "s",
+				nwaves, (nwaves == 1)? "" : "s",
+				(nfailed)? ", some failed" : "");
+	if(nfailed)
+		rc = -1;
+
+	free(order);
+	free(wave.ents);
+	free(run.result);
+	return rc;
+}
@@ -0,0 +1,14 @@
+#ifndef _SPINUP_H_
+#define _SPINUP_H_
+
+#include <stdint.h>
+
+#include "atagen.h"
+#include "devtable.h"
+#include "policy.h"
+
+int32_t	ata_spinup( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+int32_t	ata_spinupall( struct ata_devtable *table, struct ata_policystore *store,
+				uint32_t jobs, uint32_t ctrljobs );
+
+#endif
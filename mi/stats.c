@@ -0,0 +1,216 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// time-in-state accounting: the daemon samples each drive's power mode
+// with CHECK POWER MODE, which doesn't wake it, and charges the time
+// since the last sample to the state seen then.   Together with the
+// wattage profile of the drive's model, that gives an estimate of the
+// energy used, and saved against leaving the drive spinning, which is
+// written out in the Prometheus text format for a textfile collector.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "atadefs.h"
+#include "util.h"
+#include "stats.h"
+
+static const char * const stats_statenames[POWERSTATE_N] = {
+	"active", "idle", "standby"
+};
+
+void ata_statsinit( struct ata_drivestats *stats, const char *label,
+				const char *model, const char *serial, const int32_t *mw )
+{
+	static const int32_t defmw[POWERSTATE_N] = {
+		STATS_ACTIVE_MW, STATS_IDLE_MW, STATS_STANDBY_MW
+	};
+	int i;
+
+	memset(stats, 0, sizeof(struct ata_drivestats));
+	snprintf(stats->label, sizeof(stats->label), "%s", label);
+	snprintf(stats->model, sizeof(stats->model), "%s", model);
+	snprintf(stats->serial, sizeof(stats->serial), "%s", serial);
+	for(i = 0; i < POWERSTATE_N; i++)
+		stats->mw[i] = (mw[i] < 0)? defmw[i] : mw[i];
+}
+
+static enum ata_powerstate stats_state( uint8_t mode )
+{
+	if( ata_powermodestandby(mode) )
+		return POWERSTATE_STANDBY;
+	else if( (mode >= ATA_POWERMODE_IDLE) && (mode <= ATA_POWERMODE_IDLE_C) )
+		return POWERSTATE_IDLE;
+	else
+		return POWERSTATE_ACTIVE;
+}
+
+// account for the time since the last sample, given the
+// power mode CHECK POWER MODE returned now
+void ata_statssample( struct ata_drivestats *stats, uint8_t mode, double now )
+{
+	enum ata_powerstate state = stats_state(mode);
+
+	if(stats->sampled) {
+		double dt = now - stats->lastsample;
+		int32_t mw = stats->mw[stats->state];
+
+		stats->seconds[stats->state] += dt;
+		stats->joules += mw * dt / 1000;
+		stats->savedjoules += (stats->mw[POWERSTATE_ACTIVE] - mw) * dt / 1000;
+
+		if( (stats->state == POWERSTATE_STANDBY) && (state != POWERSTATE_STANDBY) )
+			stats->wakes++;
+	}
+
+	stats->state = state;
+	stats->lastsample = now;
+	stats->sampled = true;
+}
+
+const char *ata_statsstatename( enum ata_powerstate state )
+{
+	return stats_statenames[state];
+}
+
+void ata_statsprint( struct ata_drivestats *stats )
+{
+	int i;
+
+	printf("%s (%s):", stats->label, stats->model);
+	for(i = 0; i < POWERSTATE_N; i++)
+		printf(" %s %.0fs,", stats_statenames[i], stats->seconds[i]);
+	printf(" %u unloads, %u standbys, %u wakes, %.1f Wh used, %.1f Wh saved\n",
+			stats->unloads, stats->standbys, stats->wakes,
+			stats->joules / 3600, stats->savedjoules / 3600);
+}
+
+// print a label value, escaped as the text format requires
+static void stats_printlabel( FILE *fp, const char *name, const char *val )
+{
+	fprintf(fp, "%s=\"", name);
+	for(; *val; val++) {
+		if( (*val == '"') || (*val == '\\') )
+			fputc('\\', fp);
+		fputc(*val, fp);
+	}
+	fprintf(fp, "\"");
+}
+
+// start a sample of metric for the drive, leaving the labels open
+static void stats_printlabels( FILE *fp, const char *metric,
+				struct ata_drivestats *stats )
+{
+	fprintf(fp, "%s{", metric);
+	stats_printlabel(fp, "drive", stats->label);
+	fprintf(fp, ",");
+	stats_printlabel(fp, "model", stats->model);
+	fprintf(fp, ",");
+	stats_printlabel(fp, "serial", stats->serial);
+}
+
+// write the counters for every drive to path in the Prometheus text
+// format, replacing the file atomically so it's never read half written
+int32_t ata_statswrite( const char *path, struct ata_drivestats **stats, size_t n )
+{
+	char tmppath[PATH_MAX];
+	FILE *fp;
+	size_t i;
+	int j;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	fp = fopen(tmppath, "w");
+	if(fp == NULL) {
+		perror(tmppath);
+		return -1;
+	}
+
+	fprintf(fp, "# HELP ataidle_power_state_seconds_total Time the drive spent in each power state.\n"
+			"# TYPE ataidle_power_state_seconds_total counter\n");
+	for(i = 0; i < n; i++)
+		for(j = 0; j < POWERSTATE_N; j++) {
+			stats_printlabels(fp, "ataidle_power_state_seconds_total", stats[i]);
+			fprintf(fp, ",state=\"%s\"} %.3f\n", stats_statenames[j],
+					stats[i]->seconds[j]);
+		}
+
+	fprintf(fp, "# HELP ataidle_transitions_total Power state transitions: "
+			"unload and standby made by ataidle, wake however caused.\n"
+			"# TYPE ataidle_transitions_total counter\n");
+	for(i = 0; i < n; i++) {
+		stats_printlabels(fp, "ataidle_transitions_total", stats[i]);
+		fprintf(fp, ",kind=\"unload\"} %u\n", stats[i]->unloads);
+		stats_printlabels(fp, "ataidle_transitions_total", stats[i]);
+		fprintf(fp, ",kind=\"standby\"} %u\n", stats[i]->standbys);
+		stats_printlabels(fp, "ataidle_transitions_total", stats[i]);
+		fprintf(fp, ",kind=\"wake\"} %u\n", stats[i]->wakes);
+	}
+
+	fprintf(fp, "# HELP ataidle_energy_joules_total Estimated energy used by the drive.\n"
+			"# TYPE ataidle_energy_joules_total counter\n");
+	for(i = 0; i < n; i++) {
+		stats_printlabels(fp, "ataidle_energy_joules_total", stats[i]);
+		fprintf(fp, "} %.1f\n", stats[i]->joules);
+	}
+
+	fprintf(fp, "# HELP ataidle_energy_saved_joules_total Estimated energy saved "
+			"against the drive staying active.\n"
+			"# TYPE ataidle_energy_saved_joules_total counter\n");
+	for(i = 0; i < n; i++) {
+		stats_printlabels(fp, "ataidle_energy_saved_joules_total", stats[i]);
+		fprintf(fp, "} %.1f\n", stats[i]->savedjoules);
+	}
+
+	fprintf(fp, "# HELP ataidle_command_latency_seconds Median latency of the "
+			"drive's recent non-media commands.\n"
+			"# TYPE ataidle_command_latency_seconds gauge\n");
+	for(i = 0; i < n; i++) {
+		stats_printlabels(fp, "ataidle_command_latency_seconds", stats[i]);
+		fprintf(fp, "} %.6f\n", ata_latencymedian(&stats[i]->latency) / 1000);
+	}
+
+	fprintf(fp, "# HELP ataidle_fail_slow Whether the drive is answering much "
+			"slower than the others of its model.\n"
+			"# TYPE ataidle_fail_slow gauge\n");
+	for(i = 0; i < n; i++) {
+		stats_printlabels(fp, "ataidle_fail_slow", stats[i]);
+		fprintf(fp, "} %d\n", stats[i]->slow);
+	}
+
+	if( (fclose(fp) != 0) || (rename(tmppath, path) != 0) ) {
+		perror(path);
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
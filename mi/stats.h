@@ -0,0 +1,49 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "latency.h"
+
+// the power states CHECK POWER MODE can tell apart
+enum ata_powerstate {
+	POWERSTATE_ACTIVE,		// active or idle, the drive won't say which
+	POWERSTATE_IDLE,		// idle, including the EPC idle conditions
+	POWERSTATE_STANDBY,
+	POWERSTATE_N
+};
+
+// the wattage profile of a typical 3.5" 7200rpm drive, used for models
+// without active_mw, idle_mw and standby_mw in the policy file
+#define STATS_ACTIVE_MW		7000
+#define STATS_IDLE_MW		5000
+#define STATS_STANDBY_MW	800
+
+struct ata_drivestats {
+	char				label[64];
+	char				model[41];
+	char				serial[21];
+	int32_t				mw[POWERSTATE_N];		// power drawn in each state
+	double				seconds[POWERSTATE_N];	// time spent in each state
+	double				joules;			// energy used, estimated
+	double				savedjoules;	// against staying active throughout
+	uint32_t			unloads;		// transitions ataidle made
+	uint32_t			standbys;
+	uint32_t			wakes;			// standby to spinning, however caused
+	enum ata_powerstate	state;			// at the last sample
+	double				lastsample;
+	bool				sampled;
+	struct ata_latency	latency;		// of CHECK POWER MODE
+	bool				slow;			// against the drive's peers
+};
+
+void	ata_statsinit( struct ata_drivestats *stats, const char *label,
+				const char *model, const char *serial, const int32_t *mw );
+void	ata_statssample( struct ata_drivestats *stats, uint8_t mode, double now );
+void	ata_statsprint( struct ata_drivestats *stats );
+const char *	ata_statsstatename( enum ata_powerstate state );
+int32_t	ata_statswrite( const char *path, struct ata_drivestats **stats, size_t n );
+
+#endif
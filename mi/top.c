@@ -0,0 +1,360 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "latency.h"
+#include "top.h"
+
+// a live view of every drive's power state and activity, for watching
+// spindown settings at work.   One loop samples all the drives each
+// interval: the I/O counts come from a single read of /proc/diskstats,
+// and the power state from CHECK POWER MODE, which never wakes a drive.
+// Only the lines which changed since the last frame are redrawn, so
+// the view costs little to keep open, even over a slow connection.
+
+// the longest line drawn
+#define TOP_LINE	160
+
+// lines above the drives
+#define TOP_HEADER	2
+
+static volatile sig_atomic_t top_stop = 0;
+static volatile sig_atomic_t top_resized = 0;
+
+static void top_signal(int sig)
+{
+	if(sig == SIGWINCH)
+		top_resized = 1;
+	else
+		top_stop = 1;
+}
+
+static double top_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+int32_t
+ata_topadd( struct ATA *ata, struct ata_top *top, uint32_t chan, uint32_t dev )
+{
+	static const int32_t nomw[POWERSTATE_N] = {
+		POLICY_UNSET, POLICY_UNSET, POLICY_UNSET
+	};
+	struct ata_topdrive *drive;
+	struct ata_policy *policy = NULL;
+	struct ata_ident ident;
+	char model[41] = "", serial[21] = "";
+	const char *base;
+
+	if( !ata_ident(ata, chan, dev, &ident) ) {
+		ata_identstrings(&ident, model, serial);
+		policy = ata_policyfind(top->store, model, serial);
+	}
+
+	if( top->ndrives == top->maxdrives ) {
+		size_t newmax = (top->maxdrives)? top->maxdrives * 2 : 8;
+		struct ata_topdrive *drives = (struct ata_topdrive*)
+				realloc(top->drives, newmax * sizeof(struct ata_topdrive));
+		if(drives == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return -1;
+		}
+		top->drives = drives;
+		top->maxdrives = newmax;
+	}
+
+	drive = &top->drives[top->ndrives++];
+	memset(drive, 0, sizeof(struct ata_topdrive));
+	drive->chan = chan;
+	drive->dev = dev;
+	ata_getdevname(ata, chan, dev, drive->devpath, sizeof(drive->devpath));
+	base = strrchr(drive->devpath, '/');
+	snprintf(drive->name, sizeof(drive->name), "%.31s", (base)? base + 1 : drive->devpath);
+
+	// the drive goes into standby at whichever of its own timer
+	// and the daemon's spindown comes first
+	drive->standby = POLICY_UNSET;
+	if(policy != NULL) {
+		int32_t standby = policy->val[POLICY_STANDBY];
+		int32_t spindown = policy->val[POLICY_SPINDOWN];
+
+		if( (standby != POLICY_UNSET) && (standby > 0) )
+			drive->standby = standby;
+		if( (spindown != POLICY_UNSET) && ((drive->standby == POLICY_UNSET) ||
+				(spindown < drive->standby)) )
+			drive->standby = spindown;
+	}
+
+	ata_statsinit(&drive->stats, ata_devlabel(ata, chan, dev), model, serial,
+			(policy != NULL)? &policy->val[POLICY_ACTIVE_MW] : nomw);
+	return 0;
+}
+
+static int top_cmpname(const void *a, const void *b)
+{
+	return strcmp(((const struct ata_topdrive*) a)->name,
+			((const struct ata_topdrive*) b)->name);
+}
+
+// sample every drive once
+static void
+top_sample( struct ATA *ata, struct ata_top *top, const char **names,
+				uint64_t *ios, double now, double dt )
+{
+	size_t i;
+
+	for(i = 0; i < top->ndrives; i++)
+		ios[i] = top->drives[i].ios;
+	ata_getiocounts(names, top->ndrives, ios);
+
+	for(i = 0; i < top->ndrives; i++) {
+		struct ata_topdrive *drive = &top->drives[i];
+		enum ata_powerstate was = drive->stats.state;
+		bool sampled = drive->stats.sampled;
+		uint8_t mode;
+		double t;
+
+		if(ios[i] != drive->ios) {
+			drive->iorate = (dt > 0)? (ios[i] - drive->ios) / dt : 0;
+			drive->ios = ios[i];
+			drive->lastio = now;
+		} else
+			drive->iorate = 0;
+
+		strcpy(ata->devpath, drive->devpath);
+		t = top_now();
+		drive->havemode = !ata_getpowermode(ata, drive->chan, drive->dev, &mode);
+		drive->latency = (top_now() - t) * 1000;
+		ata_latencyadd(&drive->stats.latency, drive->latency);
+		if(!drive->havemode)
+			continue;
+
+		ata_statssample(&drive->stats, mode, now);
+		if( sampled && (drive->stats.state != was) ) {
+			struct ata_topevent *ev;
+
+			drive->from = was;
+			drive->changed = now;
+
+			if(top->nevents == ATA_TOP_EVENTS)
+				memmove(&top->events[0], &top->events[1],
+						(ATA_TOP_EVENTS - 1) * sizeof(struct ata_topevent));
+			else
+				top->nevents++;
+			ev = &top->events[top->nevents - 1];
+			ev->drive = i;
+			ev->from = was;
+			ev->to = drive->stats.state;
+			ev->when = time(NULL);
+		}
+	}
+	ata->devpath[0] = 0;
+}
+
+// lay out the frame, one line of at most TOP_LINE characters to each
+static void
+top_frame( struct ata_top *top, char (*lines)[TOP_LINE], double now )
+{
+	char when[16], idle[16], standby[16], change[32], ago[16];
+	time_t t = time(NULL);
+	size_t i, n = 0;
+
+	strftime(when, sizeof(when), "%H:%M:%S", localtime(&t));
+	snprintf(lines[n++], TOP_LINE, "ataidle top - %s, %lu drive%s, every %us",
+			when, (unsigned long) top->ndrives, (top->ndrives == 1)? "" : "s",
+			top->interval);
+	snprintf(lines[n++], TOP_LINE, "%-12s %-20s %-8s %7s %8s %8s %5s %-24s %7s %7s",
+			"DRIVE", "MODEL", "STATE", "IO/S", "IDLE", "STANDBY", "WAKES",
+			"LAST CHANGE", "CPM MS", "MEDIAN");
+
+	for(i = 0; i < top->ndrives; i++) {
+		struct ata_topdrive *drive = &top->drives[i];
+		uint32_t idlesecs = (uint32_t) (now - drive->lastio);
+
+		ata_secsstring(idlesecs, idle, sizeof(idle));
+
+		if( !drive->havemode || (drive->stats.state == POWERSTATE_STANDBY) )
+			snprintf(standby, sizeof(standby), "-");
+		else if(drive->standby == POLICY_UNSET)
+			snprintf(standby, sizeof(standby), "off");
+		else if(idlesecs >= (uint32_t) drive->standby)
+			snprintf(standby, sizeof(standby), "due");
+		else
+			ata_secsstring(drive->standby - idlesecs, standby, sizeof(standby));
+
+		if(drive->changed)
+			snprintf(change, sizeof(change), "%s>%s %s ago",
+					ata_statsstatename(drive->from),
+					ata_statsstatename(drive->stats.state),
+					ata_secsstring((uint32_t) (now - drive->changed), ago, sizeof(ago)));
+		else
+			snprintf(change, sizeof(change), "-");
+
+		snprintf(lines[n++], TOP_LINE,
+				"%-12.12s %-20.20s %-8s %7.1f %8s %8s %5u %-24.24s %7.2f %7.2f",
+				drive->name, drive->stats.model,
+				(drive->havemode)? ata_statsstatename(drive->stats.state) : "unknown",
+				drive->iorate, idle, standby, drive->stats.wakes, change,
+				drive->latency, ata_latencymedian(&drive->stats.latency));
+	}
+
+	lines[n++][0] = 0;
+	for(i = 0; i < ATA_TOP_EVENTS; i++) {
+		if(i < top->nevents) {
+			struct ata_topevent *ev = &top->events[top->nevents - 1 - i];
+
+			strftime(when, sizeof(when), "%H:%M:%S", localtime(&ev->when));
+			snprintf(lines[n++], TOP_LINE, "%s  %-12.12s %s>%s", when,
+					top->drives[ev->drive].name, ata_statsstatename(ev->from),
+					ata_statsstatename(ev->to));
+		} else
+			lines[n++][0] = 0;
+	}
+}
+
+// run until interrupted, sampling every drive each interval and
+// redrawing what changed.   When the output isn't a terminal each
+// frame is printed in full instead, for logging.
+int32_t
+ata_toprun( struct ATA *ata, struct ata_top *top )
+{
+	struct sigaction sa;
+	size_t nlines = TOP_HEADER + top->ndrives + 1 + ATA_TOP_EVENTS, i;
+	char (*lines)[TOP_LINE], (*drawn)[TOP_LINE];
+	const char **names;
+	uint64_t *ios;
+	bool tty = isatty(STDOUT_FILENO), redraw = true;
+	double last = 0, now;
+	int32_t rc = 0;
+
+	if(top->ndrives == 0) {
+		printf("no drives to watch\n");
+		return -1;
+	}
+
+	// the I/O counts are looked up by name in a single pass
+	qsort(top->drives, top->ndrives, sizeof(struct ata_topdrive), top_cmpname);
+
+	lines = calloc(nlines, TOP_LINE);
+	drawn = calloc(nlines, TOP_LINE);
+	names = (const char**) calloc(top->ndrives, sizeof(char*));
+	ios = (uint64_t*) calloc(top->ndrives, sizeof(uint64_t));
+	if( (lines == NULL) || (drawn == NULL) || (names == NULL) || (ios == NULL) ) {
+		fprintf(stderr, "malloc failed\n");
+		rc = -1;
+	}
+
+	if(!rc) {
+		now = top_now();
+		for(i = 0; i < top->ndrives; i++) {
+			names[i] = top->drives[i].name;
+			ios[i] = 0;
+			top->drives[i].lastio = now;
+		}
+		ata_getiocounts(names, top->ndrives, ios);
+		for(i = 0; i < top->ndrives; i++)
+			top->drives[i].ios = ios[i];
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = top_signal;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGWINCH, &sa, NULL);
+
+		if(tty)
+			printf("\033[?25l");		// hide the cursor
+	}
+
+	while(!rc && !top_stop) {
+		struct timespec ts;
+
+		now = top_now();
+		top_sample(ata, top, names, ios, now, (last)? now - last : 0);
+		last = now;
+		top_frame(top, lines, now);
+
+		if(top_resized) {
+			top_resized = 0;
+			redraw = true;
+		}
+
+		if(!tty) {
+			for(i = 0; i < nlines; i++)
+				if( (i < TOP_HEADER + top->ndrives) || lines[i][0] )
+					printf("%s\n", lines[i]);
+			printf("\n");
+		} else {
+			if(redraw)
+				printf("\033[H\033[2J");
+			for(i = 0; i < nlines; i++)
+				if( redraw || strcmp(lines[i], drawn[i]) ) {
+					printf("\033[%lu;1H%s\033[K", (unsigned long) i + 1, lines[i]);
+					strcpy(drawn[i], lines[i]);
+				}
+			redraw = false;
+		}
+		fflush(stdout);
+
+		// a signal cuts the sleep short
+		now = top_now() - now;
+		if(now < top->interval) {
+			ts.tv_sec = (time_t) (top->interval - now);
+			ts.tv_nsec = (long) ((top->interval - now - ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	if(tty && !rc)
+		printf("\033[%lu;1H\033[?25h\n", (unsigned long) nlines);
+
+	free(lines);
+	free(drawn);
+	free(names);
+	free(ios);
+	return rc;
+}
+
+void ata_topfree( struct ata_top *top )
+{
+	free(top->drives);
+	top->drives = NULL;
+	top->ndrives = top->maxdrives = 0;
+}
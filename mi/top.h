@@ -0,0 +1,54 @@
+#ifndef _TOP_H_
+#define _TOP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "atagen.h"
+#include "policy.h"
+#include "stats.h"
+
+// power state transitions listed under the drives
+#define ATA_TOP_EVENTS		5
+
+struct ata_topdrive {
+	uint32_t			chan;
+	uint32_t			dev;
+	char				devpath[64];
+	char				name[32];	// base name, as /proc/diskstats has it
+	int32_t				standby;	// seconds idle before standby, or POLICY_UNSET
+	uint64_t			ios;		// I/O count at the last sample
+	double				iorate;		// I/Os a second since the sample before
+	double				lastio;		// when I/O was last seen
+	double				latency;	// of the last CHECK POWER MODE, in ms
+	bool				havemode;
+	enum ata_powerstate	from;		// the last transition
+	double				changed;	// when, or 0 if there hasn't been one
+	struct ata_drivestats	stats;
+};
+
+struct ata_topevent {
+	size_t				drive;
+	enum ata_powerstate	from;
+	enum ata_powerstate	to;
+	time_t				when;
+};
+
+struct ata_top {
+	struct ata_topdrive	*drives;
+	size_t				ndrives;
+	size_t				maxdrives;
+	uint32_t			interval;	// seconds between samples
+	struct ata_policystore	*store;
+	struct ata_topevent	events[ATA_TOP_EVENTS];	// the latest last
+	size_t				nevents;
+};
+
+int32_t	ata_topadd( struct ATA *ata, struct ata_top *top, uint32_t ata_chan,
+				uint32_t ata_dev );
+int32_t	ata_toprun( struct ATA *ata, struct ata_top *top );
+void	ata_topfree( struct ata_top *top );
+
+#endif
@@ -0,0 +1,351 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// the auto-tuner: find the most power saving APM and AAC levels at which
+// the drive still meets a latency or throughput objective, using a binary
+// search over each range rather than benchmarking every level.   The
+// result is recorded against the drive's model in the policy store, so
+// identical drives can then be configured without tuning.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "bench.h"
+#include "policy.h"
+#include "tune.h"
+#include "identify.h"
+
+static const uint32_t TUNE_IDLE_GAP		= 5;
+
+// a depth within this fraction of the best throughput is as good, and
+// the shallowest such depth is taken, for the lowest latency
+static const double TUNE_DEPTH_SLACK	= 0.05;
+
+// parse an objective such as "p99=20,mbps=100"
+int32_t ata_parseslo( char *spec, struct ata_slo *slo )
+{
+	char *p = spec;
+
+	memset(slo, 0, sizeof(struct ata_slo));
+
+	while(*p) {
+		double *target = NULL;
+		char *end;
+
+		if( strncmp(p, "p50=", 4) == 0 )
+			target = &slo->p50;
+		else if( strncmp(p, "p95=", 4) == 0 )
+			target = &slo->p95;
+		else if( strncmp(p, "p99=", 4) == 0 )
+			target = &slo->p99;
+		else if( strncmp(p, "iops=", 5) == 0 )
+			target = &slo->iops;
+		else if( strncmp(p, "mbps=", 5) == 0 )
+			target = &slo->mbps;
+		else if( strncmp(p, "wake=", 5) == 0 )
+			target = &slo->wake;
+
+		if(target == NULL) {
+			printf("invalid objective: must be p50, p95, p99, wake, iops or mbps\n");
+			return -1;
+		}
+
+		p = strchr(p, '=') + 1;
+		*target = strtod(p, &end);
+		if( (end == p) || (*target <= 0) || ((*end != ',') && (*end != 0)) ) {
+			printf("invalid objective value\n");
+			return -1;
+		}
+		p = (*end == ',')? end+1 : end;
+	}
+
+	return 0;
+}
+
+static bool tune_slomet( struct ata_slo *slo, struct ata_benchresult *res, double wake )
+{
+	return !( (slo->p50 && (res->lat_p50 > slo->p50)) ||
+			(slo->p95 && (res->lat_p95 > slo->p95)) ||
+			(slo->p99 && (res->lat_p99 > slo->p99)) ||
+			(slo->wake && (wake > slo->wake)) ||
+			(slo->iops && (res->rand_iops < slo->iops)) ||
+			(slo->mbps && (res->seq_mbps < slo->mbps)) );
+}
+
+// how far into power saving a CHECK POWER MODE result is
+static int tune_modedepth( uint8_t mode )
+{
+	if( ata_powermodestandby(mode) )
+		return 2;
+	else if( (mode >= ATA_POWERMODE_IDLE) && (mode <= ATA_POWERMODE_IDLE_C) )
+		return 1;
+	else
+		return 0;
+}
+
+// set one APM or AAC level, benchmark it, then leave the drive idle to
+// see which power mode it drops into, returned in mode.   Returns 1 if
+// the objective is met, 0 if it isn't and -1 on error.
+static int32_t
+tune_try( struct ATA *ata, uint32_t chan, uint32_t dev, bool apm, uint32_t val,
+				uint32_t secs, struct ata_slo *slo, uint8_t *mode )
+{
+	struct ata_benchresult res;
+	double wake = 0;
+	int32_t rc;
+
+	*mode = ATA_POWERMODE_ACTIVE;
+
+	rc = (apm)? ata_setapm(ata, chan, dev, val) : ata_setacoustic(ata, chan, dev, val);
+
+	if(!rc)
+		rc = ata_bench(ata, chan, dev, secs, &res);
+
+	if(!rc) {
+		sleep(TUNE_IDLE_GAP);
+		ata_getpowermode(ata, chan, dev, mode);
+		if(slo->wake)
+			rc = ata_benchwake(ata, chan, dev, &wake);
+	}
+
+	if(rc)
+		return -1;
+
+	printf("%s %3u: %7.1f MB/s %7.1f IOPS, p99 %7.2f ms, after %us idle: %s",
+			(apm)? "APM" : "AAC", val, res.seq_mbps, res.rand_iops,
+			res.lat_p99, TUNE_IDLE_GAP, ata_getpowermodestring(*mode));
+	if(slo->wake)
+		printf(", wake %.2f ms", wake);
+	printf(": %s\n", tune_slomet(slo, &res, wake)? "meets objective" : "too slow");
+
+	return tune_slomet(slo, &res, wake)? 1 : 0;
+}
+
+// binary search for the lowest level in [lo, hi] which meets the
+// objective, assuming performance increases with the level.   Of the
+// levels tried which meet it, the one whose drive went furthest into
+// idle or standby in the gap after its benchmark is taken, the lowest
+// if several went as far.   Returns the level, 0 if even hi doesn't
+// meet the objective, or -1 on error.
+static int32_t
+tune_search( struct ATA *ata, uint32_t chan, uint32_t dev, bool apm,
+				uint32_t lo, uint32_t hi, uint32_t secs, struct ata_slo *slo )
+{
+	uint8_t mode;
+	int32_t met = tune_try(ata, chan, dev, apm, hi, secs, slo, &mode);
+	int32_t best = hi, bestdepth;
+
+	if(met <= 0)
+		return met;
+	bestdepth = tune_modedepth(mode);
+
+	while(lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+
+		met = tune_try(ata, chan, dev, apm, mid, secs, slo, &mode);
+		if(met < 0)
+			return met;
+		else if(met) {
+			hi = mid;
+			if(tune_modedepth(mode) >= bestdepth) {
+				best = mid;
+				bestdepth = tune_modedepth(mode);
+			}
+		} else
+			lo = mid + 1;
+	}
+
+	return best;
+}
+
+int32_t
+ata_autotune( struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t secs,
+				struct ata_slo *slo, struct ata_policystore *store )
+{
+	struct ata_ident ident;
+	struct ata_policy *policy;
+	char model[41], serial[21];
+	int32_t apm = POLICY_UNSET, aac = POLICY_UNSET;
+	uint32_t origapm = 0, origaac = 0;
+	int32_t rc;
+
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+	ata_identstrings(&ident, model, serial);
+
+	// the levels to put back if no result is found, with AAC levels
+	// below 128 reserved, as for a sweep
+	if(ident.cmd_enabled2 & 8)
+		origapm = ident.apm_value & 0xFF;
+	if( (ident.cmd_enabled2 & 0x200) && ((ident.aac_value & 0xFF) > 127) )
+		origaac = (ident.aac_value & 0xFF) - 127;
+
+	// a drive of the same model has already been tuned
+	policy = ata_policyfind(store, model, "");
+	if( (policy != NULL) && ((policy->val[POLICY_APM] != POLICY_UNSET) ||
+			(policy->val[POLICY_AAC] != POLICY_UNSET)) ) {
+		printf("Using tuned settings for %s\n", model);
+		return ata_policyapply(ata, chan, dev, policy);
+	}
+
+	if(ident.cmd_supp2 & 8) {
+		apm = tune_search(ata, chan, dev, true, ATA_APM_MINPERF,
+						ATA_APM_MAXPERF, secs, slo);
+		if(apm == 0)
+			printf("Objective can't be met even at maximum performance\n");
+		rc = (apm > 0)? ata_setapm(ata, chan, dev, apm) : -1;
+	}
+
+	if( !rc && (ident.cmd_supp2 & 0x200) ) {
+		aac = tune_search(ata, chan, dev, false, 1,
+						ATA_AUTOACOUSTIC_MAXPERF - 127, secs, slo);
+		if(aac == 0)
+			printf("Objective can't be met even at maximum acoustic level\n");
+		rc = (aac > 0)? ata_setacoustic(ata, chan, dev, aac) : -1;
+	}
+
+	if( !rc && (apm == POLICY_UNSET) && (aac == POLICY_UNSET) ) {
+		printf("Drive supports neither APM nor AAC\n");
+		rc = -1;
+	}
+
+	if(rc) {
+		if( (ident.cmd_supp2 & 8) && ata_setapm(ata, chan, dev, origapm) )
+			printf("warning: could not restore the original APM level\n");
+		if( (ident.cmd_supp2 & 0x200) && ata_setacoustic(ata, chan, dev, origaac) )
+			printf("warning: could not restore the original AAC level\n");
+		return rc;
+	}
+
+	policy = ata_policyset(store, POLICY_MODEL, model);
+	if(policy == NULL)
+		return -1;
+	policy->val[POLICY_APM] = apm;
+	policy->val[POLICY_AAC] = aac;
+
+	printf("Tuned %s: APM %d, AAC %d\n", model, apm, aac);
+	return ata_policysave(store);
+}
+
+// find the NCQ depth at which the drive gives the most random read IOPS
+// while meeting the objective's latency limits, trying depths from 1,
+// which turns NCQ off, in powers of two up to the most it supports.   The
+// result is set, and recorded against the drive's model like APM and AAC.
+int32_t
+ata_tunedepth( struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t secs,
+				struct ata_slo *slo, struct ata_policystore *store )
+{
+	struct ata_ident ident;
+	struct ata_identinfo info;
+	struct ata_benchresult res[8];
+	struct ata_policy *policy;
+	uint32_t depths[8], orig, depth, ndepths = 0, i;
+	int32_t best = -1, rc;
+	bool met[8];
+
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+	ata_identdecode(&ident, &info);
+
+	if( !(info.supported & IDENT_NCQ) ) {
+		printf("%s doesn't support NCQ\n", info.model);
+		return -1;
+	}
+	if( ata_getqueuedepth(ata, chan, dev, &orig) ) {
+		perror("can't read the queue depth");
+		return -1;
+	}
+
+	for(depth = 1; depth < info.queuedepth; depth *= 2)
+		depths[ndepths++] = depth;
+	depths[ndepths++] = info.queuedepth;
+
+	ata_printbenchheader("depth");
+	for(i = 0; !rc && (i < ndepths); i++) {
+		char label[8];
+
+		rc = ata_setqueuedepth(ata, chan, dev, depths[i]);
+		if(rc)
+			perror("can't set the queue depth");
+		else
+			rc = ata_benchdepth(ata, chan, dev, secs, depths[i], &res[i]);
+		if(rc)
+			break;
+
+		// only the latency limits and IOPS minimum mean anything here
+		met[i] = !( (slo->p50 && (res[i].lat_p50 > slo->p50)) ||
+				(slo->p95 && (res[i].lat_p95 > slo->p95)) ||
+				(slo->p99 && (res[i].lat_p99 > slo->p99)) ||
+				(slo->iops && (res[i].rand_iops < slo->iops)) );
+		if( met[i] && ((best < 0) || (res[i].rand_iops > res[best].rand_iops)) )
+			best = i;
+
+		snprintf(label, sizeof(label), "%u", depths[i]);
+		ata_printbenchresult(label, &res[i]);
+	}
+
+	if( !rc && (best < 0) )
+		printf("Objective can't be met at any queue depth\n");
+	if( rc || (best < 0) ) {
+		ata_setqueuedepth(ata, chan, dev, orig);
+		return -1;
+	}
+
+	for(i = 0; i < (uint32_t) best; i++)
+		if( met[i] && (res[i].rand_iops >= res[best].rand_iops * (1 - TUNE_DEPTH_SLACK)) ) {
+			best = i;
+			break;
+		}
+
+	rc = ata_setqueuedepth(ata, chan, dev, depths[best]);
+	if(rc) {
+		perror("can't set the queue depth");
+		return rc;
+	}
+
+	policy = ata_policyset(store, POLICY_MODEL, info.model);
+	if(policy == NULL)
+		return -1;
+	policy->val[POLICY_QUEUE_DEPTH] = depths[best];
+
+	printf("Tuned %s: queue depth %u, %.1f IOPS, p99 %.2f ms\n", info.model,
+			depths[best], res[best].rand_iops, res[best].lat_p99);
+	return ata_policysave(store);
+}
@@ -0,0 +1,26 @@
+#ifndef _TUNE_H_
+#define _TUNE_H_
+
+#include <stdint.h>
+
+#include "atagen.h"
+#include "policy.h"
+
+// a service level objective: latency limits in ms, and throughput
+// minimums.   Zero means the limit isn't used.
+struct ata_slo {
+	double		p50;
+	double		p95;
+	double		p99;
+	double		wake;	// first read after TUNE_IDLE_GAP seconds idle
+	double		iops;
+	double		mbps;
+};
+
+int32_t ata_parseslo( char *spec, struct ata_slo *slo );
+int32_t ata_autotune( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs, struct ata_slo *slo, struct ata_policystore *store );
+int32_t ata_tunedepth( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				uint32_t secs, struct ata_slo *slo, struct ata_policystore *store );
+
+#endif
@@ -32,54 +32,172 @@
 #include <stdint.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
+#include <math.h>
 
 #include "atadefs.h"
 #include "atagen.h"
+#include "epc.h"
+#include "identify.h"
+#include "scsi.h"
+#include "util.h"
+
+// describe a drive for messages: by its device node if it was
+// addressed by one, otherwise by its channel and device.   The label
+// is kept in the struct ATA, so each scheduler worker has its own.
+const char * ata_devlabel( struct ATA *ata, uint32_t chan, uint32_t dev )
+{
+	if(ata->devpath[0])
+		snprintf(ata->label, sizeof(ata->label), "%s", ata->devpath);
+	else
+		snprintf(ata->label, sizeof(ata->label), "chan %d, dev %d", chan, dev);
 
-// calculate the idle timer value to send to the drive.
+	return ata->label;
+}
 
-int32_t 
-ata_getidleval(uint32_t idle_mins, uint16_t *timer_val)
+// copy the model and serial number out of the IDENTIFY data as
+// C strings, without the padding spaces
+void ata_identstrings( struct ata_ident *ident, char *model, char *serial )
 {
-	int32_t rc = 0;
-	
-	// idle value of 0 disabled spindown
-	if( idle_mins == 0 )
-		*timer_val = 0;
-	
-	// value is (value*5)s between 1 and 20 minutes
-	if( idle_mins <= 20 )
-		*timer_val = (idle_mins*60)/5;
-	
-	// special case for 21 minutes
-	if( idle_mins == 21 )
-		*timer_val = 252;
+	ata_identstring(model, ident->model, sizeof(ident->model));
+	ata_identstring(serial, ident->serial, sizeof(ident->serial));
+}
+
+// format the drive's World Wide Name from IDENTIFY words 108-111,
+// or return an empty string if it doesn't report one
+void ata_identwwn( struct ata_ident *ident, char *wwn )
+{
+	uint16_t *buf = (uint16_t*) ident;
+
+	if( (buf[87] & 0xC100) == 0x4100 )
+		sprintf(wwn, "0x%04x%04x%04x%04x", buf[108], buf[109], buf[110], buf[111]);
+	else
+		wwn[0] = 0;
+}
 
-	// there is no encoding for values between 21 and 30 minutes
-	if( (idle_mins > 21) && (idle_mins < 30) ) {
-		printf("cannot set timeout for values 20-30 minutes\n" );
-		rc = -2;
+// the idle and standby timer values a drive can be given, as runs of
+// values which go up in equal steps.   253 means a vendor defined
+// timeout and 254 is reserved, so neither has a duration.
+static const struct ata_timerrange {
+	uint8_t		first, last;	// timer values in the run
+	uint32_t	secs;			// the first's duration
+	uint32_t	step;			// and how much each next one adds
+} ata_timerranges[] = {
+	{   0,   0,    0,    0 },	// timer off
+	{   1, 240,    5,    5 },	// 5 seconds to 20 minutes
+	{ 241, 251, 1800, 1800 },	// 30 minutes to 5.5 hours
+	{ 252, 252, 1260,    0 },	// 21 minutes
+	{ 255, 255, 1275,    0 }	// 21 minutes 15 seconds
+};
+
+#define ATA_NTIMERRANGES (sizeof(ata_timerranges) / sizeof(ata_timerranges[0]))
+
+// find the timer value closest to secs, preferring the longer of two
+// equally close ones, and never turning the timer off unless asked to.
+// Returns the duration it gives.
+uint32_t
+ata_timerencode(uint32_t secs, uint8_t *timer_val)
+{
+	uint32_t best = 0, bestdiff = UINT32_MAX;
+	size_t i;
+
+	for(i = 0; i < ATA_NTIMERRANGES; i++) {
+		const struct ata_timerrange *r = &ata_timerranges[i];
+		uint32_t n = 0, val, diff;
+
+		if( (r->secs == 0) && (secs != 0) )
+			continue;
+		if( (r->step != 0) && (secs > r->secs) )
+			n = (secs - r->secs + r->step/2) / r->step;
+		if(n > (uint32_t) (r->last - r->first))
+			n = r->last - r->first;
+
+		val = r->secs + n * r->step;
+		diff = (val > secs)? val - secs : secs - val;
+		if( (diff < bestdiff) || ((diff == bestdiff) && (val > best)) ) {
+			best = val;
+			bestdiff = diff;
+			*timer_val = r->first + n;
+		}
 	}
-	
-	// after 30 mins, encoding is (idle_mins-29)*30, so you
-	// can only encode multiples of 30 minutes
-	if( idle_mins >= 30 ) {
-		// if it's not a multiple of 30 minutes, or it's greater than 5 hours,
-		// we can't handle it.
-		if( (((idle_mins % 30) != 0) || (idle_mins > 330)) && (idle_mins != ATA_IDLEVAL_IMMEDIATE) ) {
-			printf( "idle value must be a multiple of 30 minutes, "
-					"up to 5 hours\n" );
-			rc = -2;
+
+	return best;
+}
+
+// the duration of a timer value, or -1 if it doesn't have one
+int32_t
+ata_timerdecode(uint8_t timer_val, uint32_t *secs)
+{
+	size_t i;
+
+	for(i = 0; i < ATA_NTIMERRANGES; i++) {
+		const struct ata_timerrange *r = &ata_timerranges[i];
+
+		if( (timer_val >= r->first) && (timer_val <= r->last) ) {
+			*secs = r->secs + (timer_val - r->first) * r->step;
+			return 0;
 		}
+	}
+	return -1;
+}
 
-		// otherwise, calculate the timer value
-		if(idle_mins == ATA_IDLEVAL_IMMEDIATE)
-			*timer_val = ATA_IDLEVAL_IMMEDIATE;
-		else
-			*timer_val = 241 + (idle_mins/30);
+// format secs as, say, "45s", "8m", "21m15s" or "1h30m"
+char *
+ata_secsstring(uint32_t secs, char *buf, size_t len)
+{
+	uint32_t h = secs / 3600, m = (secs / 60) % 60, s = secs % 60;
+	int n = 0;
+
+	buf[0] = 0;
+	if(h)
+		n += snprintf(buf+n, len-n, "%uh", h);
+	if( m && (n < (int) len) )
+		n += snprintf(buf+n, len-n, "%um", m);
+	if( (s || (secs == 0)) && (n < (int) len) )
+		snprintf(buf+n, len-n, "%us", s);
+	return buf;
+}
+
+// describe a timer value for display
+char *
+ata_timerstring(uint8_t timer_val, char *buf, size_t len)
+{
+	uint32_t secs;
+
+	if(timer_val == ATA_TIMER_VENDOR)
+		snprintf(buf, len, "a vendor defined time");
+	else if( ata_timerdecode(timer_val, &secs) )
+		snprintf(buf, len, "reserved value %u", timer_val);
+	else
+		ata_secsstring(secs, buf, len);
+	return buf;
+}
+
+// parse an idle or standby timeout such as "45s", "8m" or "2h", or
+// "vendor" for the drive's own, into the nearest timer value, saying
+// so if it had to be rounded.   A number without a unit is in minutes.
+int32_t
+ata_parsetimer(const char *src, uint8_t *timer_val)
+{
+	char want[32], got[32];
+	uint64_t ms;
+	uint32_t secs, actual;
+
+	if( strcmp(src, "vendor") == 0 ) {
+		*timer_val = ATA_TIMER_VENDOR;
+		return 0;
 	}
 
-	return rc;
+	if( ata_parseduration(src, 60000, &ms) || (ms / 1000 > UINT32_MAX) )
+		return -1;
+	secs = (uint32_t) ((ms + 500) / 1000);
+
+	actual = ata_timerencode(secs, timer_val);
+	if(actual != secs)
+		printf("no timer value for %s, using the nearest, %s\n",
+				ata_secsstring(secs, want, sizeof(want)),
+				ata_secsstring(actual, got, sizeof(got)));
+	return 0;
 }
 
 
@@ -105,28 +223,95 @@ char * ata_getversionstring( unsigned short ata_version )
 }
 
 
+// whether a CHECK POWER MODE result is one of the standby modes: plain
+// standby, which is EPC's standby_z, or standby_y
+bool ata_powermodestandby( uint8_t mode )
+{
+	return (mode == ATA_POWERMODE_STANDBY) || (mode == ATA_POWERMODE_STANDBY_Y);
+}
+
+// describe the power mode returned by CHECK POWER MODE
+const char * ata_getpowermodestring( uint8_t mode )
+{
+	if( ata_powermodestandby(mode) )
+		return "standby";
+	else if(mode == ATA_POWERMODE_IDLE)
+		return "idle";
+	else if(mode == ATA_POWERMODE_ACTIVE)
+		return "active/idle";
+	else
+		return "unknown";
+}
+
+
 // standard *NIX usage instructions
 void usage()
 {
 	printf( "ataidle version 0.7\n\n"
 			"usage: \n"
 			"ataidle [-h] [-l] [-i] [-s] [-I idle] [-S standby] [-A acoustic] [-P apm]\n"
-			"\tchannel device\n\n"
+			"\t[-E timers] [-W wcache] [-R lookahead] [-b secs]\n"
+			"\t[-B apm|aac[:step]] [-T objective] [-a] [-f policyfile] [-D]\n"
+			"\t[-w] [-F] [-M metricsfile] [-j jobs] [-J jobs] [-n identfile]\n"
+			"\t[-k snapshotfile] [-K snapshotfile] [-L probes] [-U puis] [-u]\n"
+			"\t[-X mode] [-Q depth] [-q objective] [-G] [-t secs]\n"
+			"\t[-Z linkpolicy] [-z probes]\n"
+			"\tchannel device | drive\n\n"
 			"arguments:\n"
 		    "-h\t\tshow this help\n"
 			"-l\t\tlist installed devices\n"
-			"-I\t\tset the idle timeout in minutes\n"
+			"-I\t\tset the idle timeout, e.g. 45s, 8m or 2h (default minutes)\n"
 			"-i\t\tput the drive into idle mode immediately\n"
-			"-S\t\tset the standby timeout in minutes\n"
+			"-S\t\tset the standby timeout, e.g. 45s, 8m or 2h (default minutes)\n"
 			"-s\t\tput the drive into standby mode immediately\n"
 			"-A\t\tset the acoustic level, values 1-127\n"
 			"-P\t\tset the power management level, values 1-254\n"
-		 	"channel\t\tthe channel the drive is connected to\n"
-		 	"device\t\tthe device (0 or 1) the drive is connected to\n\n"
+			"-E, --epc\tset EPC timers, e.g. idle_b=5s,standby_z=2h, or off\n"
+			"-W\t\tdisable (0) or enable (1) the write cache\n"
+			"-R\t\tdisable (0) or enable (1) read look-ahead\n"
+			"-b, --bench\tbenchmark reads for the given number of seconds\n"
+			"-B, --sweep\tbenchmark at each apm[:step] or aac[:step] level\n"
+			"-T, --tune\ttune APM and AAC to meet an objective, e.g. p99=20\n"
+			"-a, --apply\tapply the drive's settings from the policy file,\n"
+			"\t\tor every drive's if no drive is given\n"
+			"-f, --policy\tuse the given policy file\n"
+			"-D, --daemon\trun the unload/spindown ladder from the policy file\n"
+			"-M, --metrics\twrite the daemon's power state counters to a file\n"
+			"-F, --flush\tflush dirty data and the write cache before standby\n"
+			"-w, --who-woke\treport which processes wake the drives from standby\n"
+			"-j, --jobs\tcommands in flight at once when acting on every drive\n"
+			"-J, --controller-jobs\n"
+			"\t\tcommands in flight at once on any one controller\n"
+			"-n, --inventory\tlist the drives in a file of IDENTIFY pages\n"
+			"-k, --snapshot\trecord every drive's settings to a file, by WWN\n"
+			"-K, --restore\tput back the settings in a snapshot which differ\n"
+			"-L, --latency\tprobe every drive's command latency and flag those\n"
+			"\t\tmuch slower than the others of their model\n"
+			"-U, --puis\tdisable (0) or enable (1) power-up in standby\n"
+			"-u, --spinup\tspin up the drive, or every waiting drive in the\n"
+			"\t\tpolicy's spinup_order\n"
+			"-X, --xfer\tset the transfer mode, e.g. udma5, mdma2 or pio4\n"
+			"-Q, --queue-depth\n"
+			"\t\tset the NCQ queue depth, 1 for NCQ off\n"
+			"-q, --tune-depth\n"
+			"\t\tfind the queue depth with the most IOPS within an\n"
+			"\t\tobjective, e.g. p99=50\n"
+			"-G, --devstats\tshow the drive's Device Statistics log, or one\n"
+			"\t\tline of them per drive if no drive is given\n"
+			"-t, --top\tshow every drive's power state and activity live,\n"
+			"\t\tupdated every secs seconds\n"
+			"-Z, --link-pm\tset the host's SATA link power policy, e.g. min_power\n"
+			"-z, --link-probe\n"
+			"\t\tmeasure the latency each link power policy adds to\n"
+			"\t\tthe first read after idle, over the given probes\n"
+			"channel\t\tthe channel the drive is connected to\n"
+		 	"device\t\tthe device (0 or 1) the drive is connected to\n"
+			"drive\t\tthe drive's WWN, serial number, /dev/disk/by-id name\n"
+			"\t\tor device node, e.g. wwn:0x5000c500a1b2c3d4\n\n"
 			"if no options are specified, information about the device\n"
 			"connected at <channel,device> will be shown\n\n"
-		 	"note:\tboth channel and device can be found\n"
-		   	"\tby running \"ataidle -l\"\n" );
+		 	"note:\tthe channel and device, and the drive names,\n"
+		   	"\tcan be found by running \"ataidle -l\"\n" );
 	exit(EXIT_FAILURE);
 }
 
@@ -134,8 +319,13 @@ void usage()
 // and simplified interface.
 int32_t ata_strtolong(char * src, long * dest)
 {
-	long val = strtol(src, NULL, 10);
+	long val;
 	int32_t rc = -1;
+
+	// strtol only sets errno on failure, so clear whatever an earlier
+	// call, such as realpath() resolving a drive's name, left there
+	errno = 0;
+	val = strtol(src, NULL, 10);
 	if( ! ((errno == EINVAL) || (errno == ERANGE)) ) {
 		rc = 0;
 		*dest = val;
@@ -144,46 +334,84 @@ int32_t ata_strtolong(char * src, long * dest)
 	return rc;
 }	
 
-// check that the user has supplied us with valid arguments
-bool checkargs(int argc, char ** argv, char * optstr, bool *needchandev) 
+// no drive timer goes anywhere near a year, and capping durations there
+// keeps the conversion to an integer defined
+#define UTIL_MAXDURATION	(365 * 24 * 3600000.0)
+
+// parse a duration such as "500ms", "45s", "8m" or "1.5h" into
+// milliseconds.   A number without a unit is in units of defunit ms.
+int32_t ata_parseduration(const char * src, uint64_t defunit, uint64_t * ms)
+{
+	char * end;
+	double val = strtod(src, &end);
+	uint64_t unit = defunit;
+
+	if( (end == src) || !isfinite(val) || (val < 0) )
+		return -1;
+
+	if( strcmp(end, "ms") == 0 )
+		unit = 1;
+	else if( strcmp(end, "s") == 0 )
+		unit = 1000;
+	else if( strcmp(end, "m") == 0 )
+		unit = 60000;
+	else if( strcmp(end, "h") == 0 )
+		unit = 3600000;
+	else if( *end != 0 )
+		return -1;
+
+	if(val * unit > UTIL_MAXDURATION)
+		return -1;
+	*ms = (uint64_t) (val * unit + 0.5);
+	return 0;
+}
+
+// check that the user has supplied us with valid arguments, and keep
+// each option in opts, which has room for argc of them, so that they
+// needn't be parsed again
+bool checkargs(int argc, char ** argv, char * optstr,
+				const struct option * longopts, bool *needchandev,
+				struct ata_option *opts, int *nopts)
 {
 	int ch;
-	int numargs = 1; // 1 argument, the name of the program
 	bool goodargs = false;
+	bool optdev = false;
 	*needchandev = false;
+	*nopts = 0;
 	
-	while ((ch = getopt(argc, argv, optstr)) != -1) {
-		numargs++;
-		switch(ch) {	
-			case 'S':
-				*needchandev = true;
-				numargs++;
-				break;
-
-			case 's':
-				*needchandev = true;
-				break;
-
-			case 'I':
-				*needchandev = true;
-				numargs++;
-				break;
-
-			case 'i':
-				*needchandev = true;
-				break;
+	while ((ch = getopt_long(argc, argv, optstr, longopts, NULL)) != -1) {
+		opts[*nopts].ch = ch;
+		opts[*nopts].arg = optarg;
+		(*nopts)++;
 
-			case 'P':
-				*needchandev = true;
-				numargs++;
+		switch(ch) {	
+			case 'D':
+			case 'a':
+			case 'w':
+			case 'u':
+			case 'G':
+			case 't':
+				// the daemon manages, the policy is applied
+				// to, the wake monitor watches, spin-up starts,
+				// the statistics are read from and the live
+				// view shows either the given device or all
+				// of them
+				optdev = true;
 				break;
 
-			case 'A':
-				*needchandev = true;
-				numargs++;
+			case 'f':
+			case 'F':
+			case 'M':
+			case 'j':
+			case 'J':
+				// these modify what the other options do
 				break;
 
 			case 'l':
+			case 'n':
+			case 'k':
+			case 'K':
+			case 'L':
 				// since we're just listing devices
 				// found in the system, we don't need
 				// any additional arguments or anything,
@@ -193,27 +421,36 @@ bool checkargs(int argc, char ** argv, char * optstr, bool *needchandev)
 			case 'h':
 				printf("help:\n");
 				usage();
+
+			case '?':
+				// getopt has already complained about it
+				return false;
+
+			default:
+				// everything else acts on a device
+				*needchandev = true;
+				break;
 		}
 	}
 
-	// if we've only got 3 arguments,
+	// if we've only got the channel and device, or a name,
 	// then we'll want to show the info
 	// about the specified device.
-	if(argc == 3)
+	if( ((optind == 1) && (argc > 1)) || (optdev && (argc > optind)) )
 		*needchandev = true;
 
-	if(*needchandev)
-		numargs += 2;
-
-	if(argc == numargs) {
+	// the channel and device, or the drive's name,
+	// must be the only arguments left after the options
+	if(*needchandev) {
 		long lval;
-		if( (*needchandev) && ((!ata_strtolong(argv[argc-1], &lval)) &&
+		if( (argc - optind == 2) && ((!ata_strtolong(argv[argc-1], &lval)) &&
 			(!ata_strtolong(argv[argc-2], &lval))) )
 			// then valid args
 			goodargs = true;
-		else if(!(*needchandev))
+		else if(argc - optind == 1)
 			goodargs = true;
-	}
+	} else if(argc == optind)
+		goodargs = true;
 
 	return goodargs;
 }
@@ -221,92 +458,137 @@ bool checkargs(int argc, char ** argv, char * optstr, bool *needchandev)
 
 
 
-void byteswap(char * buf, int from, int to)
-{
-	int i;
-	for(i = from; i <= to; i+=2) {
-		char b1 = buf[i];
-		buf[i] = buf[i+1];
-		buf[i+1] = b1;
-	}
-}
-
-void strpack(char * buf, int from, int to)
+// the signalling rate of a SATA generation
+static const char * ata_satarate( uint8_t gen )
 {
-	int numchars = (to-from)+1;
-	char *tmpbuf = (char*) malloc(numchars*sizeof(char));
-
-	if(tmpbuf == 0) { /* malloc failed, skip the string packing */
-		fprintf(stderr, "malloc failed\n");
-		return;	
-	}
+	static const char * const rates[] = { "?", "1.5", "3.0", "6.0" };
 
-	strncpy(tmpbuf, buf+from, numchars);
-	memset(buf+from, 0, numchars);
-	int i = 0;
-
-	while(tmpbuf[i] == ' ')
-		i++;
-
-	int j, k = 0;
-	for(j = i; j < numchars; j++)
-	{
-		buf[from+k] = tmpbuf[j];
-		k++;
-	}
-
-	free(tmpbuf);
+	return (gen < 4)? rates[gen] : "?";
 }
 
-
 void ata_showdeviceinfo( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev )
 {
 	int rc = 0;
 	struct ata_ident ident;
+	struct ata_identinfo info;
+	char xfer[16], degraded[64];
 	memset(&ident, 0, sizeof(struct ata_ident));
 
 	rc = ata_ident( ata, ata_chan, ata_dev,(struct ata_ident*)  &ident );
-	int16_t * buf = (int16_t*) &ident;
 	if(!rc) {
-		char model[41];
-		char serial[21];
-		char firmware[9];
-
-		memset(model, 0, 41);
-		memset(serial, 0, 21);
-		memset(firmware, 0, 9);
-
-		strncpy(model, (void*) ident.model, 40);
-		strncpy(serial, (void*) ident.serial, 20);
-		strncpy(firmware, (void*) ident.firmware, 8);
-
-		printf("Model:\t\t\t%s\n", model);
-		printf("Serial:\t\t\t%s\n", serial);
-		printf("Firmware Rev:\t\t%s\n", firmware);
-		printf("ATA revision:\t\t%s\n", (ident.version_major > 1)? ata_getversionstring(buf[80]) : "unknown/pre ATA-2");
-		printf("Geometry:\t\t%d cyls, %d heads, %d spt\n", buf[1], buf[3], buf[6]);
-		int mbsize = ((ident.nsect[0] + (ident.nsect[1] << 16))*512)/1048576;
-		printf("Capacity:\t\t%d%s\n", (mbsize < 1024)? mbsize : mbsize/1024, (mbsize < 1024)? "MB" : "GB");
-		printf("SMART Supported: \t%s\n", (buf[82] & 1)? "yes" : "no" );
-		if(buf[82] & 1)
-			printf("SMART Enabled: \t\t%s\n", (buf[85] & 1)? "yes" : "no" );
-		printf("APM Supported: \t\t%s\n", (buf[83] & 8)? "yes" : "no" );
-		if(buf[83] & 8)
-			printf("APM Enabled: \t\t%s\n", (buf[86] & 8)? "yes" : "no" );
-		printf("AAC Supported: \t\t%s\n", (buf[83] & 0x200)? "yes" : "no" );
-		if(buf[83] & 0x200)
-			printf("AAC Enabled: \t\t%s\n", (buf[86] & 0x200)? "yes" : "no");
+		ata_identdecode(&ident, &info);
+
+		printf("Model:\t\t\t%s\n", info.model);
+		printf("Serial:\t\t\t%s\n", info.serial);
+		printf("Firmware Rev:\t\t%s\n", info.firmware);
+		printf("ATA revision:\t\t%s\n", (info.version > 1)? ata_getversionstring(ident.version_major) : "unknown/pre ATA-2");
+		printf("Geometry:\t\t%d cyls, %d heads, %d spt\n", info.cyls, info.heads, info.spt);
+		uint64_t mbsize = (info.sectors * info.sectorsize) / 1048576;
+		printf("Capacity:\t\t%llu%s\n", (unsigned long long) ((mbsize < 1024)? mbsize : mbsize/1024), (mbsize < 1024)? "MB" : "GB");
+		printf("Transfer Mode:\t\t%s", ata_identxfer(&info, false, xfer, sizeof(xfer)));
+		if( ata_identdegraded(&info, degraded, sizeof(degraded)) )
+			printf(" (supports %s)", ata_identxfer(&info, true, xfer, sizeof(xfer)));
+		printf("\n");
+		if(info.multsectmax) {
+			if(info.multsect)
+				printf("Multiple Sectors:\t%u (up to %u)\n", info.multsect, info.multsectmax);
+			else
+				printf("Multiple Sectors:\toff (up to %u)\n", info.multsectmax);
+		}
+		if(info.supported & IDENT_NCQ) {
+			uint32_t depth;
+
+			printf("NCQ Depth:\t\t%u supported", info.queuedepth);
+			if( !ata_getqueuedepth(ata, ata_chan, ata_dev, &depth) )
+				printf(", %u in use", depth);
+			printf("\n");
+		}
+		if(info.satamax) {
+			printf("SATA Link:\t\t");
+			if(info.sata)
+				printf("Gen%u (%s Gb/s)", info.sata, ata_satarate(info.sata));
+			else
+				printf("unknown");
+			printf(", drive supports Gen%u (%s Gb/s)\n", info.satamax,
+					ata_satarate(info.satamax));
+		}
+		if(info.satamax) {
+			char linkpm[32];
+
+			printf("HIPM Supported: \t%s\n", (info.supported & IDENT_HIPM)? "yes" : "no" );
+			printf("DIPM Supported: \t%s\n", (info.supported & IDENT_DIPM)? "yes" : "no" );
+			if(info.supported & IDENT_DIPM)
+				printf("DIPM Enabled: \t\t%s\n", (info.enabled & IDENT_DIPM)? "yes" : "no" );
+			printf("DevSleep Supported: \t%s\n", (info.supported & IDENT_DEVSLEEP)? "yes" : "no" );
+			if(info.supported & IDENT_DEVSLEEP)
+				printf("DevSleep Enabled: \t%s\n", (info.enabled & IDENT_DEVSLEEP)? "yes" : "no" );
+			if( !ata_getlinkpm(ata, ata_chan, ata_dev, linkpm, sizeof(linkpm)) )
+				printf("Link Power Policy: \t%s\n", linkpm);
+		}
+		if(degraded[0])
+			printf("Warning:\t\tbelow its capability (%s),\n"
+					"\t\t\tcheck the cable and the controller\n", degraded);
+		printf("SMART Supported: \t%s\n", (info.supported & IDENT_SMART)? "yes" : "no" );
+		if(info.supported & IDENT_SMART)
+			printf("SMART Enabled: \t\t%s\n", (info.enabled & IDENT_SMART)? "yes" : "no" );
+		if(info.enabled & IDENT_SMART) {
+			char *smart = NULL;
+			uint64_t raw;
+
+			if( !ata_smartread(ata, ata_chan, ata_dev, &smart) ) {
+				if( !ata_smartraw(smart, ATA_SMART_START_STOP, &raw) )
+					printf("Start/Stop Count: \t%llu\n", (unsigned long long) raw);
+				if( !ata_smartraw(smart, ATA_SMART_LOAD_CYCLE, &raw) )
+					printf("Load Cycle Count: \t%llu\n", (unsigned long long) raw);
+			}
+		}
+		printf("Write Cache Supported: \t%s\n", (info.supported & IDENT_WCACHE)? "yes" : "no" );
+		if(info.supported & IDENT_WCACHE)
+			printf("Write Cache Enabled: \t%s\n", (info.enabled & IDENT_WCACHE)? "yes" : "no" );
+		printf("Look-Ahead Supported: \t%s\n", (info.supported & IDENT_LOOKAHEAD)? "yes" : "no" );
+		if(info.supported & IDENT_LOOKAHEAD)
+			printf("Look-Ahead Enabled: \t%s\n", (info.enabled & IDENT_LOOKAHEAD)? "yes" : "no" );
+		printf("APM Supported: \t\t%s\n", (info.supported & IDENT_APM)? "yes" : "no" );
+		if(info.supported & IDENT_APM)
+			printf("APM Enabled: \t\t%s\n", (info.enabled & IDENT_APM)? "yes" : "no" );
+		printf("AAC Supported: \t\t%s\n", (info.supported & IDENT_AAC)? "yes" : "no" );
+		if(info.supported & IDENT_AAC)
+			printf("AAC Enabled: \t\t%s\n", (info.enabled & IDENT_AAC)? "yes" : "no");
 		
-		if((buf[86] & 0x200)) {
-			printf("Current AAC: \t\t%d\n", ((buf[94] & 0x00FF))-127);
-			printf("Vendor Recommends AAC: \t%d\n", ((buf[94] & 0xFF00) >> 8)-127);
+		if(info.enabled & IDENT_AAC) {
+			printf("Current AAC: \t\t%d\n", info.aac-127);
+			printf("Vendor Recommends AAC: \t%d\n", info.aacrecommended-127);
 		}
 
-		if((buf[86] & 8))
-			printf("APM Value: \t\t%d\n", buf[91]);
+		if(info.enabled & IDENT_APM)
+			printf("APM Value: \t\t%d\n", info.apm);
 		
+		printf("PUIS Supported: \t%s\n", (info.supported & IDENT_PUIS)? "yes" : "no" );
+		if(info.supported & IDENT_PUIS) {
+			printf("PUIS Enabled: \t\t%s\n", (info.enabled & IDENT_PUIS)? "yes" : "no" );
+			printf("PUIS Spin-Up Command: \t%s\n",
+					(info.enabled & IDENT_PUISSPINUP)? "required" : "not required" );
+			if(info.waiting)
+				printf("Waiting to Spin Up: \tyes\n");
+		}
+
+		printf("EPC Supported: \t\t%s\n", (info.supported & IDENT_EPC)? "yes" : "no" );
+		if(info.supported & IDENT_EPC) {
+			printf("EPC Enabled: \t\t%s\n", (info.enabled & IDENT_EPC)? "yes" : "no" );
+			if(info.enabled & IDENT_EPC) {
+				printf("\n");
+				ata_showepc(ata, ata_chan, ata_dev);
+				printf("\n");
+			}
+		}
+
+		uint8_t mode;
+		if(!ata_getpowermode(ata, ata_chan, ata_dev, &mode))
+			printf("Power Mode: \t\t%s\n", ata_getpowermodestring(mode));
+
 		printf("Note:\tAAC = AutoAcoustic\n");
 		printf("\tAPM = Advanced Power Management\n");
+		printf("\tPUIS = Power-Up In Standby\n");
 		printf("\tSMART = Self-Monitoring, Analysis and Reporting Technology\n");
 	} else {
 		printf("Could not get device information: is a device attached?\n");
@@ -395,81 +677,397 @@ int32_t ata_setacoustic(struct ATA *ata, int ata_chan, int ata_dev, uint32_t aco
 	return rc;
 }
 
-// command the device to spindown after idle_mins of no disk activity
-int32_t 
-ata_setidle(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t idle_mins)
+// enable or disable the drive's volatile write cache.  With the cache
+// enabled the drive acknowledges writes as soon as they are in its buffer,
+// which greatly improves write throughput at the cost of losing data still
+// in the cache on power failure.
+int32_t ata_setwritecache(struct ATA *ata, int ata_chan, int ata_dev, uint32_t wc_val)
 {
-	uint16_t timer_val = 0;
 	int32_t rc = 0;
 
-	rc = ata_getidleval( idle_mins, &timer_val );	
-		
-	if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-		ata_setataparams(ata, 0, 0);
-	else
-		ata_setataparams(ata, timer_val, 0);
+	if( wc_val > 1 ) {
+		printf("invalid write cache value: must be 0 or 1\n");
+		rc = -1;
+	}
+
+	ata_setataparams(ata, 0, 0);
+	ata_setfeature_param(ata, (wc_val)? ATA_WCACHE_ENABLE : ATA_WCACHE_DISABLE);
 
-	// send the IDLE command to the drive
 	if(!rc) {
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-			rc = ata_cmd(ata, chan, dev, ATA_IDLE_IMMEDIATE, 0);
+		rc = ata_cmd(ata, ata_chan, ata_dev, ATA__SETFEATURES, 0);
+
+		if(rc)
+			perror("Set write cache failed");
 		else
-			rc = ata_cmd(ata, chan, dev, ATA_IDLE, 0);
+			printf("Write cache %s\n", (wc_val)? "enabled" : "disabled");
 	}
+	return rc;
+}
 
-	if(rc) { 
-		if(rc == -2)
- 			printf("error setting idle timeout\n");
+// enable or disable read look-ahead, where the drive reads the sectors
+// following the requested ones into its cache in anticipation of
+// sequential access.
+int32_t ata_setlookahead(struct ATA *ata, int ata_chan, int ata_dev, uint32_t la_val)
+{
+	int32_t rc = 0;
+
+	if( la_val > 1 ) {
+		printf("invalid look-ahead value: must be 0 or 1\n");
+		rc = -1;
+	}
+
+	ata_setataparams(ata, 0, 0);
+	ata_setfeature_param(ata, (la_val)? ATA_LOOKAHEAD_ENABLE : ATA_LOOKAHEAD_DISABLE);
+
+	if(!rc) {
+		rc = ata_cmd(ata, ata_chan, ata_dev, ATA__SETFEATURES, 0);
+
+		if(rc)
+			perror("Set read look-ahead failed");
 		else
-			perror("error setting idle timeout");
-	} else {
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-				printf("set chan %d, dev %d to idle immediately\n",
-					chan, dev);
-		else if(timer_val == 0)
-			printf("turned off idle timer on chan %d, dev %d\n",
-					chan, dev);
+			printf("Read look-ahead %s\n", (la_val)? "enabled" : "disabled");
+	}
+	return rc;
+}
+
+// set the drive's transfer mode from spec, such as "udma5", "mdma2" or
+// "pio4", where the backend allows it.   A mode the drive doesn't support
+// is refused, since the drive would stop answering.
+int32_t ata_setxfermode(struct ATA *ata, int ata_chan, int ata_dev, const char *spec)
+{
+	static const struct {
+		const char	*name, *label;
+		uint8_t		base;
+	} kinds[] = {
+		{ "udma", "UDMA", ATA_XFER_UDMA },
+		{ "mdma", "MDMA", ATA_XFER_MDMA },
+		{ "pio", "PIO", ATA_XFER_PIO }
+	};
+	struct ata_ident ident;
+	struct ata_identinfo info;
+	int32_t rc;
+	long n = -1;
+	char *end;
+	size_t i;
+	int max;
+
+	for(i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+		if( strncmp(spec, kinds[i].name, strlen(kinds[i].name)) == 0 ) {
+			n = strtol(spec + strlen(kinds[i].name), &end, 10);
+			if( (end == spec + strlen(kinds[i].name)) || *end )
+				n = -1;
+			break;
+		}
+	if( (n < 0) || (n > 7) ) {
+		printf("invalid transfer mode: must be udma0-6, mdma0-2 or pio0-4\n");
+		return -1;
+	}
+
+	rc = ata_ident(ata, ata_chan, ata_dev, &ident);
+	if(rc) {
+		printf("Could not get device information: is a device attached?\n");
+		return rc;
+	}
+	ata_identdecode(&ident, &info);
+	max = (kinds[i].base == ATA_XFER_UDMA)? info.udmamax :
+			(kinds[i].base == ATA_XFER_MDMA)? info.mdmamax : info.piomax;
+	if(n > max) {
+		printf("the drive doesn't support %s\n", spec);
+		return -1;
+	}
+
+	rc = ata_setmode(ata, ata_chan, ata_dev, kinds[i].base | n);
+	if(rc)
+		perror("Set transfer mode failed");
+	else
+		printf("Transfer mode set to %s%ld\n", kinds[i].label, n);
+	return rc;
+}
+
+// enable or disable Power-Up In Standby.   With it enabled the drive
+// comes up from power on without spinning up, until it's accessed or,
+// if it needs it, sent ATA_PUIS_SPINUP, so that a chassis full of them
+// can be brought up a few at a time.
+int32_t ata_setpuis(struct ATA *ata, int ata_chan, int ata_dev, uint32_t puis_val)
+{
+	int32_t rc = 0;
+
+	if( puis_val > 1 ) {
+		printf("invalid power-up in standby value: must be 0 or 1\n");
+		rc = -1;
+	}
+
+	ata_setataparams(ata, 0, 0);
+	ata_setfeature_param(ata, (puis_val)? ATA_PUIS_ENABLE : ATA_PUIS_DISABLE);
+
+	if(!rc) {
+		rc = ata_cmd(ata, ata_chan, ata_dev, ATA__SETFEATURES, 0);
+
+		if(rc)
+			perror("Set power-up in standby failed");
 		else
-			printf("set chan %d, dev %d to idle after %d minutes\n", 
-					chan, dev, idle_mins);
+			printf("Power-up in standby %s\n", (puis_val)? "enabled" : "disabled");
 	}
 	return rc;
 }
 
-// command the device to spindown after standby_mins of no disk activity
+// command the device to spindown after timer_val's time without disk
+// activity, or never if it's 0
 int32_t 
-ata_setstandby(struct ATA *ata, uint32_t chan, uint32_t dev, uint32_t standby_mins)
+ata_setidle(struct ATA *ata, uint32_t chan, uint32_t dev, uint8_t timer_val)
 {
-	uint16_t timer_val = 0;
-	int32_t rc = 0;
+	char timeout[32];
+	int32_t rc;
+
+	if( ata_isscsi(ata, chan, dev) ) {
+		rc = ata_scsitimer(ata, chan, dev, timer_val);
+		if(!rc)
+			rc = ata_scsipower(ata, chan, dev, SCSI_POWER_FORCE_IDLE_0, SCSI_IDLE_A);
+	} else {
+		ata_setataparams(ata, timer_val, 0);
+		rc = ata_cmd(ata, chan, dev, ATA_IDLE, 0);
+	}
+
+	if(rc)
+		perror("error setting idle timeout");
+	else if(timer_val == 0)
+		printf("turned off idle timer on %s\n",
+				ata_devlabel(ata, chan, dev));
+	else
+		printf("set %s to idle after %s\n", ata_devlabel(ata, chan, dev),
+				ata_timerstring(timer_val, timeout, sizeof(timeout)));
+	return rc;
+}
 
-	rc = ata_getidleval( standby_mins, &timer_val );	
+// put the device into idle mode now
+int32_t
+ata_idleimmediate(struct ATA *ata, uint32_t chan, uint32_t dev)
+{
+	int32_t rc;
 
-	if (timer_val == ATA_IDLEVAL_IMMEDIATE)
+	if( ata_isscsi(ata, chan, dev) )
+		rc = ata_scsipower(ata, chan, dev, SCSI_POWER_FORCE_IDLE_0, SCSI_IDLE_A);
+	else {
 		ata_setataparams(ata, 0, 0);
+		rc = ata_cmd(ata, chan, dev, ATA_IDLE_IMMEDIATE, 0);
+	}
+
+	if(rc)
+		perror("error setting idle mode");
 	else
+		printf("set %s to idle immediately\n", ata_devlabel(ata, chan, dev));
+	return rc;
+}
+
+// command the device to spindown after timer_val's time without disk
+// activity, or never if it's 0.   The STANDBY command also spins the
+// drive down straight away.
+int32_t 
+ata_setstandby(struct ATA *ata, uint32_t chan, uint32_t dev, uint8_t timer_val)
+{
+	char timeout[32];
+	int32_t rc = 0;
+
+	// anything left to write would only wake the drive up
+	// again a few seconds later
+	if(ata->flush)
+		rc = ata_flush(ata, chan, dev);
+
+	if( !rc && ata_isscsi(ata, chan, dev) ) {
+		rc = ata_scsitimer(ata, chan, dev, timer_val);
+		if(!rc)
+			rc = ata_scsipower(ata, chan, dev, SCSI_POWER_FORCE_STANDBY_0, 0);
+	} else if(!rc) {
 		ata_setataparams(ata, timer_val, 0);
+		rc = ata_cmd(ata, chan, dev, ATA_STANDBY, 0);
+	}
 
-	// send the STANDBY command to the drive
-	if(!rc) {
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-			rc = ata_cmd(ata, chan, dev, ATA_STANDBY_IMMEDIATE, 0);
-		else
-			rc = ata_cmd(ata, chan, dev, ATA_STANDBY, 0);
-	}	
-	if(rc) {
- 		perror("error setting idle timeout");
-	} else {
-		if( timer_val == ATA_IDLEVAL_IMMEDIATE )
-				printf("set chan %d, dev %d to standby immediately\n",
-					chan, dev);
-		else if(timer_val == 0)
-			printf("turned off standby timer on chan %d, dev %d\n", 
-						chan, dev);
-		else
-			printf("set chan %d, dev %d to standby after %d minutes\n", 
-					chan, dev, standby_mins);
+	if(rc)
+		perror("error setting standby timeout");
+	else if(timer_val == 0)
+		printf("turned off standby timer on %s\n", 
+				ata_devlabel(ata, chan, dev));
+	else
+		printf("set %s to standby after %s\n", ata_devlabel(ata, chan, dev),
+				ata_timerstring(timer_val, timeout, sizeof(timeout)));
+	return rc;
+}
+
+// set the standby timer without spinning the drive down as STANDBY
+// does: IDLE takes the same count, and on SCSI drives the mode page
+// timer is set on its own
+int32_t
+ata_setstandbytimer(struct ATA *ata, uint32_t chan, uint32_t dev, uint8_t timer_val)
+{
+	char timeout[32];
+	int32_t rc;
+
+	if( ata_isscsi(ata, chan, dev) )
+		rc = ata_scsitimer(ata, chan, dev, timer_val);
+	else {
+		ata_setataparams(ata, timer_val, 0);
+		rc = ata_cmd(ata, chan, dev, ATA_IDLE, 0);
 	}
+
+	if(rc)
+		perror("error setting standby timeout");
+	else if(timer_val == 0)
+		printf("turned off standby timer on %s\n",
+				ata_devlabel(ata, chan, dev));
+	else
+		printf("set %s to standby after %s\n", ata_devlabel(ata, chan, dev),
+				ata_timerstring(timer_val, timeout, sizeof(timeout)));
+	return rc;
+}
+
+// put the device into standby mode now
+int32_t
+ata_standbyimmediate(struct ATA *ata, uint32_t chan, uint32_t dev)
+{
+	int32_t rc = 0;
+
+	if(ata->flush)
+		rc = ata_flush(ata, chan, dev);
+
+	if( !rc && ata_isscsi(ata, chan, dev) )
+		rc = ata_scsipower(ata, chan, dev, SCSI_POWER_FORCE_STANDBY_0, 0);
+	else if(!rc) {
+		ata_setataparams(ata, 0, 0);
+		rc = ata_cmd(ata, chan, dev, ATA_STANDBY_IMMEDIATE, 0);
+	}
+
+	if(rc)
+		perror("error setting standby mode");
+	else
+		printf("set %s to standby immediately\n",
+				ata_devlabel(ata, chan, dev));
+	return rc;
+}
+
+// read the drive's SMART attributes with SMART READ DATA
+int32_t
+ata_smartread(struct ATA *ata, uint32_t chan, uint32_t dev, char **databuf)
+{
+	int32_t rc;
+
+	ata_setataparams(ata, 0, 0);
+	ata_setdataout_params(ata, databuf, 512);
+	ata_setfeature_param(ata, ATA_SMART_READ_DATA);
+	rc = ata_cmd(ata, chan, dev, ATA__SMART, 0);
+	if(rc)
+		perror("error reading SMART data");
+
+	return rc;
+}
+
+// find attribute id in the SMART data and return its raw value.   The
+// table holds 30 entries of 12 bytes from offset 2, each with the raw
+// value in the six little-endian bytes from offset 5.
+int32_t
+ata_smartraw(const char *data, uint8_t id, uint64_t *raw)
+{
+	const unsigned char *attr = (const unsigned char*) data + 2;
+	int i, j;
+
+	for(i = 0; i < 30; i++, attr += 12) {
+		if(attr[0] != id)
+			continue;
+
+		*raw = 0;
+		for(j = 5; j >= 0; j--)
+			*raw = (*raw << 8) | attr[5 + j];
+		return 0;
+	}
+
+	return -1;
+}
+
+// write out everything which could wake the drive soon after it spins
+// down: the dirty pages of the filesystems on it, and its write cache.
+int32_t
+ata_flush(struct ATA *ata, uint32_t chan, uint32_t dev)
+{
+	struct ata_ident ident;
+	struct timespec start, end;
+	uint32_t nsynced = 0;
+	uint32_t flushcmd = ATA_FLUSH_CACHE;
+	int32_t rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	rc = ata_syncdev(ata, chan, dev, &nsynced);
+	if(rc)
+		perror("error syncing filesystems");
+
+	if( !rc && ata_isscsi(ata, chan, dev) ) {
+		rc = ata_scsiflush(ata, chan, dev);
+		if(rc)
+			perror("error flushing the write cache");
+	} else if(!rc) {
+		// drives with 48-bit addressing need the EXT flush to
+		// be sure of writing out all of their cache
+		if( !ata_ident(ata, chan, dev, &ident) &&
+				(((uint16_t*) &ident)[83] & 0x0400) )
+			flushcmd = ATA_FLUSH_CACHE_EXT;
+
+		ata_setataparams(ata, 0, 0);
+		rc = ata_cmd(ata, chan, dev, flushcmd, 0);
+		if(rc)
+			perror("error flushing the write cache");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(!rc)
+		printf("flushed %s in %.1f ms (%u filesystem%s synced)\n",
+				ata_devlabel(ata, chan, dev),
+				(end.tv_sec - start.tv_sec) * 1e3 +
+				(end.tv_nsec - start.tv_nsec) / 1e6,
+				nsynced, (nsynced == 1)? "" : "s");
+
+	return rc;
+}
+
+// unload the heads without spinning down, using IDLE IMMEDIATE with
+// the UNLOAD feature.   The drive goes idle with its heads parked, and
+// recovers from this in well under a second.
+int32_t
+ata_unload(struct ATA *ata, uint32_t chan, uint32_t dev)
+{
+	int32_t rc = 0;
+
+	if( ata_isscsi(ata, chan, dev) )
+		rc = ata_scsipower(ata, chan, dev, SCSI_POWER_FORCE_IDLE_0, SCSI_IDLE_B);
+	else {
+		ata_setataparams(ata, 0, 0);
+		ata_setfeature_param(ata, ATA_UNLOAD_FEATURE);
+		ata_setlba(ata, ATA_UNLOAD_LBA);
+		rc = ata_cmd(ata, chan, dev, ATA_IDLE_IMMEDIATE, 0);
+	}
+
+	if(rc)
+		perror("error unloading heads");
+	else
+		printf("unloaded heads on %s\n", ata_devlabel(ata, chan, dev));
+
+	return rc;
+}
+
+// ask the drive which power mode it is in.   This doesn't spin up
+// a drive in standby, so it is safe to use for monitoring.
+int32_t
+ata_getpowermode(struct ATA *ata, uint32_t chan, uint32_t dev, uint8_t *mode)
+{
+	int32_t rc = 0;
+
+	if( ata_isscsi(ata, chan, dev) )
+		return ata_scsipowermode(ata, chan, dev, mode);
+
+	ata_setataparams(ata, 0, 0);
+	rc = ata_cmd(ata, chan, dev, ATA_POWERSTATUS_GET, 0);
+
+	if(!rc)
+		*mode = ata_getresult(ata);
+
 	return rc;
 }
 
@@ -501,9 +1099,9 @@ void ata_listdevices( struct ATA *ata )
 		
 	for(i = 0; i < numdevs; i++) {
 		struct ata_ident *ident = (struct ata_ident*) (identbuf+(sizeof(struct ata_ident)*i));
-		char model[41];
-		memset(model, 0, 41);
-		strncpy(model, (void*) ident->model, 40);
+		char model[41], serial[21];
+
+		ata_identstrings(ident, model, serial);
 
 		if(ident->config != 0) {
 			printf("Channel %d, Device %d\n", (i/2), (i%2 == 0)? 0 : 1);
@@ -520,6 +1118,9 @@ int32_t ata_ident(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, struct a
 {
 	int32_t rc = 0;
 	unsigned char * buf  = NULL;
+
+	if( ata_isscsi(ata, ata_chan, ata_dev) )
+		return ata_scsiident(ata, ata_chan, ata_dev, identity);
 	
 	ata_setataparams(ata, 0, 0);
 	ata_setdataout_params(ata, (char**) &buf, 512);
@@ -532,11 +1133,6 @@ int32_t ata_ident(struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev, struct a
 		rc = ata_cmd(ata, ata_chan, ata_dev, ATA__ATAPI_IDENTIFY, 0);
 	}
 		
-	byteswap((char*)buf, 20, 39); // serial	
-	byteswap((char*)buf, 46, 52); // firmware
-	byteswap((char*)buf, 54, 92); // model
-	strpack((char*)buf, 20, 39);
-
 	if(!rc)
 		memcpy(identity, buf, sizeof(struct ata_ident));
 
@@ -1,12 +1,34 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
 
+#include <getopt.h>
+
+struct ATA;
+struct ata_ident;
+
+// an option as getopt returned it, so the command line is parsed once
+struct ata_option {
+	int		ch;
+	char	*arg;
+};
+
 void 	usage();
 int32_t ata_strtolong( char * src, long * dest );
-int32_t ata_getidleval( uint32_t idle_mins, uint16_t *timer_val );
+int32_t ata_parseduration( const char * src, uint64_t defunit, uint64_t * ms );
+uint32_t ata_timerencode( uint32_t secs, uint8_t *timer_val );
+int32_t ata_timerdecode( uint8_t timer_val, uint32_t *secs );
+int32_t ata_parsetimer( const char *src, uint8_t *timer_val );
+char *  ata_timerstring( uint8_t timer_val, char *buf, size_t len );
+char *  ata_secsstring( uint32_t secs, char *buf, size_t len );
 char *  ata_getversionstring(uint16_t ata_version);
-void	byteswap(char * buf, int from, int to);
-void	strpack(char * buf, int from, int to);
-bool	checkargs( int argc, char ** argv, char * optstr, bool * needchandev );
+bool	ata_powermodestandby(uint8_t mode);
+const char * ata_getpowermodestring(uint8_t mode);
+const char * ata_devlabel( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev );
+void	ata_identstrings( struct ata_ident *ident, char *model, char *serial );
+void	ata_identwwn( struct ata_ident *ident, char *wwn );
+int32_t	ata_smartraw( const char *data, uint8_t id, uint64_t *raw );
+bool	checkargs( int argc, char ** argv, char * optstr,
+				const struct option * longopts, bool * needchandev,
+				struct ata_option * opts, int * nopts );
 
 #endif
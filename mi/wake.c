@@ -0,0 +1,344 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// the wake monitor: watch the drives' power mode and I/O, and when a
+// drive in standby spins up, blame the processes whose storage I/O
+// moved since the last sample.   Those with files open on the drive
+// are the prime suspects; if there are none, everyone whose I/O moved
+// is.   A ranked list of offenders for each drive is printed on exit.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "wake.h"
+
+// how many offenders to name for each wake
+#define WAKE_MAXBLAME	5
+
+static volatile sig_atomic_t wake_stop = 0;
+
+static void wake_signal(int sig)
+{
+	wake_stop = 1;
+}
+
+// a process whose I/O moved while a drive woke up
+struct wake_suspect {
+	struct ata_procio	*proc;
+	uint64_t			bytes;
+	uint32_t			nfiles;		// files it has open on the drive
+};
+
+static int wake_suspectcmp( const void *a, const void *b )
+{
+	const struct wake_suspect *sa = (const struct wake_suspect*) a;
+	const struct wake_suspect *sb = (const struct wake_suspect*) b;
+
+	if( (sa->nfiles > 0) != (sb->nfiles > 0) )
+		return (sa->nfiles > 0)? -1 : 1;
+	if(sa->bytes != sb->bytes)
+		return (sa->bytes > sb->bytes)? -1 : 1;
+	return 0;
+}
+
+static int wake_offendercmp( const void *a, const void *b )
+{
+	const struct ata_wakeoffender *oa = (const struct ata_wakeoffender*) a;
+	const struct ata_wakeoffender *ob = (const struct ata_wakeoffender*) b;
+
+	if(oa->wakes != ob->wakes)
+		return (oa->wakes > ob->wakes)? -1 : 1;
+	if(oa->bytes != ob->bytes)
+		return (oa->bytes > ob->bytes)? -1 : 1;
+	return 0;
+}
+
+static struct ata_procio * wake_findproc( struct ata_wakemon *mon, int32_t pid )
+{
+	size_t lo = 0, hi = mon->nprocs;
+
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if(mon->procs[mid].pid == pid)
+			return &mon->procs[mid];
+		else if(mon->procs[mid].pid < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+// offenders are counted by command name, since a daemon
+// which wakes the drive is often a new process each time
+static int32_t wake_blame( struct ata_wakedrive *drive, const char *comm,
+				uint64_t bytes )
+{
+	struct ata_wakeoffender *off;
+	size_t i;
+
+	for(i = 0; i < drive->noffenders; i++)
+		if( strcmp(drive->offenders[i].comm, comm) == 0 )
+			break;
+
+	if(i == drive->noffenders) {
+		if( drive->noffenders == drive->maxoffenders ) {
+			size_t newmax = (drive->maxoffenders)? drive->maxoffenders * 2 : 8;
+			struct ata_wakeoffender *offs = (struct ata_wakeoffender*)
+					realloc(drive->offenders, newmax * sizeof(struct ata_wakeoffender));
+			if(offs == 0) {
+				fprintf(stderr, "malloc failed\n");
+				return -1;
+			}
+			drive->offenders = offs;
+			drive->maxoffenders = newmax;
+		}
+		off = &drive->offenders[drive->noffenders++];
+		memset(off, 0, sizeof(struct ata_wakeoffender));
+		snprintf(off->comm, sizeof(off->comm), "%s", comm);
+	}
+
+	off = &drive->offenders[i];
+	off->wakes++;
+	off->bytes += bytes;
+
+	return 0;
+}
+
+// the drive woke up since the last sample: work out who did it from
+// the difference between the old and new process samples
+static int32_t wake_attribute( struct ATA *ata, struct ata_wakemon *mon,
+				struct ata_wakedrive *drive, struct ata_procio *procs, size_t nprocs )
+{
+	struct wake_suspect *suspects;
+	size_t nsuspects = 0, nblamed = 0, i;
+	char when[16];
+	time_t now = time(NULL);
+	int32_t rc = 0;
+
+	suspects = (struct wake_suspect*) calloc(nprocs + 1, sizeof(struct wake_suspect));
+	if(suspects == 0) {
+		fprintf(stderr, "malloc failed\n");
+		return -1;
+	}
+
+	// a process which started since the last sample is charged for all
+	// of its I/O.   Only the suspects have their open files checked,
+	// since that's far more work than reading the I/O counters.
+	for(i = 0; i < nprocs; i++) {
+		struct ata_procio *old = wake_findproc(mon, procs[i].pid);
+		uint64_t before = (old)? old->iobytes : 0;
+
+		if(procs[i].iobytes <= before)
+			continue;
+		suspects[nsuspects].proc = &procs[i];
+		suspects[nsuspects].bytes = procs[i].iobytes - before;
+		if( ata_getprocfiles(ata, drive->chan, drive->dev, procs[i].pid,
+				&suspects[nsuspects].nfiles) )
+			suspects[nsuspects].nfiles = 0;
+		nsuspects++;
+	}
+
+	qsort(suspects, nsuspects, sizeof(struct wake_suspect), wake_suspectcmp);
+
+	// if anyone had files open on the drive, it was one of them
+	if( (nsuspects > 0) && (suspects[0].nfiles > 0) )
+		while( (nsuspects > 0) && (suspects[nsuspects - 1].nfiles == 0) )
+			nsuspects--;
+
+	drive->wakes++;
+	strftime(when, sizeof(when), "%H:%M:%S", localtime(&now));
+	printf("%s %s woke up:", when, drive->label);
+	for(i = 0; !rc && (i < nsuspects) && (i < WAKE_MAXBLAME); i++) {
+		struct wake_suspect *s = &suspects[i];
+
+		printf("%s %s[%d] %llu bytes%s", (i)? "," : "", s->proc->comm,
+				s->proc->pid, (unsigned long long) s->bytes,
+				(s->nfiles)? " (files open on it)" : "");
+		rc = wake_blame(drive, s->proc->comm, s->bytes);
+		nblamed++;
+	}
+	if(nblamed == 0) {
+		printf(" no process did any I/O");
+		drive->unexplained++;
+	}
+	printf("\n");
+
+	free(suspects);
+	return rc;
+}
+
+// add the drive at chan, dev to the monitor
+int32_t
+ata_wakeadd( struct ATA *ata, struct ata_wakemon *mon, uint32_t chan, uint32_t dev )
+{
+	struct ata_wakedrive *drive;
+
+	if( mon->ndrives == mon->maxdrives ) {
+		size_t newmax = (mon->maxdrives)? mon->maxdrives * 2 : 8;
+		struct ata_wakedrive *drives = (struct ata_wakedrive*)
+				realloc(mon->drives, newmax * sizeof(struct ata_wakedrive));
+		if(drives == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return -1;
+		}
+		mon->drives = drives;
+		mon->maxdrives = newmax;
+	}
+
+	drive = &mon->drives[mon->ndrives];
+	memset(drive, 0, sizeof(struct ata_wakedrive));
+	drive->chan = chan;
+	drive->dev = dev;
+	snprintf(drive->devpath, sizeof(drive->devpath), "%s", ata->devpath);
+	snprintf(drive->label, sizeof(drive->label), "%s", ata_devlabel(ata, chan, dev));
+
+	// drives which can't tell us their power mode, or whose
+	// I/O can't be counted, can't be watched
+	if( ata_getpowermode(ata, chan, dev, &drive->mode) ||
+			ata_getiocount(ata, chan, dev, &drive->ios) ) {
+		printf("%s: can't read its power mode and I/O count, skipping\n",
+				drive->label);
+		return 1;
+	}
+
+	mon->ndrives++;
+	return 0;
+}
+
+static void wake_report( struct ata_wakemon *mon )
+{
+	size_t i, j;
+
+	printf("\nWakes by drive:\n\n");
+	for(i = 0; i < mon->ndrives; i++) {
+		struct ata_wakedrive *drive = &mon->drives[i];
+
+		printf("%s: %u wake%s", drive->label, drive->wakes,
+				(drive->wakes == 1)? "" : "s");
+		if(drive->unexplained)
+			printf(", %u unexplained", drive->unexplained);
+		printf("\n");
+
+		qsort(drive->offenders, drive->noffenders,
+				sizeof(struct ata_wakeoffender), wake_offendercmp);
+		for(j = 0; j < drive->noffenders; j++)
+			printf("\t%5u  %-16s %llu bytes\n", drive->offenders[j].wakes,
+					drive->offenders[j].comm,
+					(unsigned long long) drive->offenders[j].bytes);
+	}
+}
+
+// run until interrupted, then print the offenders for each drive
+int32_t
+ata_wakerun( struct ATA *ata, struct ata_wakemon *mon )
+{
+	struct sigaction sa;
+	int32_t rc = 0;
+	size_t i;
+
+	if(mon->ndrives == 0) {
+		printf("no drives to watch\n");
+		return -1;
+	}
+
+	if( ata_getprocio(&mon->procs, &mon->nprocs) ) {
+		printf("can't read the processes' I/O counters\n");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = wake_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("watching %lu drive%s for wake-ups, interrupt to finish\n",
+			(unsigned long) mon->ndrives, (mon->ndrives == 1)? "" : "s");
+	fflush(stdout);
+
+	while(!rc && !wake_stop) {
+		struct ata_procio *procs;
+		size_t nprocs;
+
+		sleep(mon->interval);
+		if(wake_stop)
+			break;
+
+		if( ata_getprocio(&procs, &nprocs) )
+			continue;
+
+		for(i = 0; !rc && (i < mon->ndrives); i++) {
+			struct ata_wakedrive *drive = &mon->drives[i];
+			uint8_t mode;
+			uint64_t ios;
+
+			strcpy(ata->devpath, drive->devpath);
+			if( ata_getpowermode(ata, drive->chan, drive->dev, &mode) ||
+					ata_getiocount(ata, drive->chan, drive->dev, &ios) )
+				continue;
+
+			// I/O to a drive in standby wakes it up, even if it
+			// has gone back into standby by the time we look
+			if( ata_powermodestandby(drive->mode) &&
+					(!ata_powermodestandby(mode) || (ios != drive->ios)) )
+				rc = wake_attribute(ata, mon, drive, procs, nprocs);
+
+			drive->mode = mode;
+			drive->ios = ios;
+		}
+		fflush(stdout);
+
+		free(mon->procs);
+		mon->procs = procs;
+		mon->nprocs = nprocs;
+	}
+
+	wake_report(mon);
+	return rc;
+}
+
+void ata_wakefree( struct ata_wakemon *mon )
+{
+	size_t i;
+
+	for(i = 0; i < mon->ndrives; i++)
+		free(mon->drives[i].offenders);
+	free(mon->drives);
+	free(mon->procs);
+	memset(mon, 0, sizeof(struct ata_wakemon));
+}
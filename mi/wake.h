@@ -0,0 +1,44 @@
+#ifndef _WAKE_H_
+#define _WAKE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "atagen.h"
+
+// a process blamed for waking a drive
+struct ata_wakeoffender {
+	char		comm[17];
+	uint32_t	wakes;
+	uint64_t	bytes;		// the I/O it did in the windows it was blamed for
+};
+
+struct ata_wakedrive {
+	uint32_t				chan;
+	uint32_t				dev;
+	char					devpath[64];
+	char					label[64];	// for messages
+	uint8_t					mode;		// power mode at the last sample
+	uint64_t				ios;		// I/O count at the last sample
+	uint32_t				wakes;
+	uint32_t				unexplained;	// wakes nobody could be blamed for
+	struct ata_wakeoffender	*offenders;
+	size_t					noffenders;
+	size_t					maxoffenders;
+};
+
+struct ata_wakemon {
+	struct ata_wakedrive	*drives;
+	size_t					ndrives;
+	size_t					maxdrives;
+	uint32_t				interval;	// seconds between samples
+	struct ata_procio		*procs;		// every process's I/O at the last sample
+	size_t					nprocs;
+};
+
+int32_t	ata_wakeadd( struct ATA *ata, struct ata_wakemon *mon,
+				uint32_t ata_chan, uint32_t ata_dev );
+int32_t	ata_wakerun( struct ATA *ata, struct ata_wakemon *mon );
+void	ata_wakefree( struct ata_wakemon *mon );
+
+#endif
@@ -0,0 +1,321 @@
+/*-
+ * Copyright 2004 Rebecca Cran <rebecca@bsdio.com>.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+// wear budgeting: every spin-down and head unload adds to the drive's
+// Start_Stop_Count or Load_Cycle_Count, which are rated for a limited
+// number of cycles over its life.   The counters are read from SMART
+// and a sample kept for each day in the wear file, one line per drive:
+//
+//	WD-WCC4E1234567 1700000000:120:3400 1700086400:131:3610 ...
+//
+// and if the policy gives the drive a cycles_per_day budget which it's
+// going through too fast, its timeouts are stretched to slow it down.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "util.h"
+#include "policy.h"
+#include "wear.h"
+
+#define WEAR_DAY		86400
+#define WEAR_MINSPAN	3600		// don't guess a rate from less than this
+#define WEAR_MAXSTRETCH	16.0
+
+// ata_policyapplyall() applies the policy to drives from several
+// threads at once, and each reads, updates and writes back the one
+// wear file
+static pthread_mutex_t wear_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct ata_wear * wear_find( struct ata_wearstore *store, const char *serial,
+				int add )
+{
+	struct ata_wear *wear;
+	size_t i;
+
+	for(i = 0; i < store->ndrives; i++)
+		if( strcmp(store->drives[i].serial, serial) == 0 )
+			return &store->drives[i];
+
+	if(!add)
+		return NULL;
+
+	if( store->ndrives == store->maxdrives ) {
+		size_t newmax = (store->maxdrives)? store->maxdrives * 2 : 16;
+		struct ata_wear *drives = (struct ata_wear*) realloc(store->drives,
+						newmax * sizeof(struct ata_wear));
+		if(drives == 0) {
+			fprintf(stderr, "malloc failed\n");
+			return NULL;
+		}
+		store->drives = drives;
+		store->maxdrives = newmax;
+	}
+
+	wear = &store->drives[store->ndrives++];
+	memset(wear, 0, sizeof(struct ata_wear));
+	snprintf(wear->serial, sizeof(wear->serial), "%s", serial);
+
+	return wear;
+}
+
+// load the wear file.   A missing file is not an error, it just gives
+// an empty store, and lines which can't be parsed are dropped.
+int32_t ata_wearload( struct ata_wearstore *store, const char *path )
+{
+	FILE *fp;
+	char line[512];
+
+	memset(store, 0, sizeof(struct ata_wearstore));
+	store->path = path;
+
+	fp = fopen(path, "r");
+	if(fp == NULL)
+		return (errno == ENOENT)? 0 : -1;
+
+	while( fgets(line, sizeof(line), fp) ) {
+		char serial[21], *p, *tok, *save;
+		struct ata_wear *wear;
+
+		if( (sscanf(line, "%20s", serial) != 1) || (serial[0] == '#') )
+			continue;
+		if( (wear = wear_find(store, serial, 1)) == NULL ) {
+			fclose(fp);
+			return -1;
+		}
+
+		p = line + strcspn(line, " \t");
+		for(tok = strtok_r(p, " \t\n", &save); (tok != NULL) &&
+				(wear->nsamples < WEAR_MAXSAMPLES);
+				tok = strtok_r(NULL, " \t\n", &save)) {
+			struct ata_wearsample *s = &wear->samples[wear->nsamples];
+			unsigned long long t, ss, lc;
+
+			if( sscanf(tok, "%llu:%llu:%llu", &t, &ss, &lc) != 3 )
+				continue;
+			s->time = t;
+			s->startstop = ss;
+			s->loadcycle = lc;
+			wear->nsamples++;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+// write the store back out to its file, replacing it atomically
+int32_t ata_wearsave( struct ata_wearstore *store )
+{
+	char tmppath[PATH_MAX];
+	FILE *fp;
+	size_t i, j;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", store->path);
+	fp = fopen(tmppath, "w");
+	if(fp == NULL) {
+		perror(tmppath);
+		return -1;
+	}
+
+	for(i = 0; i < store->ndrives; i++) {
+		struct ata_wear *wear = &store->drives[i];
+
+		fprintf(fp, "%s", wear->serial);
+		for(j = 0; j < wear->nsamples; j++)
+			fprintf(fp, " %llu:%llu:%llu",
+					(unsigned long long) wear->samples[j].time,
+					(unsigned long long) wear->samples[j].startstop,
+					(unsigned long long) wear->samples[j].loadcycle);
+		fprintf(fp, "\n");
+	}
+
+	if( (fclose(fp) != 0) || (rename(tmppath, store->path) != 0) ) {
+		perror(store->path);
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ata_wearfree( struct ata_wearstore *store )
+{
+	free(store->drives);
+	store->drives = NULL;
+	store->ndrives = store->maxdrives = 0;
+}
+
+// record a sample of the drive's counters, keeping one a day, and work
+// out its start/stop and load cycles per day over the samples kept.
+// The rates are negative if there isn't enough history to tell.
+int32_t ata_wearupdate( struct ata_wearstore *store, const char *serial,
+				struct ata_wearsample *now, double *ssrate, double *lcrate )
+{
+	struct ata_wear *wear = wear_find(store, serial, 1);
+	struct ata_wearsample *oldest;
+	double days;
+
+	if(wear == NULL)
+		return -1;
+
+	// counters going backwards means a different drive with the
+	// same serial number, or a reset: start the history again
+	if( (wear->nsamples > 0) &&
+			((now->startstop < wear->samples[wear->nsamples - 1].startstop) ||
+			(now->loadcycle < wear->samples[wear->nsamples - 1].loadcycle)) )
+		wear->nsamples = 0;
+
+	if( (wear->nsamples == 0) ||
+			(now->time >= wear->samples[wear->nsamples - 1].time + WEAR_DAY) ) {
+		if(wear->nsamples == WEAR_MAXSAMPLES) {
+			memmove(&wear->samples[0], &wear->samples[1],
+					(WEAR_MAXSAMPLES - 1) * sizeof(struct ata_wearsample));
+			wear->nsamples--;
+		}
+		wear->samples[wear->nsamples++] = *now;
+	}
+
+	*ssrate = *lcrate = -1;
+	oldest = &wear->samples[0];
+	if(now->time >= oldest->time + WEAR_MINSPAN) {
+		days = (now->time - oldest->time) / (double) WEAR_DAY;
+		*ssrate = (now->startstop - oldest->startstop) / days;
+		*lcrate = (now->loadcycle - oldest->loadcycle) / days;
+	}
+
+	return 0;
+}
+
+// how much to stretch the timeouts of a drive doing rate cycles a day
+// against its budget.   Cycles come roughly in proportion to how often
+// the timeout expires, so stretching by the overshoot brings the rate
+// back into budget.
+static double wear_stretch( double rate, int32_t budget )
+{
+	double stretch;
+
+	if( (rate <= 0) || (budget <= 0) || (rate <= budget) )
+		return 1.0;
+
+	stretch = rate / budget;
+	return (stretch > WEAR_MAXSTRETCH)? WEAR_MAXSTRETCH : stretch;
+}
+
+// stretch a drive timer in seconds to the nearest value the drive can
+// be given, but no shorter than it was
+static int32_t wear_stretchtimer( int32_t secs, double stretch )
+{
+	uint8_t timer_val;
+	int32_t val;
+
+	if( (secs == 0) || (stretch == 1.0) )
+		return secs;
+	val = ata_timerencode((uint32_t) (secs * stretch + 0.5), &timer_val);
+	return (val < secs)? secs : val;
+}
+
+// work out the settings to use for the drive from its policy, with the
+// idle and unload timeouts stretched if it's using load cycles faster
+// than its cycles_per_day budget allows, and the standby and spindown
+// timeouts stretched if it's using start/stop cycles too fast.
+int32_t ata_wearadjust( struct ATA *ata, uint32_t chan, uint32_t dev,
+				struct ata_policy *policy, int32_t *val )
+{
+	int32_t budget = policy->val[POLICY_CYCLES];
+	struct ata_wearstore store;
+	struct ata_wearsample sample;
+	struct ata_ident ident;
+	char model[41], serial[21];
+	char *smart = NULL;
+	double ssrate, lcrate, ssstretch, lcstretch;
+	int32_t rc;
+
+	memcpy(val, policy->val, sizeof(policy->val));
+	if(budget == POLICY_UNSET)
+		return 0;
+
+	rc = ata_ident(ata, chan, dev, &ident);
+	if(!rc)
+		rc = ata_smartread(ata, chan, dev, &smart);
+	if(rc)
+		return rc;
+	ata_identstrings(&ident, model, serial);
+
+	memset(&sample, 0, sizeof(sample));
+	sample.time = time(NULL);
+	ata_smartraw(smart, ATA_SMART_START_STOP, &sample.startstop);
+	ata_smartraw(smart, ATA_SMART_LOAD_CYCLE, &sample.loadcycle);
+
+	pthread_mutex_lock(&wear_lock);
+	rc = ata_wearload(&store, ATA_WEAR_FILE);
+	if(rc)
+		perror(ATA_WEAR_FILE);
+	if(!rc)
+		rc = ata_wearupdate(&store, serial, &sample, &ssrate, &lcrate);
+	if(!rc)
+		rc = ata_wearsave(&store);
+	ata_wearfree(&store);
+	pthread_mutex_unlock(&wear_lock);
+	if(rc)
+		return rc;
+
+	ssstretch = wear_stretch(ssrate, budget);
+	lcstretch = wear_stretch(lcrate, budget);
+
+	if(ssstretch > 1.0) {
+		printf("%s: %.0f start/stop cycles a day, budget %d: "
+				"stretching standby timeouts x%.1f\n",
+				ata_devlabel(ata, chan, dev), ssrate, budget, ssstretch);
+		if(val[POLICY_STANDBY] != POLICY_UNSET)
+			val[POLICY_STANDBY] = wear_stretchtimer(val[POLICY_STANDBY], ssstretch);
+		if(val[POLICY_SPINDOWN] != POLICY_UNSET)
+			val[POLICY_SPINDOWN] = (int32_t) (val[POLICY_SPINDOWN] * ssstretch);
+	}
+
+	if(lcstretch > 1.0) {
+		printf("%s: %.0f load cycles a day, budget %d: "
+				"stretching idle timeouts x%.1f\n",
+				ata_devlabel(ata, chan, dev), lcrate, budget, lcstretch);
+		if(val[POLICY_IDLE] != POLICY_UNSET)
+			val[POLICY_IDLE] = wear_stretchtimer(val[POLICY_IDLE], lcstretch);
+		if(val[POLICY_UNLOAD] != POLICY_UNSET)
+			val[POLICY_UNLOAD] = (int32_t) (val[POLICY_UNLOAD] * lcstretch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _WEAR_H_
+#define _WEAR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "atagen.h"
+#include "policy.h"
+
+// how many daily samples of the cycle counters are kept for each
+// drive: the budget is checked against the rate over this window
+#define WEAR_MAXSAMPLES	8
+
+struct ata_wearsample {
+	uint64_t	time;		// seconds since the epoch
+	uint64_t	startstop;	// SMART Start_Stop_Count
+	uint64_t	loadcycle;	// SMART Load_Cycle_Count
+};
+
+struct ata_wear {
+	char					serial[21];
+	struct ata_wearsample	samples[WEAR_MAXSAMPLES];	// oldest first
+	size_t					nsamples;
+};
+
+struct ata_wearstore {
+	const char		*path;
+	struct ata_wear	*drives;
+	size_t			ndrives;
+	size_t			maxdrives;
+};
+
+int32_t	ata_wearload( struct ata_wearstore *store, const char *path );
+int32_t	ata_wearsave( struct ata_wearstore *store );
+void	ata_wearfree( struct ata_wearstore *store );
+int32_t	ata_wearupdate( struct ata_wearstore *store, const char *serial,
+				struct ata_wearsample *now, double *ssrate, double *lcrate );
+int32_t	ata_wearadjust( struct ATA *ata, uint32_t ata_chan, uint32_t ata_dev,
+				struct ata_policy *policy, int32_t *val );
+
+#endif